@@ -9,6 +9,52 @@
 #include "ciSpaceBrew.h"
 #include "cinder/Log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <thread>
+
+#if defined( CINDER_MSW )
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+	#define SPACEBREW_SSE2
+	#include <emmintrin.h>
+	#if defined( __AVX2__ )
+		#define SPACEBREW_AVX2
+		#include <immintrin.h>
+	#endif
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+	#define SPACEBREW_NEON
+	#include <arm_neon.h>
+#endif
+
+#if defined( SPACEBREW_ENABLE_TLS )
+	#include <websocketpp/config/asio_client.hpp>
+	#include <websocketpp/client.hpp>
+	#include <openssl/ssl.h>
+	// for SSL_SESSION_dup(), which keeps the cached sessions resumable
+	#if OPENSSL_VERSION_NUMBER < 0x10101000L
+		#error "SPACEBREW_ENABLE_TLS needs OpenSSL 1.1.1 or newer"
+	#endif
+#endif
+
 using namespace std;
 using namespace ci;
 using namespace ci::app;
@@ -28,13 +74,15 @@ Message::Message(const std::string &name, const std::string &type )
 }
 
 Message::Message( const Message &other )
-: mName( other.mName ), mType( other.mType), mValue( other.mValue )
+: mName( other.mName ), mType( other.mType), mValue( other.mValue ),
+	mRangeArray( other.mRangeArray ), mFloatArray( other.mFloatArray ), mEndpointId( other.mEndpointId )
 {
 }
 
 Message::Message( Message &&other )
 : mName( std::move( other.mName ) ), mType( std::move( other.mType ) ),
-	mValue( std::move( other.mValue ) )
+	mValue( std::move( other.mValue ) ), mRangeArray( std::move( other.mRangeArray ) ),
+	mFloatArray( std::move( other.mFloatArray ) ), mEndpointId( other.mEndpointId )
 {
 }
 	
@@ -43,6 +91,9 @@ Message& Message::operator=( const Message &other )
 	mName = other.mName;
 	mType = other.mType;
 	mValue = other.mValue;
+	mRangeArray = other.mRangeArray;
+	mFloatArray = other.mFloatArray;
+	mEndpointId = other.mEndpointId;
 	return *this;
 }
 	
@@ -51,16 +102,44 @@ Message& Message::operator=( Message &&other )
 	mName = std::move( other.mName );
 	mType = std::move( other.mType );
 	mValue = std::move( other.mValue );
+	mRangeArray = std::move( other.mRangeArray );
+	mFloatArray = std::move( other.mFloatArray );
+	mEndpointId = other.mEndpointId;
 	return *this;
 }
 	
 string Message::getJSON( const string &configName ) const
 {
+	string json = "{\"message\":{\"clientName\":\"";
+	appendEscaped( configName, json );
+	json += "\",\"name\":\"";
+	appendEscaped( mName, json );
+	json += "\",\"type\":\"";
+	appendEscaped( mType, json );
     if ( mType == "string" || mType == "boolean" ){
-        return "{\"message\":{\"clientName\":\"" + configName + "\",\"name\":\"" + mName + "\",\"type\":\"" + mType + "\",\"value\":\"" + mValue +"\"}}";
+		json += "\",\"value\":\"";
+		appendEscaped( mValue, json );
+		json += "\"}}";
     } else {
-        return "{\"message\":{\"clientName\":\"" + configName +"\",\"name\":\"" + mName + "\",\"type\":\"" + mType + "\",\"value\":" + mValue +"}}";
+		json += "\",\"value\":" + mValue + "}}";
     }
+	return json;
+}
+
+void Message::clear()
+{
+	mName.clear();
+	mType.clear();
+	mValue.clear();
+	mRangeArray.clear();
+	mFloatArray.clear();
+	mEndpointId = UNKNOWN_ENDPOINT;
+}
+
+size_t Message::getCapacity() const
+{
+	return mName.capacity() + mType.capacity() + mValue.capacity()
+		+ mRangeArray.capacity() * sizeof( int ) + mFloatArray.capacity() * sizeof( float );
 }
 
 bool Message::valueAsBoolean() const
@@ -83,6 +162,620 @@ const string& Message::valueAsString() const
 		CI_LOG_E( "This Message is not a string type! Returning raw value as string." );
     return mValue;
 }
+
+const vector<int>& Message::valueAsRangeArray() const
+{
+	if ( mType != TYPE_RANGE_ARRAY )
+		CI_LOG_E( "This Message is not a range array type! You'll most likely get an empty array." );
+	return mRangeArray;
+}
+
+const vector<float>& Message::valueAsFloatArray() const
+{
+	if ( mType != TYPE_FLOAT_ARRAY )
+		CI_LOG_E( "This Message is not a float array type! You'll most likely get an empty array." );
+	return mFloatArray;
+}
+
+void Message::decodeArray()
+{
+	if ( mType != TYPE_RANGE_ARRAY && mType != TYPE_FLOAT_ARRAY )
+		return;
+
+	if ( mType == TYPE_RANGE_ARRAY ) {
+		if ( ! parseRangeArray( mValue, mRangeArray ) )
+			CI_LOG_E( "Malformed range array: " << mValue );
+	}
+	else if ( mType == TYPE_FLOAT_ARRAY ) {
+		if ( ! parseFloatArray( mValue, mFloatArray ) )
+			CI_LOG_E( "Malformed float array: " << mValue );
+	}
+}
+
+#pragma mark Escaping
+
+namespace {
+
+inline bool needsEscape( unsigned char c )
+{
+	return c == '"' || c == '\\' || c < 0x20;
+}
+
+#if defined( SPACEBREW_SSE2 ) || defined( SPACEBREW_NEON )
+inline int countTrailingZeros( uint32_t mask )
+{
+#if defined( _MSC_VER )
+	unsigned long index;
+	_BitScanForward( &index, mask );
+	return static_cast<int>( index );
+#else
+	return __builtin_ctz( mask );
+#endif
+}
+#endif
+
+//! Returns the offset of the first character in \a data that needs escaping, or \a length
+size_t findEscape( const char *data, size_t length )
+{
+	size_t i = 0;
+#if defined( SPACEBREW_AVX2 )
+	const __m256i quote = _mm256_set1_epi8( '"' );
+	const __m256i backslash = _mm256_set1_epi8( '\\' );
+	const __m256i control = _mm256_set1_epi8( 0x1F );
+	for ( ; i + 32 <= length; i += 32 ) {
+		__m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( data + i ) );
+		// max_epu8( v, 0x1F ) == 0x1F exactly when v <= 0x1F as an unsigned byte
+		__m256i special = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, quote ), _mm256_cmpeq_epi8( v, backslash ) ),
+										   _mm256_cmpeq_epi8( _mm256_max_epu8( v, control ), control ) );
+		uint32_t mask = static_cast<uint32_t>( _mm256_movemask_epi8( special ) );
+		if ( mask )
+			return i + countTrailingZeros( mask );
+	}
+#endif
+#if defined( SPACEBREW_SSE2 )
+	const __m128i quote16 = _mm_set1_epi8( '"' );
+	const __m128i backslash16 = _mm_set1_epi8( '\\' );
+	const __m128i control16 = _mm_set1_epi8( 0x1F );
+	for ( ; i + 16 <= length; i += 16 ) {
+		__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + i ) );
+		__m128i special = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, quote16 ), _mm_cmpeq_epi8( v, backslash16 ) ),
+										_mm_cmpeq_epi8( _mm_max_epu8( v, control16 ), control16 ) );
+		uint32_t mask = static_cast<uint32_t>( _mm_movemask_epi8( special ) );
+		if ( mask )
+			return i + countTrailingZeros( mask );
+	}
+#elif defined( SPACEBREW_NEON ) && defined( __aarch64__ )
+	const uint8x16_t quote16 = vdupq_n_u8( '"' );
+	const uint8x16_t backslash16 = vdupq_n_u8( '\\' );
+	const uint8x16_t control16 = vdupq_n_u8( 0x20 );
+	for ( ; i + 16 <= length; i += 16 ) {
+		uint8x16_t v = vld1q_u8( reinterpret_cast<const uint8_t*>( data + i ) );
+		uint8x16_t special = vorrq_u8( vorrq_u8( vceqq_u8( v, quote16 ), vceqq_u8( v, backslash16 ) ), vcltq_u8( v, control16 ) );
+		if ( vmaxvq_u8( special ) )
+			break; // let the scalar loop find the exact position
+	}
+#endif
+	for ( ; i < length; ++i ) {
+		if ( needsEscape( static_cast<unsigned char>( data[i] ) ) )
+			return i;
+	}
+	return length;
+}
+
+int hexValue( char c )
+{
+	if ( c >= '0' && c <= '9' )
+		return c - '0';
+	if ( c >= 'a' && c <= 'f' )
+		return c - 'a' + 10;
+	if ( c >= 'A' && c <= 'F' )
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool parseHex4( const char *p, const char *end, uint32_t &out )
+{
+	if ( end - p < 4 )
+		return false;
+	out = 0;
+	for ( int i = 0; i < 4; ++i ) {
+		int digit = hexValue( p[i] );
+		if ( digit < 0 )
+			return false;
+		out = ( out << 4 ) | static_cast<uint32_t>( digit );
+	}
+	return true;
+}
+
+void appendUtf8( uint32_t codepoint, string &out )
+{
+	if ( codepoint < 0x80 ) {
+		out += static_cast<char>( codepoint );
+	}
+	else if ( codepoint < 0x800 ) {
+		out += static_cast<char>( 0xC0 | ( codepoint >> 6 ) );
+		out += static_cast<char>( 0x80 | ( codepoint & 0x3F ) );
+	}
+	else if ( codepoint < 0x10000 ) {
+		out += static_cast<char>( 0xE0 | ( codepoint >> 12 ) );
+		out += static_cast<char>( 0x80 | ( ( codepoint >> 6 ) & 0x3F ) );
+		out += static_cast<char>( 0x80 | ( codepoint & 0x3F ) );
+	}
+	else {
+		out += static_cast<char>( 0xF0 | ( codepoint >> 18 ) );
+		out += static_cast<char>( 0x80 | ( ( codepoint >> 12 ) & 0x3F ) );
+		out += static_cast<char>( 0x80 | ( ( codepoint >> 6 ) & 0x3F ) );
+		out += static_cast<char>( 0x80 | ( codepoint & 0x3F ) );
+	}
+}
+
+} // anonymous namespace
+
+void appendEscaped( const char *data, size_t length, string &out )
+{
+	static const char sHex[] = "0123456789abcdef";
+
+	size_t i = 0;
+	while ( i < length ) {
+		size_t clean = findEscape( data + i, length - i );
+		out.append( data + i, clean );
+		i += clean;
+		if ( i == length )
+			break;
+
+		unsigned char c = static_cast<unsigned char>( data[i++] );
+		switch ( c ) {
+			case '"':	out += "\\\""; break;
+			case '\\':	out += "\\\\"; break;
+			case '\n':	out += "\\n"; break;
+			case '\r':	out += "\\r"; break;
+			case '\t':	out += "\\t"; break;
+			case '\b':	out += "\\b"; break;
+			case '\f':	out += "\\f"; break;
+			default: {
+				char escape[] = { '\\', 'u', '0', '0', sHex[c >> 4], sHex[c & 0xF] };
+				out.append( escape, sizeof( escape ) );
+			}
+		}
+	}
+}
+
+bool appendUnescaped( const char *data, size_t length, string &out )
+{
+	const char *p = data;
+	const char *end = data + length;
+	while ( p < end ) {
+		const char *escape = static_cast<const char*>( memchr( p, '\\', end - p ) );
+		if ( ! escape ) {
+			out.append( p, end - p );
+			return true;
+		}
+		out.append( p, escape - p );
+		p = escape + 1;
+		if ( p == end )
+			return false;
+
+		switch ( *p++ ) {
+			case '"':	out += '"'; break;
+			case '\\':	out += '\\'; break;
+			case '/':	out += '/'; break;
+			case 'n':	out += '\n'; break;
+			case 'r':	out += '\r'; break;
+			case 't':	out += '\t'; break;
+			case 'b':	out += '\b'; break;
+			case 'f':	out += '\f'; break;
+			case 'u': {
+				uint32_t codepoint;
+				if ( ! parseHex4( p, end, codepoint ) )
+					return false;
+				p += 4;
+				// surrogate pairs encode codepoints above the basic multilingual plane
+				if ( codepoint >= 0xD800 && codepoint <= 0xDBFF ) {
+					uint32_t low;
+					if ( end - p < 6 || p[0] != '\\' || p[1] != 'u' || ! parseHex4( p + 2, end, low ) || low < 0xDC00 || low > 0xDFFF )
+						return false;
+					p += 6;
+					codepoint = 0x10000 + ( ( codepoint - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+				}
+				else if ( codepoint >= 0xDC00 && codepoint <= 0xDFFF ) {
+					return false;
+				}
+				appendUtf8( codepoint, out );
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+#pragma mark MessageView
+
+bool MessageView::valueAsBoolean() const
+{
+	if ( mType != TYPE_BOOLEAN )
+		CI_LOG_E( "This Message is not a boolean type! You'll most likely get 'false'." );
+	return mValue == "true";
+}
+
+int MessageView::valueAsRange() const
+{
+	if ( mType != TYPE_RANGE )
+		CI_LOG_E( "This Message is not a range type! Results may be unpredicatable." );
+
+	// same result as atoi(), without needing a terminated string
+	const char *p = mValue.data();
+	const char *end = p + mValue.size();
+	while ( p < end && isspace( static_cast<unsigned char>( *p ) ) )
+		++p;
+	bool negative = p < end && *p == '-';
+	if ( p < end && ( *p == '-' || *p == '+' ) )
+		++p;
+	int value = 0;
+	while ( p < end && *p >= '0' && *p <= '9' )
+		value = value * 10 + ( *p++ - '0' );
+	return negative ? -value : value;
+}
+
+const StringView& MessageView::valueAsString() const
+{
+	if ( mType != TYPE_STRING )
+		CI_LOG_E( "This Message is not a string type! Returning raw value as string." );
+	return mValue;
+}
+
+Message MessageView::toOwned() const
+{
+	Message message;
+	toOwned( message );
+	return message;
+}
+
+void MessageView::toOwned( Message &message ) const
+{
+	message.setName( mName.data(), mName.size() );
+	message.setType( mType.data(), mType.size() );
+	message.setValue( mValue.data(), mValue.size() );
+	message.setEndpointId( mEndpointId );
+	message.decodeArray();
+}
+
+#pragma mark MessagePool
+
+Message* MessagePool::acquire()
+{
+	if ( mFree.empty() ) {
+		mMessages.emplace_back( new Message() );
+		mFree.reserve( mMessages.size() );
+		return mMessages.back().get();
+	}
+	Message *message = mFree.back();
+	mFree.pop_back();
+	message->clear();
+	return message;
+}
+
+void MessagePool::release( Message *message )
+{
+	mFree.push_back( message );
+}
+
+#pragma mark MessageBatch
+
+void MessageBatch::append( const MessageView &view, double time )
+{
+	if ( rawOffsets.empty() )
+		rawOffsets.push_back( 0 );
+	endpointIds.push_back( view.getEndpointId() );
+	times.push_back( time );
+	if ( view.getType() == TYPE_RANGE )
+		values.push_back( static_cast<float>( view.valueAsRange() ) );
+	else if ( view.getType() == TYPE_BOOLEAN )
+		values.push_back( view.valueAsBoolean() ? 1.0f : 0.0f );
+	else
+		values.push_back( numeric_limits<float>::quiet_NaN() );
+	rawValues.append( view.getRawValue().data(), view.getRawValue().size() );
+	rawOffsets.push_back( static_cast<uint32_t>( rawValues.size() ) );
+}
+
+void MessageBatch::clear()
+{
+	endpointIds.clear();
+	times.clear();
+	values.clear();
+	rawValues.clear();
+	rawOffsets.clear();
+}
+
+#pragma mark Histogram
+
+void Histogram::add( uint64_t value )
+{
+	size_t bucket = 0;
+	while ( value >= 2 && bucket < NUM_BUCKETS - 1 ) {
+		value >>= 1;
+		++bucket;
+	}
+	buckets[bucket]++;
+	count++;
+}
+
+uint64_t Histogram::getPercentile( double fraction ) const
+{
+	uint64_t target = static_cast<uint64_t>( ceil( fraction * count ) );
+	uint64_t seen = 0;
+	for ( size_t i = 0; i < NUM_BUCKETS; ++i ) {
+		seen += buckets[i];
+		if ( seen >= target && seen > 0 )
+			return uint64_t( 2 ) << i;
+	}
+	return 0;
+}
+
+#pragma mark Arrays
+
+void quantizeRange( const float *normalized, int *out, size_t count )
+{
+	size_t i = 0;
+#if defined( SPACEBREW_SSE2 )
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 scale = _mm_set1_ps( (float)RANGE_MAX );
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128 v = _mm_loadu_ps( normalized + i );
+		v = _mm_mul_ps( _mm_min_ps( _mm_max_ps( v, zero ), one ), scale );
+		// _mm_cvtps_epi32 rounds to nearest
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out + i ), _mm_cvtps_epi32( v ) );
+	}
+#elif defined( SPACEBREW_NEON )
+	const float32x4_t zero = vdupq_n_f32( 0.0f );
+	const float32x4_t one = vdupq_n_f32( 1.0f );
+	const float32x4_t half = vdupq_n_f32( 0.5f );
+	for ( ; i + 4 <= count; i += 4 ) {
+		float32x4_t v = vld1q_f32( normalized + i );
+		v = vminq_f32( vmaxq_f32( v, zero ), one );
+		// values are non-negative, so adding 0.5 before truncating rounds to nearest
+		v = vmlaq_n_f32( half, v, (float)RANGE_MAX );
+		vst1q_s32( out + i, vcvtq_s32_f32( v ) );
+	}
+#endif
+	for ( ; i < count; ++i ) {
+		// written so nan clamps to 0, like the vector paths
+		float v = normalized[i] > 0.0f ? std::min( normalized[i], 1.0f ) : 0.0f;
+		out[i] = static_cast<int>( v * RANGE_MAX + 0.5f );
+	}
+}
+
+namespace {
+
+const char sDigitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+//! Writes \a value backwards ending at \a end, returns the first character written
+char* formatInt( int value, char *end )
+{
+	unsigned int v = value < 0 ? 0u - static_cast<unsigned int>( value ) : static_cast<unsigned int>( value );
+	while ( v >= 100 ) {
+		const char *pair = sDigitPairs + ( v % 100 ) * 2;
+		v /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	if ( v >= 10 ) {
+		const char *pair = sDigitPairs + v * 2;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+	else {
+		*--end = static_cast<char>( '0' + v );
+	}
+	if ( value < 0 )
+		*--end = '-';
+	return end;
+}
+
+const char* skipSpace( const char *p, const char *end )
+{
+	while ( p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) )
+		++p;
+	return p;
+}
+
+//! Parses the JSON number at \a p into \a out, returns the end of the number or nullptr if there
+//! is none or it doesn't fit a float. Unlike strtof it ignores the C locale and takes neither
+//! nan, inf nor hex. Up to 19 significant digits are kept, more only move the exponent.
+const char* parseFloat( const char *p, const char *end, float &out )
+{
+	bool negative = p < end && *p == '-';
+	if ( negative )
+		++p;
+	if ( p == end || *p < '0' || *p > '9' )
+		return nullptr;
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	for ( ; p < end && *p >= '0' && *p <= '9'; ++p ) {
+		if ( digits < 19 ) {
+			mantissa = mantissa * 10 + ( *p - '0' );
+			digits += mantissa > 0;
+		}
+		else
+			++exponent;
+	}
+	if ( p < end && *p == '.' ) {
+		++p;
+		if ( p == end || *p < '0' || *p > '9' )
+			return nullptr;
+		for ( ; p < end && *p >= '0' && *p <= '9'; ++p ) {
+			if ( digits < 19 ) {
+				mantissa = mantissa * 10 + ( *p - '0' );
+				digits += mantissa > 0;
+				--exponent;
+			}
+		}
+	}
+	if ( p < end && ( *p == 'e' || *p == 'E' ) ) {
+		++p;
+		bool negativeExponent = p < end && *p == '-';
+		if ( p < end && ( *p == '-' || *p == '+' ) )
+			++p;
+		if ( p == end || *p < '0' || *p > '9' )
+			return nullptr;
+		int value = 0;
+		for ( ; p < end && *p >= '0' && *p <= '9'; ++p ) {
+			// far past what a float holds either way
+			if ( value < 100000 )
+				value = value * 10 + ( *p - '0' );
+		}
+		exponent += negativeExponent ? -value : value;
+	}
+
+	// powers of ten up to 1e22 are exact in a double, so with up to 15 digits this rounds once
+	static const double sPowers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	double value = static_cast<double>( mantissa );
+	if ( mantissa == 0 )
+		value = 0;
+	else if ( exponent >= 0 && exponent <= 22 )
+		value *= sPowers[exponent];
+	else if ( exponent < 0 && exponent >= -22 )
+		value /= sPowers[-exponent];
+	else
+		value *= std::pow( 10.0, exponent );
+	// half an ulp past the largest float, from there on the float would be infinite
+	if ( value >= 3.4028235677973366e38 )
+		return nullptr;
+	out = static_cast<float>( negative ? -value : value );
+	return p;
+}
+
+//! Calls \a parseElement on each element of the JSON array in \a raw
+template<typename ParseFn>
+bool parseArray( const StringView &raw, const ParseFn &parseElement )
+{
+	const char *p = raw.data();
+	const char *end = p + raw.size();
+	p = skipSpace( p, end );
+	if ( p == end || *p++ != '[' )
+		return false;
+	p = skipSpace( p, end );
+	if ( p < end && *p == ']' )
+		return true;
+	while ( p < end ) {
+		p = parseElement( p, end );
+		if ( ! p )
+			return false;
+		p = skipSpace( p, end );
+		if ( p == end )
+			return false;
+		if ( *p == ']' )
+			return true;
+		if ( *p++ != ',' )
+			return false;
+		p = skipSpace( p, end );
+	}
+	return false;
+}
+
+} // anonymous namespace
+
+void appendRangeArray( const int *values, size_t count, string &out )
+{
+	// at most 4 characters plus a separator per range
+	size_t start = out.size();
+	out.resize( start + 2 + count * 5 );
+	char *p = &out[start];
+	*p++ = '[';
+	char scratch[12];
+	for ( size_t i = 0; i < count; ++i ) {
+		if ( i )
+			*p++ = ',';
+		char *first = formatInt( std::min( std::max( values[i], 0 ), RANGE_MAX ), scratch + sizeof( scratch ) );
+		size_t length = scratch + sizeof( scratch ) - first;
+		memcpy( p, first, length );
+		p += length;
+	}
+	*p++ = ']';
+	out.resize( p - out.data() );
+}
+
+void appendFloatArray( const float *values, size_t count, string &out )
+{
+	// "%.9g" round trips any float in at most 16 characters
+	size_t start = out.size();
+	out.resize( start + 2 + count * 17 );
+	char *p = &out[start];
+	*p++ = '[';
+	// snprintf follows the C locale, JSON always uses a dot
+	const char point = *localeconv()->decimal_point;
+	for ( size_t i = 0; i < count; ++i ) {
+		if ( i )
+			*p++ = ',';
+		if ( std::isfinite( values[i] ) ) {
+			char *number = p;
+			p += snprintf( p, 17, "%.9g", values[i] );
+			if ( point != '.' )
+				std::replace( number, p, point, '.' );
+		}
+		else
+			*p++ = '0'; // JSON has no representation for inf / nan
+	}
+	*p++ = ']';
+	out.resize( p - out.data() );
+}
+
+bool parseRangeArray( const string &raw, vector<int> &out )
+{
+	return parseRangeArray( StringView( raw.data(), raw.size() ), out );
+}
+
+bool parseFloatArray( const string &raw, vector<float> &out )
+{
+	return parseFloatArray( StringView( raw.data(), raw.size() ), out );
+}
+
+bool parseRangeArray( const StringView &raw, vector<int> &out )
+{
+	out.clear();
+	return parseArray( raw, [&out]( const char *p, const char *end ) -> const char* {
+		bool negative = p < end && *p == '-';
+		if ( negative )
+			++p;
+		if ( p == end || *p < '0' || *p > '9' )
+			return nullptr;
+		int value = 0;
+		while ( p < end && *p >= '0' && *p <= '9' ) {
+			int digit = *p++ - '0';
+			if ( value > ( std::numeric_limits<int>::max() - digit ) / 10 )
+				return nullptr;
+			value = value * 10 + digit;
+		}
+		// tolerate fractional ranges from other clients by truncating them
+		if ( p < end && ( *p == '.' || *p == 'e' || *p == 'E' ) ) {
+			while ( p < end && ( ( *p >= '0' && *p <= '9' ) || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+' ) )
+				++p;
+		}
+		out.push_back( negative ? -value : value );
+		return p;
+	} );
+}
+
+bool parseFloatArray( const StringView &raw, vector<float> &out )
+{
+	out.clear();
+	return parseArray( raw, [&out]( const char *p, const char *end ) -> const char* {
+		float value;
+		p = parseFloat( p, end, value );
+		if ( p )
+			out.push_back( value );
+		return p;
+	} );
+}
     
 #pragma mark Config
 	
@@ -101,8 +794,8 @@ Config& Config::operator=( const Config &other )
 {
 	mName = other.mName;
 	mDescription = other.mDescription;
-	mPublishers = mPublishers;
-	mSubscribers = mSubscribers;
+	mPublishers = other.mPublishers;
+	mSubscribers = other.mSubscribers;
 	return *this;
 }
 	
@@ -143,13 +836,20 @@ void Config::addPublish( const Message &m )
 
 string Config::getJSON() const
 {
-    string message = "{\"config\": {\"name\": \"" + mName +"\",\"description\":\"" + mDescription +"\",\"publish\": {\"messages\": [";
+    string message = "{\"config\": {\"name\": \"";
+	appendEscaped( mName, message );
+	message += "\",\"description\":\"";
+	appendEscaped( mDescription, message );
+	message += "\",\"publish\": {\"messages\": [";
 	int i = 0;
 	for( auto & pub : mPublishers ) {
-        message += "{\"name\":\"" + pub.getName() + "\",";
-        message += "\"type\":\"" + pub.getType() + "\",";
-        message += "\"default\":\"" + pub.valueAsString() + "\"";
-        message += "}";
+        message += "{\"name\":\"";
+		appendEscaped( pub.getName(), message );
+        message += "\",\"type\":\"";
+		appendEscaped( pub.getType(), message );
+        message += "\",\"default\":\"";
+		appendEscaped( pub.getRawValue(), message );
+        message += "\"}";
         if( i++ < mPublishers.size() - 1 )
             message += ",";
     }
@@ -158,9 +858,11 @@ string Config::getJSON() const
 	
 	i = 0;
 	for ( auto & sub : mSubscribers ) {
-        message += "{\"name\":\"" + sub.getName() + "\",";
-        message += "\"type\":\"" + sub.getType() + "\"";
-        message += "}";
+        message += "{\"name\":\"";
+		appendEscaped( sub.getName(), message );
+        message += "\",\"type\":\"";
+		appendEscaped( sub.getType(), message );
+        message += "\"}";
         if ( i++ < mSubscribers.size() - 1 )
             message += ",";
     }
@@ -170,221 +872,4214 @@ string Config::getJSON() const
     return message;
 }
     
-#pragma mark Connection
-	
-ConnectionRef Connection::create( const std::string& host, const std::string& name, const std::string& description )
+#pragma mark Decoding
+
+namespace {
+
+//! A piece of the frame being decoded
+struct Span {
+	const char	*mBegin = nullptr, *mEnd = nullptr;
+
+	size_t	size() const { return mEnd - mBegin; }
+	bool	equals( const char *literal, size_t length ) const { return size() == length && memcmp( mBegin, literal, length ) == 0; }
+};
+
+//! The fields of a "message" frame, pointing into the frame
+struct MessageFields {
+	Span	mName, mType, mValue;
+	//! Sender and the "sbx" extension object, empty when the frame has none
+	Span	mClientName, mExtension;
+	bool	mValueIsString = false;
+	//! Set when a string field contains an escape sequence
+	bool	mIsEscaped = false;
+};
+
+//! Scans the JSON string starting at the '"' at \a p, returns the character after the closing '"'
+const char* scanString( const char *p, const char *end, Span &contents, bool &isEscaped )
 {
-	return ConnectionRef( new Connection( host, SPACEBREW_PORT, name, description ) );
+	if ( p == end || *p != '"' )
+		return nullptr;
+	contents.mBegin = ++p;
+	while ( p < end ) {
+		char c = *p;
+		if ( c == '"' ) {
+			contents.mEnd = p;
+			return p + 1;
+		}
+		if ( c == '\\' ) {
+			isEscaped = true;
+			++p;
+		}
+		++p;
+	}
+	return nullptr;
 }
-    
-ConnectionRef Connection::create( const std::string& host, const uint16_t &port, const std::string& name, const std::string& description )
+
+//! Skips any JSON value starting at \a p, returns the character after it
+const char* skipValue( const char *p, const char *end )
 {
-    return ConnectionRef( new Connection( host, port, name, description ) );
+	if ( p == end )
+		return nullptr;
+
+	bool isEscaped;
+	Span contents;
+	if ( *p == '"' )
+		return scanString( p, end, contents, isEscaped );
+
+	if ( *p == '{' || *p == '[' ) {
+		int depth = 0;
+		while ( p < end ) {
+			char c = *p;
+			if ( c == '"' ) {
+				p = scanString( p, end, contents, isEscaped );
+				if ( ! p )
+					return nullptr;
+				continue;
+			}
+			if ( c == '{' || c == '[' )
+				++depth;
+			else if ( c == '}' || c == ']' ) {
+				if ( --depth == 0 )
+					return p + 1;
+			}
+			++p;
+		}
+		return nullptr;
+	}
+
+	// number or literal
+	const char *start = p;
+	while ( p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' )
+		++p;
+	return p == start ? nullptr : p;
 }
 
-Connection::Connection( const std::string& host, const uint16_t &port, const std::string& name, const std::string& description )
-: mHost( "ws://" + host + ":" + to_string(port) ),
-    mIsConnected( false ), mReconnectInterval( 2.0 ), mShouldAutoReconnect( false ),
-    mLastTimeTriedConnect( 0 ), mConfig( Config( name, description ) )
+//! Calls \a onMember( key, valueStart ) for each member of the object at \a p. \a onMember
+//! returns the character after the value, or nullptr on failure.
+template<typename MemberFn>
+const char* scanObject( const char *p, const char *end, const MemberFn &onMember )
 {
-	initialize();
+	p = skipSpace( p, end );
+	if ( p == end || *p++ != '{' )
+		return nullptr;
+	p = skipSpace( p, end );
+	if ( p < end && *p == '}' )
+		return p + 1;
+
+	while ( p < end ) {
+		Span key;
+		bool isEscaped = false;
+		p = scanString( p, end, key, isEscaped );
+		if ( ! p )
+			return nullptr;
+		p = skipSpace( p, end );
+		if ( p == end || *p++ != ':' )
+			return nullptr;
+		p = onMember( key, skipSpace( p, end ) );
+		if ( ! p )
+			return nullptr;
+		p = skipSpace( p, end );
+		if ( p == end )
+			return nullptr;
+		if ( *p == '}' )
+			return p + 1;
+		if ( *p++ != ',' )
+			return nullptr;
+		p = skipSpace( p, end );
+	}
+	return nullptr;
 }
 
-Connection::~Connection()
+enum FrameKind { FRAME_MESSAGE, FRAME_OTHER, FRAME_INVALID };
+
+//! Finds the fields of a {"message":{...}} frame without copying or allocating anything
+FrameKind scanFrame( const char *begin, const char *end, MessageFields &fields )
 {
-	// Disconnect update signal:
-    mUpdateConnection.disconnect();
+	bool isMessage = false;
+
+	const char *p = scanObject( begin, end, [&]( const Span &key, const char *value ) -> const char* {
+		if ( ! key.equals( "message", 7 ) || value == end || *value != '{' )
+			return skipValue( value, end );
+
+		isMessage = true;
+		return scanObject( value, end, [&]( const Span &field, const char *v ) -> const char* {
+			if ( field.equals( "name", 4 ) )
+				return scanString( v, end, fields.mName, fields.mIsEscaped );
+			if ( field.equals( "type", 4 ) )
+				return scanString( v, end, fields.mType, fields.mIsEscaped );
+			if ( field.equals( "clientName", 10 ) )
+				return scanString( v, end, fields.mClientName, fields.mIsEscaped );
+			if ( field.equals( "sbx", 3 ) ) {
+				const char *next = skipValue( v, end );
+				fields.mExtension.mBegin = v;
+				fields.mExtension.mEnd = next;
+				return next;
+			}
+			if ( field.equals( "value", 5 ) ) {
+				fields.mValueIsString = v < end && *v == '"';
+				if ( fields.mValueIsString )
+					return scanString( v, end, fields.mValue, fields.mIsEscaped );
+				const char *next = skipValue( v, end );
+				fields.mValue.mBegin = v;
+				fields.mValue.mEnd = next;
+				return next;
+			}
+			return skipValue( v, end );
+		} );
+	} );
+
+	if ( ! p )
+		return FRAME_INVALID;
+	return isMessage ? FRAME_MESSAGE : FRAME_OTHER;
 }
 
-void Connection::initialize()
+FrameKind scanFrame( const string &frame, MessageFields &fields )
 {
-	mClient.reset( new WebSocketClient() );
-	// Setup callbacks:
-	mUpdateConnection = app::App::get()->getSignalUpdate().connect( std::bind( &Connection::update, this ) ) ;
-	//TODO: See if we can add a listener here to websocketpp cinder to automate this
-	//WebSocketPP Interface
-	mClient->connectOpenEventHandler( &Connection::onConnect, this );
-	mClient->connectCloseEventHandler( &Connection::onDisconnect, this );
-	mClient->connectFailEventHandler( [](std::string err){ CI_LOG_E(err); } );
-	mClient->connectInterruptEventHandler( &Connection::onInterrupt, this );
-	mClient->connectPingEventHandler( &Connection::onPing, this );
-	mClient->connectMessageEventHandler( &Connection::onRead, this );
+	return scanFrame( frame.data(), frame.data() + frame.size(), fields );
 }
 
-void Connection::update()
+//! Calls \a onElement( begin, end ) for each element of the array at \a p, returns false if it's malformed
+template<typename ElementFn>
+bool scanArray( const char *p, const char *end, const ElementFn &onElement )
 {
-    mClient->poll();
+	p = skipSpace( p, end );
+	if ( p == end || *p++ != '[' )
+		return false;
+	p = skipSpace( p, end );
+	if ( p < end && *p == ']' )
+		return true;
 
-    if ( mShouldAutoReconnect ) {
-        if ( ! mIsConnected && getElapsedSeconds() - mLastTimeTriedConnect > mReconnectInterval ) {
-			// Disconnect update signal:
-			mUpdateConnection.disconnect();
-			// Re-initialize ws client:
-			initialize();
-			// Re-establish connection:
-			mClient->connect( mHost );
-			// Reset connection attempt time:
-			mLastTimeTriedConnect = getElapsedSeconds();
-        }
-    }
+	while ( p < end ) {
+		const char *element = p;
+		p = skipValue( p, end );
+		if ( ! p )
+			return false;
+		onElement( element, p );
+		p = skipSpace( p, end );
+		if ( p == end )
+			return false;
+		if ( *p == ']' )
+			return true;
+		if ( *p++ != ',' )
+			return false;
+		p = skipSpace( p, end );
+	}
+	return false;
 }
 
-void Connection::connect()
+//! Reads the sequence number, epoch and send time of an "sbx" object, returns false without a sequence number
+bool parseExtension( const Span &extension, uint64_t &sequence, uint64_t &epoch, uint64_t &sentMillis )
 {
-    mClient->connect( mHost );
+	sequence = epoch = sentMillis = 0;
+	bool hasSequence = false;
+	auto parseUnsigned = [&]( const char *p, uint64_t &out ) -> const char* {
+		const char *start = p;
+		out = 0;
+		while ( p < extension.mEnd && *p >= '0' && *p <= '9' )
+			out = out * 10 + ( *p++ - '0' );
+		return p == start ? skipValue( start, extension.mEnd ) : p;
+	};
+	const char *p = scanObject( extension.mBegin, extension.mEnd, [&]( const Span &key, const char *value ) -> const char* {
+		if ( key.equals( "seq", 3 ) ) {
+			hasSequence = true;
+			return parseUnsigned( value, sequence );
+		}
+		if ( key.equals( "e", 1 ) )
+			return parseUnsigned( value, epoch );
+		if ( key.equals( "t", 1 ) )
+			return parseUnsigned( value, sentMillis );
+		return skipValue( value, extension.mEnd );
+	} );
+	return p && hasSequence;
 }
 
-void Connection::connect( const string &host, const Config &config )
+uint64_t getMillisSinceEpoch()
 {
-    connect( host, SPACEBREW_PORT, config);
+	return chrono::duration_cast<chrono::milliseconds>( chrono::system_clock::now().time_since_epoch() ).count();
 }
-    
-void Connection::connect( const std::string &host, const uint16_t &port, const Config &config )
+
+//! Unescapes the name, type and string value of \a fields into buffers that keep their capacity,
+//! and points \a fields at those instead of the frame. Returns false for a malformed escape.
+bool unescapeFields( MessageFields &fields, string &name, string &type, string &value )
 {
-    mHost = "ws://" + host + ":" + to_string(port);
-    mConfig = config;
-    
-    mClient->connect( mHost );
+	name.clear();
+	type.clear();
+	value.clear();
+	if ( ! appendUnescaped( fields.mName.mBegin, fields.mName.size(), name )
+		 || ! appendUnescaped( fields.mType.mBegin, fields.mType.size(), type )
+		 || ( fields.mValueIsString && ! appendUnescaped( fields.mValue.mBegin, fields.mValue.size(), value ) ) )
+		return false;
+
+	fields.mName.mBegin = name.data();
+	fields.mName.mEnd = name.data() + name.size();
+	fields.mType.mBegin = type.data();
+	fields.mType.mEnd = type.data() + type.size();
+	if ( fields.mValueIsString ) {
+		fields.mValue.mBegin = value.data();
+		fields.mValue.mEnd = value.data() + value.size();
+	}
+	return true;
 }
 
-void Connection::send( const string &name, const string &type, const string &value )
+StringView toView( const Span &span )
 {
-    if ( mIsConnected ) {
-        Message m( name, type, value );
-        send( m );
-    } else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
+	return StringView( span.mBegin, span.size() );
 }
 
-void Connection::sendString( const string &name, const string &value )
+//! Builds a view of the scanned fields, using the same value conventions as decodeJson()
+MessageView makeView( const MessageFields &fields )
 {
-    if ( mIsConnected ) {
-        Message m( name, "string", value );
-        send( m );
-    }
-	else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
+	StringView type = toView( fields.mType );
+	StringView value = toView( fields.mValue );
+	if ( type == TYPE_BOOLEAN && ! fields.mValueIsString && ! value.empty()
+		 && ( ( value[0] >= '0' && value[0] <= '9' ) || value[0] == '-' ) ) {
+		value = value == "0" ? StringView( "false" ) : StringView( "true" );
+	}
+	else if ( value == "null" ) {
+		value = StringView();
+	}
+	return MessageView( toView( fields.mName ), type, value );
 }
 
-void Connection::sendRange( const string &name, int value )
+//! Fallback for frames the scanner couldn't take apart
+bool decodeJson( const char *begin, const char *end, Message &m )
 {
-    if ( mIsConnected ) {
-        Message m( name, "range", to_string(value));
-        send( m );
-    }
-	else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
+    Json::Value json;
+    Json::Reader reader;
+    if ( ! reader.parse( begin, end, json ) || ! json.isObject() || ! json["message"].isObject() )
+		return false;
+
+	const Json::Value &message = json["message"];
+	const Json::Value &value = message["value"];
+	m.setName( message["name"].asString() );
+	m.setType( message["type"].asString() );
+
+	if ( value.isString() ) {
+		m.setValue( value.asString() );
+	}
+	else if ( value.isBool() ) {
+		m.setValue( value.asBool() ? "true" : "false" );
+	}
+	else if ( value.isIntegral() && m.getType() == TYPE_BOOLEAN ) {
+		m.setValue( value.asInt() == 0 ? "false" : "true" );
+	}
+	else if ( ! value.isNull() ) {
+		// ranges and custom types keep their JSON so a Codec<T> can decode it
+		Json::FastWriter writer;
+		string raw = writer.write( value );
+		if ( ! raw.empty() && raw.back() == '\n' )
+			raw.pop_back();
+		m.setValue( raw );
+	}
+	return true;
 }
 
-void Connection::sendBoolean( const string &name, bool value )
+} // anonymous namespace
+
+#pragma mark MappedFile
+
+MappedFile::MappedFile()
+: mData( nullptr ), mSize( 0 ), mMode( READ ),
+#if defined( CINDER_MSW )
+	mFile( INVALID_HANDLE_VALUE ), mMapping( nullptr )
+#else
+	mFile( -1 )
+#endif
 {
-    if ( mIsConnected ) {
-        string out = value ? "true" : "false";
-        Message m( name, "boolean", out );
-        send( m );
-    }
-	else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
 }
 
-void Connection::send( const Message &m )
+MappedFile::~MappedFile()
 {
-    if ( mIsConnected ) {
-        mClient->write( m.getJSON( mConfig.getName() ) );
-    }
-	else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
+	close();
 }
 
-void Connection::send( Message* m )
+bool MappedFile::open( const string &path, Mode mode, size_t size )
 {
-    if ( mIsConnected ) {
-        mClient->write( m->getJSON( mConfig.getName() ) );
-    }
-	else {
-        CI_LOG_E( "Send failed, not connected!" );
-    }
+	close();
+	mMode = mode;
+
+#if defined( CINDER_MSW )
+	DWORD access = mode == READ ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+	DWORD creation = mode == READ_WRITE ? OPEN_ALWAYS : OPEN_EXISTING;
+	// shared inboxes are written by other processes, and removed while they still have them open
+	mFile = CreateFileA( path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, creation, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( mFile == INVALID_HANDLE_VALUE )
+		return false;
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx( mFile, &fileSize );
+	mSize = static_cast<size_t>( fileSize.QuadPart );
+#else
+	int flags = mode == READ ? O_RDONLY : mode == READ_WRITE ? O_RDWR | O_CREAT : O_RDWR;
+	mFile = ::open( path.c_str(), flags, 0644 );
+	if ( mFile < 0 )
+		return false;
+	struct stat info;
+	fstat( mFile, &info );
+	mSize = static_cast<size_t>( info.st_size );
+#endif
+
+	if ( mode != READ && size > mSize )
+		return resize( size );
+	if ( ! map() ) {
+		close();
+		return false;
+	}
+	return true;
 }
 
-void Connection::addSubscribe( const string &name, const string &type )
+bool MappedFile::resize( size_t size )
 {
-    mConfig.addSubscribe( name, type );
-    if ( mIsConnected ) {
-        updatePubSub();
-    }
+	if ( mMode == READ )
+		return false;
+
+	unmap();
+#if defined( CINDER_MSW )
+	LARGE_INTEGER position;
+	position.QuadPart = static_cast<LONGLONG>( size );
+	if ( ! SetFilePointerEx( mFile, position, nullptr, FILE_BEGIN ) || ! SetEndOfFile( mFile ) )
+		return false;
+#else
+	if ( ftruncate( mFile, static_cast<off_t>( size ) ) != 0 )
+		return false;
+#endif
+	mSize = size;
+	return map();
 }
 
-void Connection::addSubscribe( const Message &m )
+void MappedFile::close()
 {
-    mConfig.addSubscribe( m );
-    if ( mIsConnected ) {
-        updatePubSub();
-    }
+	unmap();
+#if defined( CINDER_MSW )
+	if ( mFile != INVALID_HANDLE_VALUE )
+		CloseHandle( mFile );
+	mFile = INVALID_HANDLE_VALUE;
+#else
+	if ( mFile >= 0 )
+		::close( mFile );
+	mFile = -1;
+#endif
+	mSize = 0;
 }
 
-void Connection::addPublish( const string &name, const string &type, const string &def)
+bool MappedFile::map()
 {
-    mConfig.addPublish( name, type, def );
-    if ( mIsConnected )
-        updatePubSub();
+	// empty files can't be mapped, but they're still valid
+	if ( mSize == 0 )
+		return true;
+
+#if defined( CINDER_MSW )
+	mMapping = CreateFileMappingA( mFile, nullptr, mMode == READ ? PAGE_READONLY : PAGE_READWRITE, 0, 0, nullptr );
+	if ( ! mMapping )
+		return false;
+	mData = static_cast<char*>( MapViewOfFile( mMapping, mMode == READ ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, mSize ) );
+#else
+	void *data = mmap( nullptr, mSize, mMode == READ ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0 );
+	mData = data == MAP_FAILED ? nullptr : static_cast<char*>( data );
+#endif
+	return mData != nullptr;
 }
 
-void Connection::addPublish( const Message &m )
+void MappedFile::unmap()
 {
-    mConfig.addPublish( m );
-    if ( mIsConnected )
-        updatePubSub();
+#if defined( CINDER_MSW )
+	if ( mData )
+		UnmapViewOfFile( mData );
+	if ( mMapping )
+		CloseHandle( mMapping );
+	mMapping = nullptr;
+#else
+	if ( mData )
+		munmap( mData, mSize );
+#endif
+	mData = nullptr;
 }
 
-void Connection::onConnect()
+#pragma mark Capture
+
+namespace {
+
+// Capture file layout: a CaptureHeader, then CaptureRecords each followed by their payload,
+// padded so every record starts 8 byte aligned.
+const char		CAPTURE_MAGIC[8] = { 'S', 'B', 'C', 'A', 'P', 0, 0, 1 };
+const size_t	CAPTURE_INITIAL_SIZE = 1 << 20;
+
+struct CaptureHeader {
+	char		mMagic[8];
+	//! Bytes in use including this header, the rest of the file is preallocated
+	uint64_t	mUsed;
+};
+
+struct CaptureRecord {
+	uint64_t	mNanos;
+	uint32_t	mLength;
+	uint8_t		mDirection;
+	uint8_t		mPadding[3];
+};
+
+size_t alignRecord( size_t size )
 {
-    mIsConnected = true;
-    updatePubSub();
+	return ( size + 7 ) & ~size_t( 7 );
 }
 
-void Connection::onDisconnect()
+} // anonymous namespace
+
+RecorderRef Recorder::create( const string &path )
 {
-    mIsConnected = false;
-    //TODO: Figure out the time
-	mLastTimeTriedConnect = getElapsedSeconds();
+	RecorderRef recorder( new Recorder() );
+	// start from an empty file, then preallocate
+	MappedFile &file = recorder->mFile;
+	if ( ! file.open( path, MappedFile::READ_WRITE ) || ! file.resize( 0 ) || ! file.resize( CAPTURE_INITIAL_SIZE ) ) {
+		CI_LOG_E( "Couldn't open capture file " << path );
+		return nullptr;
+	}
+
+	CaptureHeader header;
+	memcpy( header.mMagic, CAPTURE_MAGIC, sizeof( CAPTURE_MAGIC ) );
+	header.mUsed = recorder->mUsed;
+	memcpy( file.getData(), &header, sizeof( header ) );
+	return recorder;
 }
 
-void Connection::onRead( const string &message )
+Recorder::Recorder()
+: mUsed( sizeof( CaptureHeader ) ), mNumFrames( 0 ), mStartTime( chrono::steady_clock::now() )
 {
-    Message m;
-    Json::Value json;
-    Json::Reader reader;
-    if ( reader.parse( message, json ) ) {
-        
-        m.setName( json["message"]["name"].asString() );
-        m.setType( json["message"]["type"].asString() );
-        
-        if ( m.getType() == "string" && json["message"]["value"].isString() ) {
-            m.setValue( json["message"]["value"].asString() );
-        }
-		else if ( m.getType() == "boolean" ) {
-            if ( json["message"]["value"].isInt() ) {
-				m.setValue( json["message"]["value"].asInt() == 0 ? "false" : "true" );
-            }
-			else if ( json["message"]["value"].isString() ) {
-                m.setValue( json["message"]["value"].asString() );
-            }
-        } else if ( m.getType() == "range" ) {
-            if ( json["message"]["value"].isInt() ) {
-                m.setValue( to_string( json["message"]["value"].asInt() ) );
-            }
-			else if ( json["message"]["value"].isString() ) {
-                m.setValue( json["message"]["value"].asString() );
-            }
-        }
-    }
-    
-    onMessage.emit( m );
+}
+
+Recorder::~Recorder()
+{
+	close();
+}
+
+void Recorder::record( Direction direction, const string &frame )
+{
+	if ( ! mFile.isOpen() )
+		return;
+
+	size_t recordSize = alignRecord( sizeof( CaptureRecord ) + frame.size() );
+	if ( mUsed + recordSize > mFile.getSize() ) {
+		size_t size = mFile.getSize();
+		while ( mUsed + recordSize > size )
+			size *= 2;
+		if ( ! mFile.resize( size ) ) {
+			CI_LOG_E( "Couldn't grow capture file, recording stopped" );
+			mFile.close();
+			return;
+		}
+	}
+
+	CaptureRecord record = {};
+	record.mNanos = chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - mStartTime ).count();
+	record.mLength = static_cast<uint32_t>( frame.size() );
+	record.mDirection = static_cast<uint8_t>( direction );
+
+	char *data = mFile.getData() + mUsed;
+	memcpy( data, &record, sizeof( record ) );
+	memcpy( data + sizeof( record ), frame.data(), frame.size() );
+	mUsed += recordSize;
+	mNumFrames++;
+
+	// publish the new length last, so a crash never leaves a half written record in use
+	uint64_t used = mUsed;
+	memcpy( mFile.getData() + offsetof( CaptureHeader, mUsed ), &used, sizeof( used ) );
+}
+
+void Recorder::close()
+{
+	if ( mFile.isOpen() ) {
+		mFile.resize( mUsed );
+		mFile.close();
+	}
+}
+
+ReplayerRef Replayer::create( const string &path )
+{
+	ReplayerRef replayer( new Replayer() );
+	MappedFile &file = replayer->mFile;
+	CaptureHeader header;
+	if ( ! file.open( path, MappedFile::READ ) || file.getSize() < sizeof( header ) ) {
+		CI_LOG_E( "Couldn't open capture file " << path );
+		return nullptr;
+	}
+
+	memcpy( &header, file.getData(), sizeof( header ) );
+	if ( memcmp( header.mMagic, CAPTURE_MAGIC, sizeof( CAPTURE_MAGIC ) ) != 0 || header.mUsed > file.getSize() ) {
+		CI_LOG_E( path << " is not a Spacebrew capture file" );
+		return nullptr;
+	}
+	replayer->mEnd = static_cast<size_t>( header.mUsed );
+	// the replay timeline starts at the first frame, not when recording started
+	if ( replayer->mEnd >= sizeof( header ) + sizeof( CaptureRecord ) ) {
+		CaptureRecord first;
+		memcpy( &first, file.getData() + sizeof( header ), sizeof( first ) );
+		replayer->mFirstNanos = first.mNanos;
+	}
+	return replayer;
+}
+
+Replayer::Replayer()
+: mOffset( sizeof( CaptureHeader ) ), mEnd( 0 ), mFirstNanos( 0 ), mNumReplayed( 0 ), mSpeed( 1 ), mIsStarted( false )
+{
+}
+
+size_t Replayer::update( Connection &connection, Target target )
+{
+	if ( mSpeed <= 0 )
+		return replayAll( connection, target );
+
+	if ( ! mIsStarted ) {
+		mStartTime = chrono::steady_clock::now();
+		mIsStarted = true;
+	}
+	double elapsed = chrono::duration<double, nano>( chrono::steady_clock::now() - mStartTime ).count();
+	return replay( connection, target, mFirstNanos + static_cast<uint64_t>( elapsed * mSpeed ) );
+}
+
+size_t Replayer::replayAll( Connection &connection, Target target )
+{
+	return replay( connection, target, numeric_limits<uint64_t>::max() );
+}
+
+void Replayer::rewind()
+{
+	mOffset = sizeof( CaptureHeader );
+	mNumReplayed = 0;
+	mIsStarted = false;
+}
+
+size_t Replayer::replay( Connection &connection, Target target, uint64_t untilNanos )
+{
+	Recorder::Direction direction = target == DISPATCH ? Recorder::INBOUND : Recorder::OUTBOUND;
+	size_t count = 0;
+	string frame;
+
+	while ( mOffset + sizeof( CaptureRecord ) <= mEnd ) {
+		CaptureRecord record;
+		memcpy( &record, mFile.getData() + mOffset, sizeof( record ) );
+		if ( record.mNanos > untilNanos )
+			break;
+		if ( record.mLength > mEnd - mOffset - sizeof( record ) ) {
+			CI_LOG_E( "Corrupt capture record at offset " << mOffset << ", replay stops here" );
+			mOffset = mEnd;
+			break;
+		}
+
+		const char *payload = mFile.getData() + mOffset + sizeof( record );
+		mOffset += alignRecord( sizeof( record ) + record.mLength );
+		if ( record.mDirection != direction )
+			continue;
+
+		frame.assign( payload, record.mLength );
+		if ( target == DISPATCH )
+			connection.onRead( frame );
+		else if ( connection.isConnected() )
+			connection.writeFrame( Connection::NO_ENDPOINT, frame );
+		count++;
+	}
+
+	mNumReplayed += count;
+	return count;
+}
+
+#pragma mark Topology
+
+namespace {
+
+// keys join names with a separator that can't appear in them unescaped
+string clientKey( const string &name, const string &remoteAddress )
+{
+	return name + '\x1f' + remoteAddress;
+}
+
+string endpointKey( const Route::Endpoint &endpoint )
+{
+	return clientKey( endpoint.clientName, endpoint.remoteAddress ) + '\x1f' + endpoint.name + '\x1f' + endpoint.type;
+}
+
+string routeKey( const Route &route )
+{
+	return endpointKey( route.publisher ) + '\x1e' + endpointKey( route.subscriber );
+}
+
+Route::Endpoint toRouteEndpoint( const Json::Value &json )
+{
+	Route::Endpoint endpoint;
+	endpoint.clientName = json["clientName"].asString();
+	endpoint.name = json["name"].asString();
+	endpoint.type = json["type"].asString();
+	endpoint.remoteAddress = json["remoteAddress"].asString();
+	return endpoint;
+}
+
+void toEndpoints( const Json::Value &messages, const Topology::Client &client, vector<Route::Endpoint> &out )
+{
+	out.clear();
+	for ( auto & message : messages ) {
+		Route::Endpoint endpoint;
+		endpoint.clientName = client.name;
+		endpoint.remoteAddress = client.remoteAddress;
+		endpoint.name = message["name"].asString();
+		endpoint.type = message["type"].asString();
+		out.push_back( endpoint );
+	}
+}
+
+} // anonymous namespace
+
+bool Topology::apply( const Json::Value &update )
+{
+	bool changed = false;
+
+	if ( update.isMember( "config" ) ) {
+		const Json::Value &config = update["config"];
+		string name = config["name"].asString();
+		string address = config["remoteAddress"].asString();
+		string key = clientKey( name, address );
+
+		auto inserted = mClients.emplace( key, Client() );
+		Client &client = inserted.first->second;
+		if ( inserted.second ) {
+			client.name = name;
+			client.remoteAddress = address;
+			mClientsByName.emplace( name, key );
+		}
+		// a config update replaces the client's endpoints, its routes stay until the server removes them
+		client.description = config["description"].asString();
+		toEndpoints( config["publish"]["messages"], client, client.publishers );
+		toEndpoints( config["subscribe"]["messages"], client, client.subscribers );
+		changed = true;
+	}
+	else if ( update.isMember( "remove" ) ) {
+		for ( auto & removed : update["remove"] )
+			changed = removeClient( clientKey( removed["name"].asString(), removed["remoteAddress"].asString() ) ) || changed;
+	}
+	else if ( update.isMember( "route" ) ) {
+		const Json::Value &routeUpdate = update["route"];
+		Route route;
+		route.publisher = toRouteEndpoint( routeUpdate["publisher"] );
+		route.subscriber = toRouteEndpoint( routeUpdate["subscriber"] );
+		if ( routeUpdate["type"].asString() == "add" )
+			changed = addRoute( route );
+		else if ( routeUpdate["type"].asString() == "remove" )
+			changed = removeRoute( routeKey( route ) );
+	}
+
+	if ( changed )
+		mVersion++;
+	return changed;
+}
+
+void Topology::clear()
+{
+	mClients.clear();
+	mClientsByName.clear();
+	mRoutes.clear();
+	mRoutesByClient.clear();
+	mRoutesByEndpoint.clear();
+	mVersion++;
+}
+
+const Topology::Client* Topology::findClient( const string &name, const string &remoteAddress ) const
+{
+	auto found = mClients.find( clientKey( name, remoteAddress ) );
+	return found == mClients.end() ? nullptr : &found->second;
+}
+
+vector<const Topology::Client*> Topology::findClients( const string &name ) const
+{
+	vector<const Client*> clients;
+	auto range = mClientsByName.equal_range( name );
+	for ( auto it = range.first; it != range.second; ++it ) {
+		auto found = mClients.find( it->second );
+		if ( found != mClients.end() )
+			clients.push_back( &found->second );
+	}
+	return clients;
+}
+
+vector<const Route*> Topology::getRoutes( const string &name, const string &remoteAddress ) const
+{
+	vector<const Route*> routes;
+	auto found = mRoutesByClient.find( clientKey( name, remoteAddress ) );
+	if ( found != mRoutesByClient.end() ) {
+		for ( auto & key : found->second )
+			routes.push_back( &mRoutes.at( key ) );
+	}
+	return routes;
+}
+
+vector<const Route*> Topology::getRoutes( const Route::Endpoint &endpoint ) const
+{
+	vector<const Route*> routes;
+	auto found = mRoutesByEndpoint.find( endpointKey( endpoint ) );
+	if ( found != mRoutesByEndpoint.end() ) {
+		for ( auto & key : found->second )
+			routes.push_back( &mRoutes.at( key ) );
+	}
+	return routes;
+}
+
+bool Topology::addRoute( const Route &route )
+{
+	string key = routeKey( route );
+	if ( ! mRoutes.emplace( key, route ).second )
+		return false;
+
+	// a client routed to itself, or an endpoint to its namesake, is indexed once
+	string publisherClient = clientKey( route.publisher.clientName, route.publisher.remoteAddress );
+	string subscriberClient = clientKey( route.subscriber.clientName, route.subscriber.remoteAddress );
+	mRoutesByClient[publisherClient].push_back( key );
+	if ( subscriberClient != publisherClient )
+		mRoutesByClient[subscriberClient].push_back( key );
+
+	string publisherEndpoint = endpointKey( route.publisher );
+	string subscriberEndpoint = endpointKey( route.subscriber );
+	mRoutesByEndpoint[publisherEndpoint].push_back( key );
+	if ( subscriberEndpoint != publisherEndpoint )
+		mRoutesByEndpoint[subscriberEndpoint].push_back( key );
+	return true;
+}
+
+bool Topology::removeRoute( const string &key )
+{
+	auto found = mRoutes.find( key );
+	if ( found == mRoutes.end() )
+		return false;
+
+	const Route &route = found->second;
+	unindexRoute( mRoutesByClient, clientKey( route.publisher.clientName, route.publisher.remoteAddress ), key );
+	unindexRoute( mRoutesByClient, clientKey( route.subscriber.clientName, route.subscriber.remoteAddress ), key );
+	unindexRoute( mRoutesByEndpoint, endpointKey( route.publisher ), key );
+	unindexRoute( mRoutesByEndpoint, endpointKey( route.subscriber ), key );
+	mRoutes.erase( found );
+	return true;
+}
+
+void Topology::unindexRoute( RouteIndex &index, const string &indexKey, const string &routeKey )
+{
+	auto indexed = index.find( indexKey );
+	if ( indexed == index.end() )
+		return;
+	auto &keys = indexed->second;
+	keys.erase( std::remove( keys.begin(), keys.end(), routeKey ), keys.end() );
+	if ( keys.empty() )
+		index.erase( indexed );
+}
+
+bool Topology::removeClient( const string &key )
+{
+	auto found = mClients.find( key );
+	bool changed = found != mClients.end();
+	if ( changed ) {
+		auto range = mClientsByName.equal_range( found->second.name );
+		for ( auto it = range.first; it != range.second; ++it ) {
+			if ( it->second == key ) {
+				mClientsByName.erase( it );
+				break;
+			}
+		}
+		mClients.erase( found );
+	}
+
+	// copy, removeRoute() edits the index
+	auto routes = mRoutesByClient.find( key );
+	if ( routes != mRoutesByClient.end() ) {
+		vector<string> keys = routes->second;
+		for ( auto & route : keys )
+			changed = removeRoute( route ) || changed;
+	}
+	return changed;
+}
+
+#pragma mark PatternIndex
+
+size_t PatternIndex::addPattern( const string &pattern )
+{
+	uint32_t node = 0;
+	for ( size_t i = 0; i < pattern.size(); ++i ) {
+		if ( pattern[i] != '*' ) {
+			node = getChild( node, pattern[i] );
+		}
+		else if ( i + 2 == pattern.size() && pattern[i + 1] == '*' ) {
+			return add( pattern, node, true );
+		}
+		else {
+			// runs of stars mean the same as one
+			while ( i + 1 < pattern.size() && pattern[i + 1] == '*' && i + 2 != pattern.size() )
+				++i;
+			node = getStar( node );
+		}
+	}
+	return add( pattern, node, false );
+}
+
+size_t PatternIndex::addPrefix( const string &prefix )
+{
+	uint32_t node = 0;
+	for ( char c : prefix )
+		node = getChild( node, c );
+	// prefixes are literal, so keep them apart from patterns spelled the same
+	return add( '\0' + prefix, node, true );
+}
+
+size_t PatternIndex::add( const string &key, uint32_t node, bool isRest )
+{
+	auto inserted = mIds.emplace( key, mIds.size() );
+	if ( inserted.second ) {
+		auto &ids = isRest ? mNodes[node].mRest : mNodes[node].mExact;
+		ids.push_back( static_cast<uint32_t>( inserted.first->second ) );
+	}
+	return inserted.first->second;
+}
+
+uint32_t PatternIndex::getChild( uint32_t node, char c )
+{
+	for ( auto & child : mNodes[node].mChildren ) {
+		if ( child.first == c )
+			return child.second;
+	}
+	uint32_t child = static_cast<uint32_t>( mNodes.size() );
+	mNodes.push_back( Node() );
+	mNodes[node].mChildren.push_back( make_pair( c, child ) );
+	return child;
+}
+
+uint32_t PatternIndex::getStar( uint32_t node )
+{
+	if ( mNodes[node].mStar == 0 ) {
+		uint32_t star = static_cast<uint32_t>( mNodes.size() );
+		mNodes.push_back( Node() );
+		mNodes[node].mStar = star;
+	}
+	return mNodes[node].mStar;
+}
+
+void PatternIndex::match( const char *name, size_t length, vector<size_t> &out ) const
+{
+	out.clear();
+	matchFrom( 0, name, name + length, out );
+	// a name can reach the same pattern through different stars
+	std::sort( out.begin(), out.end() );
+	out.erase( std::unique( out.begin(), out.end() ), out.end() );
+}
+
+void PatternIndex::matchFrom( uint32_t node, const char *p, const char *end, vector<size_t> &out ) const
+{
+	for ( ;; ) {
+		const Node &current = mNodes[node];
+		out.insert( out.end(), current.mRest.begin(), current.mRest.end() );
+
+		if ( current.mStar != 0 ) {
+			// the star takes as much of this segment as the rest of the pattern leaves it
+			for ( const char *q = p; ; ++q ) {
+				matchFrom( current.mStar, q, end, out );
+				if ( q == end || *q == '/' )
+					break;
+			}
+		}
+
+		if ( p == end ) {
+			out.insert( out.end(), current.mExact.begin(), current.mExact.end() );
+			return;
+		}
+
+		uint32_t next = 0;
+		for ( auto & child : current.mChildren ) {
+			if ( child.first == *p ) {
+				next = child.second;
+				break;
+			}
+		}
+		if ( next == 0 )
+			return;
+		node = next;
+		++p;
+	}
+}
+
+#pragma mark History
+
+namespace {
+
+// Seqlock reader: runs \a read until it didn't overlap a History::push()
+template<typename Fn>
+void readConsistent( const atomic<uint64_t> &sequence, Fn read )
+{
+	for ( ;; ) {
+		uint64_t before = sequence.load( memory_order_acquire );
+		if ( before & 1 ) {
+			this_thread::yield();
+			continue;
+		}
+		read();
+		atomic_thread_fence( memory_order_acquire );
+		if ( sequence.load( memory_order_relaxed ) == before )
+			return;
+	}
+}
+
+}
+
+History::History( size_t capacity )
+	: mSequence( 0 ), mCount( 0 )
+{
+	size_t size = 2;
+	while ( size < capacity )
+		size <<= 1;
+	mSlots.reset( new Slot[size] );
+	mMask = size - 1;
+}
+
+void History::push( double time, double value )
+{
+	uint64_t sequence = mSequence.load( memory_order_relaxed );
+	mSequence.store( sequence + 1, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+
+	uint64_t count = mCount.load( memory_order_relaxed );
+	Slot &slot = mSlots[count & mMask];
+	slot.time.store( time, memory_order_relaxed );
+	slot.value.store( value, memory_order_relaxed );
+	mCount.store( count + 1, memory_order_relaxed );
+
+	mSequence.store( sequence + 2, memory_order_release );
+}
+
+void History::clear()
+{
+	uint64_t sequence = mSequence.load( memory_order_relaxed );
+	mSequence.store( sequence + 1, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+	mCount.store( 0, memory_order_relaxed );
+	mSequence.store( sequence + 2, memory_order_release );
+}
+
+uint64_t History::findAfter( double time, bool orEqual, uint64_t first, uint64_t count ) const
+{
+	while ( first < count ) {
+		uint64_t middle = first + ( count - first ) / 2;
+		double t = mSlots[middle & mMask].time.load( memory_order_relaxed );
+		if ( t < time || ( t == time && ! orEqual ) )
+			first = middle + 1;
+		else
+			count = middle;
+	}
+	return first;
+}
+
+double History::sample( double time, Interpolation interpolation, double fallback ) const
+{
+	double result = fallback;
+	readConsistent( mSequence, [&] {
+		result = fallback;
+		uint64_t count = mCount.load( memory_order_relaxed );
+		if ( count == 0 )
+			return;
+		uint64_t first = getFirst( count );
+		uint64_t after = findAfter( time, false, first, count );
+		if ( after == first ) {
+			result = mSlots[first & mMask].value.load( memory_order_relaxed );
+			return;
+		}
+
+		const Slot &a = mSlots[( after - 1 ) & mMask];
+		result = a.value.load( memory_order_relaxed );
+		if ( after == count || interpolation == HOLD )
+			return;
+
+		const Slot &b = mSlots[after & mMask];
+		double t0 = a.time.load( memory_order_relaxed );
+		double t1 = b.time.load( memory_order_relaxed );
+		double v1 = b.value.load( memory_order_relaxed );
+		if ( t1 > t0 )
+			result += ( v1 - result ) * ( ( time - t0 ) / ( t1 - t0 ) );
+	} );
+	return result;
+}
+
+size_t History::read( double from, double to, vector<Sample> &out ) const
+{
+	readConsistent( mSequence, [&] {
+		out.clear();
+		uint64_t count = mCount.load( memory_order_relaxed );
+		uint64_t first = getFirst( count );
+		uint64_t begin = findAfter( from, true, first, count );
+		uint64_t end = findAfter( to, false, begin, count );
+		for ( uint64_t i = begin; i < end; ++i ) {
+			const Slot &slot = mSlots[i & mMask];
+			out.push_back( Sample{ slot.time.load( memory_order_relaxed ), slot.value.load( memory_order_relaxed ) } );
+		}
+	} );
+	return out.size();
+}
+
+bool History::getLatest( Sample &out ) const
+{
+	bool found = false;
+	readConsistent( mSequence, [&] {
+		uint64_t count = mCount.load( memory_order_relaxed );
+		found = count > 0;
+		if ( found ) {
+			const Slot &slot = mSlots[( count - 1 ) & mMask];
+			out = Sample{ slot.time.load( memory_order_relaxed ), slot.value.load( memory_order_relaxed ) };
+		}
+	} );
+	return found;
+}
+
+size_t History::getSize() const
+{
+	uint64_t count = mCount.load( memory_order_acquire );
+	return static_cast<size_t>( count - getFirst( count ) );
+}
+
+#pragma mark LatestValues
+
+const LatestValues::Entry* LatestValues::Index::find( const string &name ) const
+{
+	auto it = mNames.find( name );
+	return it != mNames.end() ? it->second : nullptr;
+}
+
+LatestValues::LatestValues()
+	: mVersion( 0 ), mIndex( make_shared<Index>() )
+{
+}
+
+LatestValues::Entry::Entry()
+	: mSequence( 0 ), mVersion( 0 ), mSize( 0 ), mIsStale( false )
+{
+	for ( auto & word : mText )
+		word.store( 0, memory_order_relaxed );
+}
+
+LatestValues::Entry* LatestValues::acquire( const string &name )
+{
+	auto it = mEntries.find( name );
+	if ( it != mEntries.end() )
+		return it->second;
+
+	if ( mNumEntries == mPages.size() * PAGE_SIZE )
+		mPages.emplace_back( new Entry[PAGE_SIZE] );
+	Entry *entry = &mPages.back()[mNumEntries++ % PAGE_SIZE];
+	mEntries[name] = entry;
+	return entry;
+}
+
+void LatestValues::store( Entry &entry, const StringView &raw )
+{
+	uint64_t version = mVersion.load( memory_order_relaxed ) + 1;
+	write( entry, version, &raw );
+	mVersion.store( version, memory_order_release );
+}
+
+void LatestValues::markStale()
+{
+	uint64_t version = mVersion.load( memory_order_relaxed ) + 1;
+	for ( auto & it : mEntries ) {
+		if ( it.second->mVersion.load( memory_order_relaxed ) && ! it.second->mIsStale.load( memory_order_relaxed ) )
+			write( *it.second, version, nullptr );
+	}
+	mVersion.store( version, memory_order_release );
+}
+
+void LatestValues::write( Entry &entry, uint64_t version, const StringView *raw )
+{
+	// long values hold the lock for the whole write, so readers see them together with their size
+	unique_lock<mutex> lock;
+	if ( raw && raw->size() > INLINE_SIZE )
+		lock = unique_lock<mutex>( entry.mLongMutex );
+
+	uint64_t sequence = entry.mSequence.load( memory_order_relaxed );
+	entry.mSequence.store( sequence + 1, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+
+	entry.mVersion.store( version, memory_order_relaxed );
+	entry.mIsStale.store( ! raw, memory_order_relaxed );
+	if ( raw ) {
+		entry.mSize.store( raw->size(), memory_order_relaxed );
+		if ( raw->size() > INLINE_SIZE ) {
+			entry.mLongText.assign( raw->data(), raw->size() );
+		}
+		else {
+			for ( size_t i = 0; i * sizeof( uint64_t ) < raw->size(); ++i ) {
+				uint64_t word = 0;
+				memcpy( &word, raw->data() + i * sizeof( uint64_t ), min( sizeof( uint64_t ), raw->size() - i * sizeof( uint64_t ) ) );
+				entry.mText[i].store( word, memory_order_relaxed );
+			}
+		}
+	}
+
+	entry.mSequence.store( sequence + 2, memory_order_release );
+}
+
+bool LatestValues::load( const Entry &entry, string &raw ) const
+{
+	for ( ;; ) {
+		size_t size = 0;
+		uint64_t version = 0;
+		uint64_t text[Entry::INLINE_WORDS];
+		readConsistent( entry.mSequence, [&] {
+			version = entry.mVersion.load( memory_order_relaxed );
+			size = entry.mSize.load( memory_order_relaxed );
+			for ( size_t i = 0; i * sizeof( uint64_t ) < size && i < Entry::INLINE_WORDS; ++i )
+				text[i] = entry.mText[i].load( memory_order_relaxed );
+		} );
+		if ( ! version )
+			return false;
+		if ( size <= INLINE_SIZE ) {
+			raw.assign( reinterpret_cast<const char*>( text ), size );
+			return true;
+		}
+
+		lock_guard<mutex> lock( entry.mLongMutex );
+		// a short value may have replaced it in the meantime
+		if ( entry.mSize.load( memory_order_relaxed ) > INLINE_SIZE ) {
+			raw = entry.mLongText;
+			return true;
+		}
+	}
+}
+
+#pragma mark DispatchPool
+
+namespace {
+
+// Lets submit() from inside a task push onto the worker's own deque
+thread_local const DispatchPool	*sCurrentPool = nullptr;
+thread_local size_t				sCurrentWorker = 0;
+
+}
+
+DispatchPool::DispatchPool( size_t numThreads )
+	: mPending( 0 ), mNext( 0 ), mNumStolen( 0 )
+{
+	if ( numThreads == 0 )
+		numThreads = max<size_t>( thread::hardware_concurrency(), 1 );
+	for ( size_t i = 0; i < numThreads; ++i )
+		mWorkers.emplace_back( new Worker() );
+	for ( size_t i = 0; i < numThreads; ++i )
+		mThreads.emplace_back( [this, i] { run( i ); } );
+}
+
+DispatchPool::~DispatchPool()
+{
+	{
+		lock_guard<mutex> lock( mWakeMutex );
+		mIsStopping = true;
+	}
+	mWake.notify_all();
+	for ( auto & thread : mThreads )
+		thread.join();
+}
+
+void DispatchPool::submit( function<void ()> task )
+{
+	size_t index = sCurrentPool == this ? sCurrentWorker : mNext.fetch_add( 1, memory_order_relaxed ) % mWorkers.size();
+	{
+		// counted first, so a worker never takes a task that isn't counted yet
+		lock_guard<mutex> lock( mWakeMutex );
+		mPending.fetch_add( 1 );
+	}
+	{
+		lock_guard<mutex> lock( mWorkers[index]->mMutex );
+		mWorkers[index]->mTasks.push_back( move( task ) );
+	}
+	mWake.notify_one();
+}
+
+bool DispatchPool::take( size_t index, function<void ()> &task )
+{
+	{
+		Worker &own = *mWorkers[index];
+		lock_guard<mutex> lock( own.mMutex );
+		if ( ! own.mTasks.empty() ) {
+			task = move( own.mTasks.back() );
+			own.mTasks.pop_back();
+			mPending.fetch_sub( 1 );
+			return true;
+		}
+	}
+	for ( size_t i = 1; i < mWorkers.size(); ++i ) {
+		Worker &victim = *mWorkers[( index + i ) % mWorkers.size()];
+		lock_guard<mutex> lock( victim.mMutex );
+		if ( ! victim.mTasks.empty() ) {
+			task = move( victim.mTasks.front() );
+			victim.mTasks.pop_front();
+			mPending.fetch_sub( 1 );
+			mNumStolen.fetch_add( 1, memory_order_relaxed );
+			return true;
+		}
+	}
+	return false;
+}
+
+void DispatchPool::run( size_t index )
+{
+	sCurrentPool = this;
+	sCurrentWorker = index;
+	function<void ()> task;
+	for ( ;; ) {
+		if ( take( index, task ) ) {
+			task();
+			task = nullptr;
+			continue;
+		}
+		unique_lock<mutex> lock( mWakeMutex );
+		if ( mPending.load() > 0 )
+			continue;
+		if ( mIsStopping )
+			return;
+		mWake.wait( lock, [this] { return mPending.load() > 0 || mIsStopping; } );
+	}
+}
+
+#pragma mark Transports
+
+TransportWait::TransportWait()
+{
+#if ! defined( CINDER_MSW )
+	mPipe[0] = mPipe[1] = -1;
+#endif
+}
+
+TransportWait::~TransportWait()
+{
+#if ! defined( CINDER_MSW )
+	if ( mPipe[0] >= 0 ) {
+		::close( mPipe[0] );
+		::close( mPipe[1] );
+	}
+#endif
+}
+
+void TransportWait::wait( double seconds )
+{
+	// woken since the last wait, there's work already
+	if ( mIsWoken.exchange( false ) )
+		return;
+
+	bool hasSockets = false;
+#if ! defined( CINDER_MSW )
+	static thread_local vector<pollfd> sPollFds;
+	sPollFds.clear();
+#endif
+	{
+		lock_guard<mutex> lock( mMutex );
+		for ( auto & entry : mEntries ) {
+			if ( entry.mPollInterval > 0 )
+				seconds = std::min( seconds, entry.mPollInterval );
+			if ( entry.mSocket == NO_SOCKET )
+				continue;
+			hasSockets = true;
+#if ! defined( CINDER_MSW )
+			pollfd fd = { entry.mSocket, POLLIN, 0 };
+			sPollFds.push_back( fd );
+#endif
+		}
+	}
+
+#if defined( CINDER_MSW )
+	// no pipe to end a select() with, sockets are looked at every millisecond instead
+	if ( hasSockets )
+		seconds = std::min( seconds, 0.001 );
+	unique_lock<mutex> lock( mMutex );
+	mIsWaiting = true;
+	mCondition.wait_for( lock, chrono::duration<double>( seconds ), [this] { return mIsWoken.load(); } );
+	mIsWaiting = false;
+#else
+	(void)hasSockets;
+	if ( mPipe[0] < 0 ) {
+		if ( pipe( mPipe ) != 0 ) {
+			mPipe[0] = mPipe[1] = -1;
+			CI_LOG_E( "Can't create a pipe to wake the I/O thread with" );
+			this_thread::sleep_for( chrono::duration<double>( std::min( seconds, 0.001 ) ) );
+			return;
+		}
+		fcntl( mPipe[0], F_SETFL, O_NONBLOCK );
+		fcntl( mPipe[1], F_SETFL, O_NONBLOCK );
+	}
+	pollfd wakeFd = { mPipe[0], POLLIN, 0 };
+	sPollFds.push_back( wakeFd );
+
+	// published by the store, wake() only writes to the pipe once it sees it
+	mIsWaiting = true;
+	if ( ! mIsWoken.load() )
+		::poll( sPollFds.data(), sPollFds.size(), static_cast<int>( std::ceil( std::min( seconds, 60.0 ) * 1000 ) ) );
+	mIsWaiting = false;
+
+	char drain[64];
+	while ( ::read( mPipe[0], drain, sizeof( drain ) ) > 0 )
+		;
+#endif
+}
+
+void TransportWait::wake()
+{
+	mIsWoken = true;
+	if ( ! mIsWaiting )
+		return;
+#if defined( CINDER_MSW )
+	lock_guard<mutex> lock( mMutex );
+	mCondition.notify_one();
+#else
+	// a full pipe wakes it just as well
+	char byte = 0;
+	if ( ::write( mPipe[1], &byte, 1 ) < 0 )
+		return;
+#endif
+}
+
+void TransportWait::watch( const void *owner, Socket socket )
+{
+	{
+		lock_guard<mutex> lock( mMutex );
+		getEntry( owner ).mSocket = socket;
+	}
+	// a wait() already going doesn't know about it
+	wake();
+}
+
+void TransportWait::unwatch( const void *owner )
+{
+	lock_guard<mutex> lock( mMutex );
+	getEntry( owner ).mSocket = NO_SOCKET;
+	removeUnused();
+}
+
+void TransportWait::setPollInterval( const void *owner, double seconds )
+{
+	{
+		lock_guard<mutex> lock( mMutex );
+		getEntry( owner ).mPollInterval = seconds;
+		removeUnused();
+	}
+	if ( seconds > 0 )
+		wake();
+}
+
+TransportWait::Entry& TransportWait::getEntry( const void *owner )
+{
+	for ( auto & entry : mEntries ) {
+		if ( entry.mOwner == owner )
+			return entry;
+	}
+	Entry entry = { owner, NO_SOCKET, 0 };
+	mEntries.push_back( entry );
+	return mEntries.back();
+}
+
+void TransportWait::removeUnused()
+{
+	mEntries.erase( std::remove_if( mEntries.begin(), mEntries.end(), []( const Entry &entry ) {
+		return entry.mSocket == NO_SOCKET && entry.mPollInterval <= 0;
+	} ), mEntries.end() );
+}
+
+#if defined( SPACEBREW_ENABLE_TLS )
+
+namespace {
+
+typedef websocketpp::client<websocketpp::config::asio_tls_client>					TlsClient;
+typedef websocketpp::lib::asio::ssl::context										SslContext;
+typedef websocketpp::lib::asio::ssl::stream<websocketpp::lib::asio::ip::tcp::socket>	SslStream;
+
+//! Shared by every connection, so a session can be resumed by whichever transport connects
+//! next, including failover attempts and shards
+mutex										sTlsMutex;
+WebSocketTransport::TlsOptions				sTlsOptions;
+websocketpp::lib::shared_ptr<SslContext>	sSslContext;
+
+struct SessionFree {
+	void operator()( SSL_SESSION *session ) const { SSL_SESSION_free( session ); }
+};
+
+//! Latest session of each host:port, under sTlsMutex
+unordered_map<string, unique_ptr<SSL_SESSION, SessionFree>>& getTlsSessions()
+{
+	// OpenSSL cleans up at exit, initializing it first frees the sessions before that
+	static bool initialized = OPENSSL_init_ssl( 0, nullptr ) != 0;
+	static unordered_map<string, unique_ptr<SSL_SESSION, SessionFree>> sessions;
+	(void)initialized;
+	return sessions;
+}
+
+//! Where each SSL keeps its TlsWebSocketClient. Not the app data, asio keeps its verify callback there.
+int getClientIndex()
+{
+	static int index = SSL_get_ex_new_index( 0, nullptr, nullptr, nullptr, nullptr );
+	return index;
+}
+
+}
+
+/**
+ * @brief The Cinder-WebSocketPP client only speaks plain ws://, this is the same thing over TLS.
+ * Each connection offers the last session of its host:port, and OpenSSL's info callback times
+ * the handshake.
+ */
+class TlsWebSocketClient : ci::Noncopyable {
+public:
+	TlsWebSocketClient();
+
+	void	connect( const string &url );
+	void	disconnect();
+	void	write( const string &frame );
+	void	poll() { mClient.poll(); }
+
+	const Transport::HandshakeInfo&	getHandshakeInfo() const { return mHandshake; }
+
+	function<void ()>				mOpenHandler, mCloseHandler, mInterruptHandler;
+	function<void (const string&)>	mFailHandler, mMessageHandler;
+	//! Called with the connection's socket once it's connected
+	function<void (TransportWait::Socket)>	mSocketHandler;
+
+private:
+	websocketpp::lib::shared_ptr<SslContext>	getContext();
+	void		prepare( SSL *ssl );
+
+	static void	onInfo( const SSL *ssl, int where, int ret );
+	static int	onNewSession( SSL *ssl, SSL_SESSION *session );
+
+	TlsClient					mClient;
+	websocketpp::connection_hdl	mHandle;
+	string						mHost, mSessionKey;
+	chrono::steady_clock::time_point	mHandshakeStart;
+	bool						mIsHandshaking = false;
+	Transport::HandshakeInfo	mHandshake;
+};
+
+TlsWebSocketClient::TlsWebSocketClient()
+{
+	mClient.clear_access_channels( websocketpp::log::alevel::all );
+	mClient.clear_error_channels( websocketpp::log::elevel::all );
+	mClient.init_asio();
+	mClient.set_tls_init_handler( [this]( websocketpp::connection_hdl ) { return getContext(); } );
+	mClient.set_socket_init_handler( [this]( websocketpp::connection_hdl, SslStream &stream ) { prepare( stream.native_handle() ); } );
+	mClient.set_tcp_post_init_handler( [this]( websocketpp::connection_hdl handle ) {
+		websocketpp::lib::error_code err;
+		TlsClient::connection_ptr connection = mClient.get_con_from_hdl( handle, err );
+		if ( ! err && mSocketHandler )
+			mSocketHandler( static_cast<TransportWait::Socket>( connection->get_raw_socket().native_handle() ) );
+	} );
+	mClient.set_open_handler( [this]( websocketpp::connection_hdl ) { if ( mOpenHandler ) mOpenHandler(); } );
+	mClient.set_close_handler( [this]( websocketpp::connection_hdl ) { if ( mCloseHandler ) mCloseHandler(); } );
+	mClient.set_interrupt_handler( [this]( websocketpp::connection_hdl ) { if ( mInterruptHandler ) mInterruptHandler(); } );
+	mClient.set_fail_handler( [this]( websocketpp::connection_hdl handle ) {
+		websocketpp::lib::error_code err;
+		auto connection = mClient.get_con_from_hdl( handle, err );
+		if ( mFailHandler )
+			mFailHandler( connection ? connection->get_ec().message() : err.message() );
+	} );
+	mClient.set_message_handler( [this]( websocketpp::connection_hdl, TlsClient::message_ptr message ) {
+		if ( mMessageHandler )
+			mMessageHandler( message->get_payload() );
+	} );
+}
+
+void TlsWebSocketClient::connect( const string &url )
+{
+	websocketpp::lib::error_code err;
+	TlsClient::connection_ptr connection = mClient.get_connection( url, err );
+	if ( err ) {
+		if ( mFailHandler )
+			mFailHandler( err.message() );
+		return;
+	}
+
+	mHost = connection->get_uri()->get_host();
+	mSessionKey = mHost + ":" + to_string( connection->get_uri()->get_port() );
+	mHandshake = Transport::HandshakeInfo();
+	mHandshake.isSecure = true;
+	mIsHandshaking = false;
+	mHandle = connection->get_handle();
+	mClient.connect( connection );
+}
+
+void TlsWebSocketClient::disconnect()
+{
+	websocketpp::lib::error_code err;
+	mClient.close( mHandle, websocketpp::close::status::going_away, "", err );
+}
+
+void TlsWebSocketClient::write( const string &frame )
+{
+	websocketpp::lib::error_code err;
+	mClient.send( mHandle, frame, websocketpp::frame::opcode::text, err );
+	if ( err && mFailHandler )
+		mFailHandler( err.message() );
+}
+
+websocketpp::lib::shared_ptr<SslContext> TlsWebSocketClient::getContext()
+{
+	lock_guard<mutex> lock( sTlsMutex );
+	if ( sSslContext )
+		return sSslContext;
+
+	auto context = websocketpp::lib::make_shared<SslContext>( SslContext::sslv23_client );
+	// asio's error code, which websocketpp's own may not be
+	websocketpp::lib::asio::error_code err;
+	context->set_options( SslContext::default_workarounds | SslContext::no_sslv2 | SslContext::no_sslv3, err );
+	if ( sTlsOptions.verifyPeer ) {
+		context->set_verify_mode( websocketpp::lib::asio::ssl::verify_peer, err );
+		if ( sTlsOptions.caFile.empty() )
+			context->set_default_verify_paths( err );
+		else
+			context->load_verify_file( sTlsOptions.caFile, err );
+		if ( err )
+			CI_LOG_E( "Couldn't load trusted certificates: " << err.message() );
+	}
+	else {
+		context->set_verify_mode( websocketpp::lib::asio::ssl::verify_none, err );
+	}
+
+	// OpenSSL hands new sessions, TLS 1.3 tickets included, to onNewSession() instead of its own cache
+	SSL_CTX *native = context->native_handle();
+	SSL_CTX_set_session_cache_mode( native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE );
+	SSL_CTX_sess_set_new_cb( native, &TlsWebSocketClient::onNewSession );
+	sSslContext = context;
+	return context;
+}
+
+void TlsWebSocketClient::prepare( SSL *ssl )
+{
+	SSL_set_ex_data( ssl, getClientIndex(), this );
+	SSL_set_info_callback( ssl, &TlsWebSocketClient::onInfo );
+	SSL_set_tlsext_host_name( ssl, mHost.c_str() );
+
+	lock_guard<mutex> lock( sTlsMutex );
+	if ( sTlsOptions.verifyPeer )
+		SSL_set1_host( ssl, mHost.c_str() );
+	if ( sTlsOptions.resumeSessions ) {
+		auto &sessions = getTlsSessions();
+		auto it = sessions.find( mSessionKey );
+		if ( it != sessions.end() )
+			SSL_set_session( ssl, it->second.get() );
+	}
+}
+
+void TlsWebSocketClient::onInfo( const SSL *ssl, int where, int )
+{
+	auto client = static_cast<TlsWebSocketClient*>( SSL_get_ex_data( ssl, getClientIndex() ) );
+	if ( ! client )
+		return;
+	// TLS 1.3 tickets arrive in later handshake messages, only the first handshake counts
+	if ( ( where & SSL_CB_HANDSHAKE_START ) && ! client->mIsHandshaking && client->mHandshake.seconds == 0 ) {
+		client->mIsHandshaking = true;
+		client->mHandshakeStart = chrono::steady_clock::now();
+	}
+	else if ( ( where & SSL_CB_HANDSHAKE_DONE ) && client->mIsHandshaking ) {
+		client->mIsHandshaking = false;
+		client->mHandshake.seconds = chrono::duration<double>( chrono::steady_clock::now() - client->mHandshakeStart ).count();
+		client->mHandshake.isResumed = SSL_session_reused( const_cast<SSL*>( ssl ) ) != 0;
+	}
+}
+
+int TlsWebSocketClient::onNewSession( SSL *ssl, SSL_SESSION *session )
+{
+	auto client = static_cast<TlsWebSocketClient*>( SSL_get_ex_data( ssl, getClientIndex() ) );
+	lock_guard<mutex> lock( sTlsMutex );
+	if ( ! client || ! sTlsOptions.resumeSessions )
+		return 0;
+
+	// a copy, OpenSSL marks the connection's own session unusable when the link drops without a
+	// clean shutdown, which is exactly when we want to resume it
+	getTlsSessions()[client->mSessionKey].reset( SSL_SESSION_dup( session ) );
+	return 0;
+}
+
+#endif
+
+namespace {
+
+//! How often a websocket is polled while it connects, before there's a socket to watch
+const double CONNECT_POLL_INTERVAL = 0.01;
+
+}
+
+WebSocketTransport::WebSocketTransport()
+{
+}
+
+WebSocketTransport::~WebSocketTransport()
+{
+	mWait->unwatch( this );
+	mWait->setPollInterval( this, 0 );
+}
+
+void WebSocketTransport::setTlsOptions( const TlsOptions &options )
+{
+#if defined( SPACEBREW_ENABLE_TLS )
+	lock_guard<mutex> lock( sTlsMutex );
+	sTlsOptions = options;
+	sSslContext.reset();
+	getTlsSessions().clear();
+#else
+	// nothing to configure without TLS, wss:// URLs fail to connect
+	(void)options;
+#endif
+}
+
+void WebSocketTransport::connect( const string &url )
+{
+	// resolving and connecting finish in poll() without the socket saying so, poll until it's open
+	mWait->unwatch( this );
+	mWait->setPollInterval( this, CONNECT_POLL_INTERVAL );
+
+	if ( url.compare( 0, 6, "wss://" ) == 0 ) {
+		mClient.reset();
+#if defined( SPACEBREW_ENABLE_TLS )
+		// fresh client per attempt like below, the session cache outlives it
+		mTlsClient.reset( new TlsWebSocketClient() );
+		mTlsClient->mOpenHandler = [this]() { onOpen(); };
+		mTlsClient->mCloseHandler = [this]() { onClosed(); handleClose(); };
+		mTlsClient->mInterruptHandler = [this]() { handleInterrupt(); };
+		mTlsClient->mFailHandler = [this]( const string &err ) { onClosed(); handleFail( err ); };
+		mTlsClient->mMessageHandler = [this]( const string &msg ) { handleMessage( msg ); };
+		mTlsClient->mSocketHandler = [this]( TransportWait::Socket socket ) { mWait->watch( this, socket ); };
+		mTlsClient->connect( url );
+#else
+		onClosed();
+		handleFail( "Connecting to " + url + " needs a build with SPACEBREW_ENABLE_TLS defined" );
+#endif
+		return;
+	}
+
+#if defined( SPACEBREW_ENABLE_TLS )
+	mTlsClient.reset();
+#endif
+	// websocketpp clients can't be reused once closed, so every attempt gets a fresh one
+	mClient.reset( new WebSocketClient() );
+	mClient->connectOpenEventHandler( [this]() { onOpen(); } );
+	mClient->connectCloseEventHandler( [this]() { onClosed(); handleClose(); } );
+	mClient->connectFailEventHandler( [this]( string err ) { onClosed(); handleFail( err ); } );
+	mClient->connectInterruptEventHandler( [this]() { handleInterrupt(); } );
+	mClient->connectPingEventHandler( [this]( string msg ) { handlePing( msg ); } );
+	mClient->connectMessageEventHandler( [this]( string msg ) { handleMessage( msg ); } );
+	// the block's client doesn't tell which socket it reads, its websocketpp client does once connected
+	WebSocketClient::Client &client = mClient->getClient();
+	client.set_tcp_post_init_handler( [this, &client]( websocketpp::connection_hdl handle ) {
+		websocketpp::lib::error_code err;
+		auto connection = client.get_con_from_hdl( handle, err );
+		if ( ! err )
+			mWait->watch( this, static_cast<TransportWait::Socket>( connection->get_raw_socket().native_handle() ) );
+	} );
+	mClient->connect( url );
+}
+
+void WebSocketTransport::onOpen()
+{
+	mWait->setPollInterval( this, 0 );
+	handleOpen();
+}
+
+void WebSocketTransport::onClosed()
+{
+	mWait->unwatch( this );
+	mWait->setPollInterval( this, 0 );
+}
+
+void WebSocketTransport::disconnect()
+{
+	if ( mClient )
+		mClient->disconnect();
+#if defined( SPACEBREW_ENABLE_TLS )
+	if ( mTlsClient )
+		mTlsClient->disconnect();
+#endif
+}
+
+void WebSocketTransport::write( const string &frame )
+{
+	if ( mClient )
+		mClient->write( frame );
+#if defined( SPACEBREW_ENABLE_TLS )
+	if ( mTlsClient )
+		mTlsClient->write( frame );
+#endif
+	// websocketpp only sends it from the next poll()
+	mWait->wake();
+}
+
+void WebSocketTransport::poll()
+{
+	if ( mClient )
+		mClient->poll();
+#if defined( SPACEBREW_ENABLE_TLS )
+	if ( mTlsClient )
+		mTlsClient->poll();
+#endif
+}
+
+Transport::HandshakeInfo WebSocketTransport::getHandshakeInfo() const
+{
+#if defined( SPACEBREW_ENABLE_TLS )
+	if ( mTlsClient )
+		return mTlsClient->getHandshakeInfo();
+#endif
+	return HandshakeInfo();
+}
+
+FailoverTransport::FailoverTransport( const vector<string> &urls, const Factory &factory )
+: mFactory( factory ), mNextAttempt( 0 ), mActive( NO_ATTEMPT ), mIsConnecting( false ), mIsClosing( false ), mIsClosePending( false ),
+	mStagger( 0.25 ), mAttemptTimeout( 5 ), mNextStartTime( 0 ), mNumFailovers( 0 ), mEpoch( chrono::steady_clock::now() )
+{
+	if ( ! mFactory )
+		mFactory = []() -> TransportRef { return WebSocketTransport::create(); };
+	setUrls( urls );
+}
+
+void FailoverTransport::setUrls( const vector<string> &urls )
+{
+	stopAll();
+	mUrls = urls;
+	mAttempts.clear();
+	mAttempts.resize( mUrls.size() );
+	for ( size_t i = 0; i < mAttempts.size(); ++i ) {
+		// every server gets its own transport, so attempts can overlap
+		TransportRef transport = mFactory();
+		transport->connectOpenEventHandler( [this, i]() { onAttemptOpen( i ); } );
+		transport->connectCloseEventHandler( [this, i]() { onAttemptLost( i, "closed" ); } );
+		transport->connectFailEventHandler( [this, i]( const string &err ) { onAttemptLost( i, err ); } );
+		transport->connectInterruptEventHandler( [this, i]() { if ( i == mActive ) handleInterrupt(); } );
+		transport->connectPingEventHandler( [this, i]( const string &msg ) { if ( i == mActive ) handlePing( msg ); } );
+		transport->connectMessageEventHandler( [this, i]( const string &msg ) { if ( i == mActive ) handleMessage( msg ); } );
+		transport->setWait( mWait );
+		mAttempts[i].mTransport = transport;
+	}
+}
+
+void FailoverTransport::connect( const string &url )
+{
+	if ( ! url.empty() && std::find( mUrls.begin(), mUrls.end(), url ) == mUrls.end() ) {
+		vector<string> urls( 1, url );
+		urls.insert( urls.end(), mUrls.begin(), mUrls.end() );
+		setUrls( urls );
+	}
+
+	stopAll();
+	mOrder.clear();
+	for ( size_t i = 0; i < mAttempts.size(); ++i )
+		mOrder.push_back( i );
+	startRace();
+}
+
+void FailoverTransport::disconnect()
+{
+	mIsConnecting = false;
+	for ( size_t i = 0; i < mAttempts.size(); ++i ) {
+		if ( i != mActive )
+			stopAttempt( i, ATTEMPT_IDLE );
+	}
+	if ( mActive != NO_ATTEMPT ) {
+		// the active transport's close event still reaches the Connection
+		mIsClosing = true;
+		mAttempts[mActive].mTransport->disconnect();
+	}
+}
+
+void FailoverTransport::stopAll()
+{
+	mIsConnecting = false;
+	mIsClosing = false;
+	// the dropped link's own close event is ignored, so poll() reports it. Not from here, the
+	// Connection may be calling connect() with the transport locked.
+	if ( mActive != NO_ATTEMPT ) {
+		mActive = NO_ATTEMPT;
+		mIsClosePending = true;
+		mWait->wake();
+	}
+	for ( size_t i = 0; i < mAttempts.size(); ++i )
+		stopAttempt( i, ATTEMPT_IDLE );
+}
+
+void FailoverTransport::write( const string &frame )
+{
+	if ( mActive != NO_ATTEMPT )
+		mAttempts[mActive].mTransport->write( frame );
+}
+
+void FailoverTransport::poll()
+{
+	// before anything else, a race started since may already open
+	if ( mIsClosePending ) {
+		mIsClosePending = false;
+		handleClose();
+	}
+
+	double time = now();
+	if ( mIsConnecting ) {
+		for ( size_t i = 0; i < mAttempts.size(); ++i ) {
+			if ( mAttempts[i].mState == ATTEMPT_CONNECTING && time - mAttempts[i].mStartTime > mAttemptTimeout ) {
+				mLastError = mUrls[i] + ": timed out";
+				stopAttempt( i, ATTEMPT_FAILED );
+			}
+		}
+		while ( mNextAttempt < mOrder.size() && time >= mNextStartTime )
+			startNextAttempt( time );
+	}
+
+	// handlers may start or stop other attempts, but never resize mAttempts
+	for ( size_t i = 0; i < mAttempts.size(); ++i ) {
+		if ( mAttempts[i].mState == ATTEMPT_CONNECTING || mAttempts[i].mState == ATTEMPT_OPEN )
+			mAttempts[i].mTransport->poll();
+	}
+
+	if ( mIsConnecting && mNextAttempt == mOrder.size() ) {
+		bool pending = false;
+		for ( auto & attempt : mAttempts )
+			pending = pending || attempt.mState == ATTEMPT_CONNECTING;
+		if ( ! pending ) {
+			mIsConnecting = false;
+			handleFail( "Could not connect to any server, last error: " + mLastError );
+		}
+	}
+}
+
+void FailoverTransport::setWait( const TransportWaitRef &wait )
+{
+	Transport::setWait( wait );
+	for ( auto & attempt : mAttempts )
+		attempt.mTransport->setWait( wait );
+}
+
+const string& FailoverTransport::getActiveUrl() const
+{
+	static const string none;
+	return mActive != NO_ATTEMPT ? mUrls[mActive] : none;
+}
+
+Transport::HandshakeInfo FailoverTransport::getHandshakeInfo() const
+{
+	return mActive != NO_ATTEMPT ? mAttempts[mActive].mTransport->getHandshakeInfo() : HandshakeInfo();
+}
+
+void FailoverTransport::startRace()
+{
+	mNextAttempt = 0;
+	mIsConnecting = ! mOrder.empty();
+	mNextStartTime = now();
+	if ( mIsConnecting )
+		startNextAttempt( mNextStartTime );
+}
+
+void FailoverTransport::startNextAttempt( double time )
+{
+	size_t index = mOrder[mNextAttempt++];
+	Attempt &attempt = mAttempts[index];
+	attempt.mState = ATTEMPT_CONNECTING;
+	attempt.mStartTime = time;
+	attempt.mTransport->connect( mUrls[index] );
+	mNextStartTime = time + mStagger;
+}
+
+void FailoverTransport::stopAttempt( size_t index, AttemptState state )
+{
+	// set first, so a transport closing right away finds the attempt stopped
+	Attempt &attempt = mAttempts[index];
+	AttemptState previous = attempt.mState;
+	attempt.mState = state;
+	if ( previous == ATTEMPT_CONNECTING || previous == ATTEMPT_OPEN )
+		attempt.mTransport->disconnect();
+}
+
+void FailoverTransport::onAttemptOpen( size_t index )
+{
+	if ( mAttempts[index].mState != ATTEMPT_CONNECTING )
+		return;
+	if ( mActive != NO_ATTEMPT ) {
+		// lost the race
+		stopAttempt( index, ATTEMPT_IDLE );
+		return;
+	}
+
+	mActive = index;
+	mAttempts[index].mState = ATTEMPT_OPEN;
+	mIsConnecting = false;
+	for ( size_t i = 0; i < mAttempts.size(); ++i ) {
+		if ( i != index )
+			stopAttempt( i, ATTEMPT_IDLE );
+	}
+	handleOpen();
+}
+
+void FailoverTransport::onAttemptLost( size_t index, const string &error )
+{
+	Attempt &attempt = mAttempts[index];
+	if ( index != mActive ) {
+		if ( attempt.mState != ATTEMPT_CONNECTING )
+			return;
+		// don't wait for the stagger when we already know this one won't work
+		attempt.mState = ATTEMPT_FAILED;
+		mLastError = mUrls[index] + ": " + error;
+		if ( mIsConnecting && mNextAttempt < mOrder.size() )
+			startNextAttempt( now() );
+		return;
+	}
+
+	attempt.mState = ATTEMPT_IDLE;
+	mActive = NO_ATTEMPT;
+	handleClose();
+	if ( mIsClosing ) {
+		mIsClosing = false;
+		return;
+	}
+
+	// fail over right away, starting after the server that dropped and trying it again last
+	mNumFailovers++;
+	mOrder.clear();
+	for ( size_t i = 1; i <= mAttempts.size(); ++i )
+		mOrder.push_back( ( index + i ) % mAttempts.size() );
+	startRace();
+}
+
+double FailoverTransport::now() const
+{
+	return chrono::duration<double>( chrono::steady_clock::now() - mEpoch ).count();
+}
+
+namespace {
+
+const uint32_t	RING_MAGIC = 0x53425249; // "SBRI"
+const uint32_t	RING_NUM_SLOTS = 1024;
+const uint32_t	RING_SLOT_SIZE = 512;
+//! An inbox whose owner hasn't polled for this long is treated as gone
+const int64_t	RING_TIMEOUT_MILLIS = 2000;
+const double	RING_REOPEN_INTERVAL = 1.0;
+//! Peers can't wake another process's I/O thread, so it looks at its inbox this often
+const double	RING_POLL_INTERVAL = 0.001;
+
+//! Lives at the start of the inbox file. The file starts out zeroed, so writers wait for mReady.
+struct RingHeader {
+	std::atomic<uint32_t>	mReady;
+	uint32_t				mNumSlots, mSlotSize;
+	std::atomic<int64_t>	mHeartbeat;
+	//! Claimed by producers, and consumed by the owner, on separate cache lines
+	alignas( 64 ) std::atomic<uint64_t>	mHead;
+	alignas( 64 ) std::atomic<uint64_t>	mTail;
+};
+
+//! Precedes each slot's payload. A slot is readable when mSequence is its position + 1,
+//! and writable again when it is the position + mNumSlots.
+struct RingSlot {
+	std::atomic<uint64_t>	mSequence;
+	uint32_t				mLength;
+};
+
+const size_t RING_SLOT_HEADER = ( sizeof( RingSlot ) + 7 ) & ~size_t( 7 );
+
+int64_t nowMillis()
+{
+	// system_clock, because the heartbeat is compared across processes
+	return chrono::duration_cast<chrono::milliseconds>( chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+double nowSeconds()
+{
+	return chrono::duration<double>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+} // anonymous namespace
+
+struct SharedMemoryTransport::Ring {
+	MappedFile	mFile;
+	double		mOpenTime = 0;
+
+	RingHeader*	getHeader() { return reinterpret_cast<RingHeader*>( mFile.getData() ); }
+	RingSlot*	getSlot( uint64_t position )
+	{
+		size_t index = static_cast<size_t>( position % getHeader()->mNumSlots );
+		return reinterpret_cast<RingSlot*>( mFile.getData() + sizeof( RingHeader ) + index * RING_SLOT_SIZE );
+	}
+	size_t		getCapacity() const { return RING_SLOT_SIZE - RING_SLOT_HEADER; }
+
+	//! Creates a new inbox. The old file is removed first, so peers still mapping it can tell.
+	bool create( const string &path )
+	{
+		std::remove( path.c_str() );
+		if ( ! mFile.open( path, MappedFile::READ_WRITE, sizeof( RingHeader ) + RING_NUM_SLOTS * RING_SLOT_SIZE ) )
+			return false;
+
+		RingHeader *header = new ( mFile.getData() ) RingHeader();
+		if ( ! header->mHead.is_lock_free() || ! header->mHeartbeat.is_lock_free() ) {
+			CI_LOG_E( "Shared memory rings need lock-free 64 bit atomics" );
+			mFile.close();
+			return false;
+		}
+		header->mNumSlots = RING_NUM_SLOTS;
+		header->mSlotSize = RING_SLOT_SIZE;
+		header->mHeartbeat.store( nowMillis(), memory_order_relaxed );
+		header->mHead.store( 0, memory_order_relaxed );
+		header->mTail.store( 0, memory_order_relaxed );
+		for ( uint64_t i = 0; i < RING_NUM_SLOTS; ++i ) {
+			RingSlot *slot = new ( getSlot( i ) ) RingSlot();
+			slot->mSequence.store( i, memory_order_relaxed );
+		}
+		header->mReady.store( RING_MAGIC, memory_order_release );
+		return true;
+	}
+
+	//! Maps a peer's inbox, without leaving an empty file behind when the peer isn't running
+	bool open( const string &path )
+	{
+		mOpenTime = nowSeconds();
+		if ( ! mFile.open( path, MappedFile::READ_WRITE_EXISTING ) || mFile.getSize() < sizeof( RingHeader ) )
+			return false;
+		RingHeader *header = getHeader();
+		return header->mReady.load( memory_order_acquire ) == RING_MAGIC && header->mSlotSize == RING_SLOT_SIZE
+			&& mFile.getSize() >= sizeof( RingHeader ) + header->mNumSlots * size_t( RING_SLOT_SIZE );
+	}
+
+	bool isAlive()
+	{
+		return mFile.isOpen() && nowMillis() - getHeader()->mHeartbeat.load( memory_order_relaxed ) < RING_TIMEOUT_MILLIS;
+	}
+
+	//! Any number of processes may push at once
+	bool push( const char *data, size_t length )
+	{
+		RingHeader *header = getHeader();
+		uint64_t position = header->mHead.load( memory_order_relaxed );
+		RingSlot *slot;
+		for ( ;; ) {
+			slot = getSlot( position );
+			int64_t difference = static_cast<int64_t>( slot->mSequence.load( memory_order_acquire ) - position );
+			if ( difference == 0 ) {
+				if ( header->mHead.compare_exchange_weak( position, position + 1, memory_order_relaxed ) )
+					break;
+			}
+			else if ( difference < 0 ) {
+				// the owner hasn't caught up with the oldest slot yet
+				return false;
+			}
+			else {
+				position = header->mHead.load( memory_order_relaxed );
+			}
+		}
+
+		slot->mLength = static_cast<uint32_t>( length );
+		memcpy( reinterpret_cast<char*>( slot ) + RING_SLOT_HEADER, data, length );
+		slot->mSequence.store( position + 1, memory_order_release );
+		return true;
+	}
+
+	//! Only the owner pops. Returns false when the ring is empty, and clears \a isValid for a
+	//! slot whose length is out of bounds, which is skipped.
+	bool pop( string &out, bool &isValid )
+	{
+		RingHeader *header = getHeader();
+		uint64_t position = header->mTail.load( memory_order_relaxed );
+		RingSlot *slot = getSlot( position );
+		if ( slot->mSequence.load( memory_order_acquire ) != position + 1 )
+			return false;
+
+		// written by another process, which may have died halfway or not be one of ours
+		uint32_t length = slot->mLength;
+		isValid = length <= getCapacity();
+		if ( isValid )
+			out.assign( reinterpret_cast<const char*>( slot ) + RING_SLOT_HEADER, length );
+		slot->mSequence.store( position + header->mNumSlots, memory_order_release );
+		header->mTail.store( position + 1, memory_order_relaxed );
+		return true;
+	}
+};
+
+SharedMemoryTransport::SharedMemoryTransport( const string &clientName, const TransportRef &fallback, const string &directory )
+: mClientName( clientName ), mDirectory( directory ), mFallback( fallback ),
+	mNumLocalWrites( 0 ), mNumLocalReads( 0 ), mNumDropped( 0 )
+{
+	if ( ! mFallback )
+		mFallback = WebSocketTransport::create();
+	mFallback->setWait( mWait );
+	if ( mDirectory.empty() ) {
+#if defined( CINDER_MSW )
+		const char *temp = getenv( "TEMP" );
+		mDirectory = temp ? temp : ".";
+#else
+		struct stat info;
+		mDirectory = stat( "/dev/shm", &info ) == 0 && S_ISDIR( info.st_mode ) ? "/dev/shm" : "/tmp";
+#endif
+	}
+	if ( mDirectory.back() != '/' && mDirectory.back() != '\\' )
+		mDirectory += '/';
+
+	mFallback->connectOpenEventHandler( [this]() { handleOpen(); } );
+	mFallback->connectCloseEventHandler( [this]() { handleClose(); } );
+	mFallback->connectFailEventHandler( [this]( const string &err ) { handleFail( err ); } );
+	mFallback->connectInterruptEventHandler( [this]() { handleInterrupt(); } );
+	mFallback->connectPingEventHandler( [this]( const string &msg ) { handlePing( msg ); } );
+	mFallback->connectMessageEventHandler( [this]( const string &msg ) { handleMessage( msg ); } );
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+	if ( mInbox ) {
+		mInbox.reset();
+		std::remove( getInboxPath( mClientName ).c_str() );
+		mWait->setPollInterval( this, 0 );
+	}
+}
+
+void SharedMemoryTransport::setWait( const TransportWaitRef &wait )
+{
+	if ( mInbox ) {
+		mWait->setPollInterval( this, 0 );
+		wait->setPollInterval( this, RING_POLL_INTERVAL );
+	}
+	Transport::setWait( wait );
+	mFallback->setWait( wait );
+}
+
+string SharedMemoryTransport::getInboxPath( const string &clientName ) const
+{
+	// client names can be anything, so keep what's safe in a file name and add a hash against collisions
+	string path = mDirectory + "spacebrew-";
+	for ( char c : clientName )
+		path += isalnum( static_cast<unsigned char>( c ) ) ? c : '_';
+	char hash[20];
+	snprintf( hash, sizeof( hash ), "-%08x.ring", static_cast<unsigned>( std::hash<string>()( clientName ) ) );
+	return path + hash;
+}
+
+void SharedMemoryTransport::connect( const string &url )
+{
+	if ( ! mInbox ) {
+		mInbox.reset( new Ring() );
+		if ( ! mInbox->create( getInboxPath( mClientName ) ) ) {
+			CI_LOG_E( "Can't create a shared memory inbox in " << mDirectory << ", local messages will go through the server" );
+			mInbox.reset();
+		}
+		else {
+			mWait->setPollInterval( this, RING_POLL_INTERVAL );
+		}
+	}
+	mFallback->connect( url );
+}
+
+void SharedMemoryTransport::disconnect()
+{
+	mFallback->disconnect();
+}
+
+void SharedMemoryTransport::write( const string &frame )
+{
+	if ( ! mLocalRoutes.empty() && frame.compare( 0, 11, "{\"message\":" ) == 0 ) {
+		MessageFields fields;
+		if ( scanFrame( frame, fields ) == FRAME_MESSAGE && ! fields.mIsEscaped ) {
+			mLookupKey.assign( fields.mName.mBegin, fields.mName.size() );
+			mLookupKey += '\x1f';
+			mLookupKey.append( fields.mType.mBegin, fields.mType.size() );
+			auto found = mLocalRoutes.find( mLookupKey );
+			if ( found != mLocalRoutes.end()
+				 && writeLocal( frame, fields.mName.mBegin - frame.data(), fields.mName.mEnd - frame.data(), found->second ) )
+				return;
+		}
+	}
+	mFallback->write( frame );
+}
+
+bool SharedMemoryTransport::writeLocal( const string &frame, size_t nameBegin, size_t nameEnd, const vector<Target> &targets )
+{
+	// all or nothing, the server must not deliver it to some subscribers while we deliver to the rest
+	for ( auto & target : targets ) {
+		Ring *peer = findPeer( target.mClientName );
+		if ( ! peer || frame.size() - ( nameEnd - nameBegin ) + target.mSubscriberName.size() > peer->getCapacity() )
+			return false;
+	}
+
+	for ( auto & target : targets ) {
+		// the server renames messages after the subscriber they're routed to, so we do too
+		mLocalFrame.assign( frame, 0, nameBegin );
+		mLocalFrame += target.mSubscriberName;
+		mLocalFrame.append( frame, nameEnd, string::npos );
+		if ( findPeer( target.mClientName )->push( mLocalFrame.data(), mLocalFrame.size() ) )
+			mNumLocalWrites++;
+		else
+			mNumDropped++;
+	}
+	return true;
+}
+
+SharedMemoryTransport::Ring* SharedMemoryTransport::findPeer( const string &clientName )
+{
+	if ( clientName == mClientName )
+		return mInbox.get();
+
+	auto &peer = mPeers[clientName];
+	if ( peer && peer->isAlive() )
+		return peer.get();
+
+	// the owner may have restarted with a new file, but don't hammer the file system looking
+	if ( peer && nowSeconds() - peer->mOpenTime < RING_REOPEN_INTERVAL )
+		return nullptr;
+	peer.reset( new Ring() );
+	if ( ! peer->open( getInboxPath( clientName ) ) || ! peer->isAlive() )
+		return nullptr;
+	return peer.get();
+}
+
+void SharedMemoryTransport::poll()
+{
+	if ( mInbox )
+		mInbox->getHeader()->mHeartbeat.store( nowMillis(), memory_order_relaxed );
+
+	mFallback->poll();
+
+	// stop after one ring's worth, so busy peers can't keep us here forever
+	bool isValid = true;
+	for ( uint32_t i = 0; mInbox && i < RING_NUM_SLOTS && mInbox->pop( mReadFrame, isValid ); ++i ) {
+		if ( ! isValid ) {
+			mNumDropped++;
+			continue;
+		}
+		mNumLocalReads++;
+		handleMessage( mReadFrame );
+	}
+}
+
+void SharedMemoryTransport::setRoutes( const vector<Route> &routes )
+{
+	mLocalRoutes.clear();
+	vector<string> remote;
+	for ( auto & route : routes ) {
+		if ( route.publisher.clientName != mClientName )
+			continue;
+		string key = route.publisher.name + '\x1f' + route.publisher.type;
+		// the server sees both ends of a route stay on one host from the same address
+		if ( route.subscriber.remoteAddress.empty() || route.subscriber.remoteAddress != route.publisher.remoteAddress ) {
+			remote.push_back( key );
+			continue;
+		}
+		Target target;
+		target.mClientName = route.subscriber.clientName;
+		target.mSubscriberName = route.subscriber.name;
+		mLocalRoutes[key].push_back( target );
+	}
+	for ( auto & key : remote )
+		mLocalRoutes.erase( key );
+}
+
+LoopbackTransport::LoopbackTransport()
+: mIsOpen( false ), mIsOpening( false ), mIsClosing( false ), mEcho( true ),
+	mNumWritten( 0 ), mNumDelivered( 0 )
+{
+}
+
+void LoopbackTransport::connect( const string & )
+{
+	mIsOpen = false;
+	mIsOpening = true;
+	mWait->wake();
+}
+
+void LoopbackTransport::disconnect()
+{
+	mIsOpening = false;
+	mIsClosing = mIsOpen;
+	mIsOpen = false;
+	mWait->wake();
+}
+
+void LoopbackTransport::write( const string &frame )
+{
+	if ( ! mIsOpen )
+		return;
+
+	mNumWritten++;
+	if ( mEcho && ( frame.compare( 0, 11, "{\"message\":" ) == 0 || frame.compare( 0, 1, "[" ) == 0 ) )
+		inject( frame );
+}
+
+void LoopbackTransport::inject( const string &frame )
+{
+	if ( mSpare.empty() ) {
+		mPending.push_back( frame );
+	}
+	else {
+		mPending.push_back( std::move( mSpare.back() ) );
+		mSpare.pop_back();
+		mPending.back().assign( frame );
+	}
+	mWait->wake();
+}
+
+void LoopbackTransport::poll()
+{
+	if ( mIsOpening ) {
+		mIsOpening = false;
+		mIsOpen = true;
+		handleOpen();
+	}
+	if ( mIsClosing ) {
+		mIsClosing = false;
+		handleClose();
+	}
+	if ( ! mIsOpen )
+		return;
+
+	// frames written while delivering wait for the next poll, like a real socket
+	mDelivering.swap( mPending );
+	for ( auto &frame : mDelivering ) {
+		handleMessage( frame );
+		mNumDelivered++;
+	}
+	for ( auto &frame : mDelivering )
+		mSpare.push_back( std::move( frame ) );
+	mDelivering.clear();
+}
+
+#pragma mark Connection
+	
+namespace {
+
+//! ws://host:port, or \a host as given when it comes with a scheme such as wss://, plus the port if it has none
+string makeUrl( const string &host, uint16_t port )
+{
+	size_t scheme = host.find( "://" );
+	if ( scheme == string::npos )
+		return "ws://" + host + ":" + to_string( port );
+
+	size_t authority = scheme + 3;
+	size_t path = host.find( '/', authority );
+	if ( host.find( ':', authority ) < path )
+		return host;
+	string url = host.substr( 0, path ) + ":" + to_string( port );
+	if ( path != string::npos )
+		url += host.substr( path );
+	return url;
+}
+
+}
+
+ConnectionRef Connection::create( const std::string& host, const std::string& name, const std::string& description )
+{
+	return ConnectionRef( new Connection( host, SPACEBREW_PORT, name, description ) );
+}
+    
+ConnectionRef Connection::create( const std::string& host, const uint16_t &port, const std::string& name, const std::string& description )
+{
+    return ConnectionRef( new Connection( host, port, name, description ) );
+}
+
+Connection::Connection( const std::string& host, const uint16_t &port, const std::string& name, const std::string& description )
+: mHost( makeUrl( host, port ) ),
+    mIsConnected( false ), mReconnectInterval( 2.0 ), mShouldAutoReconnect( false ),
+    mLastTimeTriedConnect( 0 ), mConfig( Config( name, description ) )
+{
+	initialize();
+}
+
+Connection::~Connection()
+{
+	// Disconnect update signal:
+    mUpdateConnection.disconnect();
+	stopIoThread();
+	*mAliveToken = false;
+	// while the rest is still around, destroys the frames of coroutines waiting on these
+	mConnectWaiters.clear();
+	mSentWaiters.clear();
+	mMessageWaiters.clear();
+}
+
+void Connection::initialize()
+{
+	mAliveToken = make_shared<bool>( true );
+	// Setup callbacks:
+	if ( app::App::get() )
+		mUpdateConnection = app::App::get()->getSignalUpdate().connect( std::bind( &Connection::update, this ) ) ;
+	setTransport( WebSocketTransport::create() );
+}
+
+void Connection::setTransport( const TransportRef &transport )
+{
+	// the I/O thread polls the old transport, it starts over with the new one
+	bool hadIoThread = isIoThread();
+	stopIoThread();
+
+	if ( mTransport ) {
+		mTransport->disconnect();
+		mIsConnected = false;
+	}
+
+	mTransport = transport;
+	mTransport->connectOpenEventHandler( [this] { handleTransportEvent( IO_OPEN, string() ); } );
+	mTransport->connectCloseEventHandler( [this] { handleTransportEvent( IO_CLOSE, string() ); } );
+	mTransport->connectFailEventHandler( [this]( const string &err ) { handleTransportEvent( IO_FAIL, err ); } );
+	mTransport->connectInterruptEventHandler( [this] { handleTransportEvent( IO_INTERRUPT, string() ); } );
+	mTransport->connectPingEventHandler( [this]( const string &msg ) { handleTransportEvent( IO_PING, msg ); } );
+	mTransport->connectMessageEventHandler( [this]( const string &msg ) { handleTransportEvent( IO_MESSAGE, msg ); } );
+
+	// local delivery depends on knowing where every route leads
+	if ( std::dynamic_pointer_cast<SharedMemoryTransport>( mTransport ) ) {
+		setRouteTracking( true );
+		updateRouteCounts();
+	}
+
+	if ( hadIoThread )
+		setIoThread( true, mIsWakingApp );
+}
+
+void Connection::update()
+{
+	// a fresh write budget goes to the frames that waited longest, highest priority first
+	mNumWritesThisUpdate = 0;
+	if ( hasQueuedFrames() )
+		flushLanes();
+
+	// with an I/O thread the transport was polled already, its events wait in a queue
+	if ( isIoThread() )
+		processIoEvents();
+	else
+		mTransport->poll();
+	for ( auto & shard : mShards )
+		shard.mTransport->poll();
+
+	if ( mIsConnected && ! mFilteredPublishers.empty() )
+		updateFilters( getElapsedSeconds() );
+
+	if ( mAdminQueueStart < mAdminQueue.size() )
+		updateTopology();
+
+	if ( ! mReceivedBatch.empty() ) {
+		onMessageBatch.emit( mReceivedBatch );
+		mReceivedBatch.clear();
+	}
+
+	// everything sent since the last update() leaves in one frame
+	flush();
+
+	if ( ! mSentWaiters.empty() && ! hasQueuedFrames() ) {
+		// deferred frames went out in updateFilters(), and callbacks may wait again
+		vector<function<void ()>> waiters;
+		waiters.swap( mSentWaiters );
+		for ( auto & waiter : waiters )
+			waiter();
+	}
+
+	if ( mIsRouteSnapshotPending ) {
+		mIsRouteSnapshotPending = false;
+		mHasRouteSnapshot = true;
+	}
+
+    if ( mShouldAutoReconnect ) {
+		{
+			auto lock = lockTransport();
+			if ( ! mIsConnected && ! mTransport->isConnecting() && getElapsedSeconds() - mLastTimeTriedConnect > mReconnectInterval ) {
+				// Re-establish connection, the transport starts over with a fresh client:
+				mTransport->connect( mHost );
+				// Reset connection attempt time:
+				mLastTimeTriedConnect = getElapsedSeconds();
+			}
+		}
+		for ( size_t i = 0; i < mShards.size(); ++i ) {
+			Shard &shard = mShards[i];
+			if ( mIsConnected && ! shard.mIsConnected && ! shard.mTransport->isConnecting() && getElapsedSeconds() - shard.mLastTimeTriedConnect > mReconnectInterval )
+				connectShard( i + 1 );
+		}
+    }
+}
+
+void Connection::connect()
+{
+	auto lock = lockTransport();
+    mTransport->connect( mHost );
+}
+
+void Connection::connect( const string &host, const Config &config )
+{
+    connect( host, SPACEBREW_PORT, config);
+}
+    
+void Connection::connect( const std::string &host, const uint16_t &port, const Config &config )
+{
+    mHost = makeUrl( host, port );
+    mConfig = config;
+	// a config of its own replaces any schema
+	mSchema = nullptr;
+	mSchemaSize = 0;
+	rebuildEndpoints();
+    
+	auto lock = lockTransport();
+    mTransport->connect( mHost );
+}
+
+void Connection::connect( const vector<string> &hosts, const uint16_t &port, const Config &config )
+{
+	if ( hosts.empty() ) {
+		CI_LOG_E( "No hosts to connect to" );
+		return;
+	}
+
+	vector<string> urls;
+	for ( auto & host : hosts )
+		urls.push_back( makeUrl( host, port ) );
+	mHost = urls.front();
+	mConfig = config;
+	mSchema = nullptr;
+	mSchemaSize = 0;
+	rebuildEndpoints();
+
+	auto failover = std::dynamic_pointer_cast<FailoverTransport>( mTransport );
+	if ( ! failover ) {
+		failover = FailoverTransport::create();
+		setTransport( failover );
+	}
+	auto lock = lockTransport();
+	failover->setUrls( urls );
+	failover->connect( mHost );
+}
+
+void Connection::send( const string &name, const string &type, const string &value )
+{
+	double number = 0;
+	bool isNumeric = type == TYPE_RANGE && ! value.empty();
+	if ( isNumeric )
+		number = strtod( value.c_str(), nullptr );
+
+	size_t id;
+	string *frame = beginFrame( name, type, &id, isNumeric ? &number : nullptr );
+	if ( frame ) {
+		if ( type == TYPE_STRING || type == TYPE_BOOLEAN ) {
+			*frame += '"';
+			appendEscaped( value, *frame );
+			*frame += '"';
+		}
+		else {
+			*frame += value;
+		}
+		endFrame( id );
+	}
+}
+
+template<typename T>
+void Connection::sendValue( const string &name, const typename Codec<T>::value_type &value )
+{
+	double number;
+	size_t id;
+	string *frame = beginFrame( name, Codec<T>::type(), &id, getFilterValue( value, number ) ? &number : nullptr );
+	if ( frame ) {
+		Codec<T>::encode( value, *frame );
+		endFrame( id );
+	}
+}
+
+void Connection::sendString( const string &name, const string &value )
+{
+	sendValue<String>( name, value );
+}
+
+void Connection::sendRange( const string &name, int value )
+{
+	sendValue<Range>( name, value );
+}
+
+void Connection::sendBoolean( const string &name, bool value )
+{
+	sendValue<Boolean>( name, value );
+}
+
+void Connection::sendRangeArray( const string &name, const int *values, size_t count )
+{
+	size_t id;
+	string *frame = beginFrame( name, TYPE_RANGE_ARRAY, &id );
+	if ( frame ) {
+		appendRangeArray( values, count, *frame );
+		endFrame( id );
+	}
+}
+
+void Connection::sendRangeArray( const string &name, const float *normalized, size_t count )
+{
+	mQuantized.resize( count );
+	quantizeRange( normalized, mQuantized.data(), count );
+	sendRangeArray( name, mQuantized.data(), count );
+}
+
+void Connection::sendFloatArray( const string &name, const float *values, size_t count )
+{
+	size_t id;
+	string *frame = beginFrame( name, TYPE_FLOAT_ARRAY, &id );
+	if ( frame ) {
+		appendFloatArray( values, count, *frame );
+		endFrame( id );
+	}
+}
+
+void Connection::send( const Message &m )
+{
+	sendMessage( m );
+}
+
+void Connection::send( Message* m )
+{
+	sendMessage( *m );
+}
+
+void Connection::sendMessage( const Message &m )
+{
+	double number = 0;
+	bool isNumeric = m.getType() == TYPE_RANGE && ! m.getRawValue().empty();
+	if ( isNumeric )
+		number = strtod( m.getRawValue().c_str(), nullptr );
+
+	size_t id;
+	string *frame = beginFrame( m.getName(), m.getType(), &id, isNumeric ? &number : nullptr );
+	if ( ! frame )
+		return;
+	// the message encodes itself, subclasses may override it, under the client name of its publisher's shard
+	*frame = m.getJSON( getShardClientName( id != NO_ENDPOINT ? mPublisherStates[id].mShard : 0 ) );
+	// endFrame() closes it again
+	if ( frame->size() >= 2 && frame->compare( frame->size() - 2, 2, "}}" ) == 0 )
+		frame->resize( frame->size() - 2 );
+	endFrame( id );
+}
+
+void Connection::addSubscribe( const string &name, const string &type )
+{
+    mConfig.addSubscribe( name, type );
+	registerSubscriber( name, type );
+	publishLatestIndex();
+    if ( mIsConnected ) {
+        updatePubSub();
+    }
+}
+
+void Connection::addSubscribe( const Message &m )
+{
+    mConfig.addSubscribe( m );
+	registerSubscriber( m.getName(), m.getType() );
+	publishLatestIndex();
+    if ( mIsConnected ) {
+        updatePubSub();
+    }
+}
+
+void Connection::addPublish( const string &name, const string &type, const string &def)
+{
+    mConfig.addPublish( name, type, def );
+	registerPublisher( name, type );
+	updateRouteCounts();
+    if ( mIsConnected )
+        updatePubSub();
+}
+
+void Connection::addPublish( const string &name, const string &type, const string &def, const PublishFilter &filter )
+{
+	addPublish( name, type, def );
+	setPublishFilter( name, filter );
+}
+
+void Connection::setPublishFilter( const string &name, const PublishFilter &filter )
+{
+	auto found = mPublisherIds.find( name );
+	if ( found == mPublisherIds.end() ) {
+		CI_LOG_E( "Can't filter " << name << ", it isn't a publisher!" );
+		return;
+	}
+
+	size_t id = found->second;
+	mPublisherStates[id].mFilter = filter;
+	mPublisherStates[id].mHasPending = false;
+	auto filtered = std::find( mFilteredPublishers.begin(), mFilteredPublishers.end(), id );
+	if ( filter.isActive() && filtered == mFilteredPublishers.end() )
+		mFilteredPublishers.push_back( id );
+	else if ( ! filter.isActive() && filtered != mFilteredPublishers.end() )
+		mFilteredPublishers.erase( filtered );
+}
+
+void Connection::addPublish( const Message &m )
+{
+    mConfig.addPublish( m );
+	registerPublisher( m.getName(), m.getType() );
+	updateRouteCounts();
+    if ( mIsConnected )
+        updatePubSub();
+}
+
+namespace {
+
+void appendHeader( const string &clientName, const string &name, const string &type, string &out )
+{
+	out += "{\"message\":{\"clientName\":\"";
+	appendEscaped( clientName, out );
+	out += "\",\"name\":\"";
+	appendEscaped( name, out );
+	out += "\",\"type\":\"";
+	appendEscaped( type, out );
+	out += "\",\"value\":";
+}
+
+//! A new epoch for a publisher's sequence numbers, unique within the process and random across processes
+uint64_t newSequenceEpoch()
+{
+	static const uint64_t sProcessNonce = [] {
+		random_device device;
+		return static_cast<uint64_t>( device() ) << 32 | device();
+	}();
+	static atomic<uint64_t> sCount( 0 );
+	// below 2^48 so JavaScript reads it exactly, and never 0, which stands for senders without epochs
+	return ( sProcessNonce + sCount.fetch_add( 1, memory_order_relaxed ) ) % 0xffffffffffffull + 1;
+}
+
+} // anonymous namespace
+
+size_t Connection::registerPublisher( const string &name, const string &type )
+{
+	PublisherState state;
+	state.mName = name;
+	state.mType = type;
+	state.mEpoch = newSequenceEpoch();
+	state.mShard = getPublisherShard( name );
+	appendHeader( getShardClientName( state.mShard ), name, type, state.mHeader );
+	mPublisherStates.push_back( std::move( state ) );
+	mConfigFrame.clear();
+	// the first registration of a name wins lookups, matching what the server routes
+	mPublisherIds.emplace( name, mPublisherStates.size() - 1 );
+	return mPublisherStates.size() - 1;
+}
+
+size_t Connection::registerSubscriber( const string &name, const string &type )
+{
+	SubscriberState state;
+	state.mName = name;
+	state.mType = type;
+	// ids past the schema's rows can't be mistaken for one
+	state.mEndpointId = mSchemaSize + mSubscriberStates.size();
+	// a subscriber keeps its latest value through config changes
+	state.mLatest = mLatestValues.acquire( name );
+	mSubscriberStates.push_back( std::move( state ) );
+	indexSubscriber( mSubscriberStates.size() - 1 );
+	mConfigFrame.clear();
+	return mSubscriberStates.size() - 1;
+}
+
+namespace {
+
+uint32_t hashName( const char *name, size_t length )
+{
+	// FNV-1a, endpoint names are short
+	uint32_t hash = 2166136261u;
+	for ( size_t i = 0; i < length; ++i )
+		hash = ( hash ^ static_cast<unsigned char>( name[i] ) ) * 16777619u;
+	return hash;
+}
+
+} // anonymous namespace
+
+void Connection::indexSubscriber( size_t subscriberId )
+{
+	const string &name = mSubscriberStates[subscriberId].mName;
+	// the first registration of a name wins lookups
+	if ( findSubscriber( name ) != NO_ENDPOINT )
+		return;
+
+	// kept at most half full, so probes stay short
+	if ( ( subscriberId + 1 ) * 2 > mSubscriberTable.size() ) {
+		size_t size = 16;
+		while ( size < ( subscriberId + 1 ) * 4 )
+			size *= 2;
+		mSubscriberTable.assign( size, 0 );
+		for ( size_t id = 0; id < subscriberId; ++id ) {
+			if ( findSubscriber( mSubscriberStates[id].mName ) == NO_ENDPOINT )
+				indexSubscriber( id );
+		}
+	}
+
+	size_t mask = mSubscriberTable.size() - 1;
+	size_t slot = hashName( name.data(), name.size() ) & mask;
+	while ( mSubscriberTable[slot] != 0 )
+		slot = ( slot + 1 ) & mask;
+	mSubscriberTable[slot] = static_cast<uint32_t>( subscriberId + 1 );
+}
+
+void Connection::rebuildEndpoints()
+{
+	auto previous = std::move( mSubscriberStates );
+	auto previousPublishers = std::move( mPublisherStates );
+	mPublisherStates.clear();
+	mSubscriberStates.clear();
+	mPublisherIds.clear();
+	mSubscriberTable.clear();
+	mConfigFrame.clear();
+
+	for ( auto & pub : mConfig.getPublishers() )
+		registerPublisher( pub.getName(), pub.getType() );
+	for ( auto & sub : mConfig.getSubscribers() )
+		registerSubscriber( sub.getName(), sub.getType() );
+	publishLatestIndex();
+
+	for ( size_t row = 0; row < mSchemaSize; ++row ) {
+		if ( mSchema[row].direction != SchemaEntry::SUBSCRIBE )
+			continue;
+		size_t id = findSubscriber( mSchema[row].name );
+		if ( id != NO_ENDPOINT )
+			mSubscriberStates[id].mEndpointId = row;
+	}
+
+	// keep typed subscriber callbacks alive for endpoints that survived the new config
+	for ( auto & state : previous ) {
+		size_t id = findSubscriber( state.mName );
+		if ( id != NO_ENDPOINT && state.mSignal && ! mSubscriberStates[id].mSignal )
+			mSubscriberStates[id].mSignal = state.mSignal;
+		if ( id != NO_ENDPOINT && state.mHistory && ! mSubscriberStates[id].mHistory )
+			mSubscriberStates[id].mHistory = state.mHistory;
+		if ( id != NO_ENDPOINT && state.mStrand && ! mSubscriberStates[id].mStrand )
+			mSubscriberStates[id].mStrand = state.mStrand;
+		if ( id != NO_ENDPOINT && state.mDelivery && ! mSubscriberStates[id].mDelivery )
+			mSubscriberStates[id].mDelivery = state.mDelivery;
+	}
+
+	mFilteredPublishers.clear();
+	vector<size_t> newIds( previousPublishers.size(), static_cast<size_t>( NO_ENDPOINT ) );
+	for ( size_t previousId = 0; previousId < previousPublishers.size(); ++previousId ) {
+		const PublisherState &state = previousPublishers[previousId];
+		size_t id = findPublisher( state.mName, state.mType );
+		newIds[previousId] = id;
+		if ( id == NO_ENDPOINT )
+			continue;
+		if ( state.mFilter.isActive() )
+			setPublishFilter( state.mName, state.mFilter );
+		mPublisherStates[id].mPriority = state.mPriority;
+		// receivers would take a count starting over for a restart
+		mPublisherStates[id].mSequence = state.mSequence;
+		mPublisherStates[id].mEpoch = state.mEpoch;
+	}
+	// queued frames stay in their lane, which matches the priority carried over, under the new ids
+	for ( auto & lane : mLanes ) {
+		for ( auto & queued : lane ) {
+			if ( queued.mPublisherId != NO_ENDPOINT )
+				queued.mPublisherId = queued.mPublisherId < newIds.size() ? newIds[queued.mPublisherId] : NO_ENDPOINT;
+		}
+	}
+	updatePublisherHandles();
+	updateRouteCounts();
+}
+
+void Connection::publishLatestIndex()
+{
+	auto index = make_shared<LatestValues::Index>();
+	index->mSubscribers.reserve( mSubscriberStates.size() );
+	for ( auto & state : mSubscriberStates ) {
+		index->mSubscribers.push_back( state.mLatest );
+		index->mNames.emplace( state.mName, state.mLatest );
+	}
+	mLatestValues.publish( index );
+}
+
+size_t Connection::findPublisher( const string &name, const string &type ) const
+{
+	auto found = mPublisherIds.find( name );
+	if ( found == mPublisherIds.end() || mPublisherStates[found->second].mType != type )
+		return NO_ENDPOINT;
+	return found->second;
+}
+
+size_t Connection::findSubscriber( const char *name, size_t length ) const
+{
+	if ( mSubscriberTable.empty() )
+		return NO_ENDPOINT;
+
+	size_t mask = mSubscriberTable.size() - 1;
+	for ( size_t slot = hashName( name, length ) & mask; mSubscriberTable[slot] != 0; slot = ( slot + 1 ) & mask ) {
+		size_t id = mSubscriberTable[slot] - 1;
+		const string &candidate = mSubscriberStates[id].mName;
+		if ( candidate.size() == length && memcmp( candidate.data(), name, length ) == 0 )
+			return id;
+	}
+	return NO_ENDPOINT;
+}
+
+void Connection::setSchema( const SchemaEntry *schema, size_t size )
+{
+	Config config( mConfig.getName(), mConfig.getDescription() );
+	for ( size_t row = 0; row < size; ++row ) {
+		const SchemaEntry &entry = schema[row];
+		if ( entry.direction == SchemaEntry::PUBLISH )
+			config.addPublish( entry.name, entry.type, entry.def ? entry.def : "" );
+		else
+			config.addSubscribe( entry.name, entry.type );
+	}
+
+	mSchema = schema;
+	mSchemaSize = size;
+	mConfig = std::move( config );
+	rebuildEndpoints();
+	updateRouteCounts();
+	// encoded once now, and reused for every reconnect
+	mConfigFrame = getShardConfig( 0 );
+	if ( mIsConnected )
+		updatePubSub();
+}
+
+void Connection::updatePubSub()
+{
+	if ( mConfigFrame.empty() )
+		mConfigFrame = getShardConfig( 0 );
+	writeFrame( NO_ENDPOINT, mConfigFrame );
+}
+
+signals::Signal<void (const Message&)>& Connection::getSubscriberSignal( size_t subscriberId )
+{
+	auto &state = mSubscriberStates[subscriberId];
+	if ( ! state.mSignal )
+		state.mSignal = make_shared<signals::Signal<void (const Message&)>>();
+	return *state.mSignal;
+}
+
+string* Connection::beginFrame( size_t publisherId, const double *number )
+{
+	if ( ! mIsConnected ) {
+		CI_LOG_E( "Send failed, not connected!" );
+		return nullptr;
+	}
+
+	auto &state = mPublisherStates[publisherId];
+	if ( mHasRouteSnapshot && state.mNumRoutes == 0 ) {
+		mStats.sendsSuppressed++;
+		return nullptr;
+	}
+
+	if ( state.mFilter.isActive() ) {
+		switch ( applyFilter( state, number, getElapsedSeconds() ) ) {
+			case FILTER_DROP:
+				return nullptr;
+			case FILTER_DEFER:
+				// encode into the pending frame, updateFilters() sends it when the interval is up
+				state.mPending = state.mHeader;
+				state.mIsDeferring = true;
+				return &state.mPending;
+			case FILTER_SEND:
+				break;
+		}
+	}
+
+	mFrame = state.mHeader;
+	return &mFrame;
+}
+
+string* Connection::beginFrame( const string &name, const string &type, size_t *publisherId, const double *number )
+{
+	*publisherId = findPublisher( name, type );
+	if ( *publisherId != NO_ENDPOINT )
+		return beginFrame( *publisherId, number );
+
+	if ( ! mIsConnected ) {
+		CI_LOG_E( "Send failed, not connected!" );
+		return nullptr;
+	}
+	mFrame.clear();
+	appendHeader( mConfig.getName(), name, type, mFrame );
+	return &mFrame;
+}
+
+string* Connection::beginHandleFrame( size_t handle, size_t *publisherId, const double *number )
+{
+	*publisherId = mPublisherHandles[handle].mId;
+	if ( *publisherId == NO_ENDPOINT ) {
+		CI_LOG_E( "Send failed, " << mPublisherHandles[handle].mName << " isn't a publisher anymore!" );
+		return nullptr;
+	}
+	return beginFrame( *publisherId, number );
+}
+
+size_t Connection::acquirePublisherHandle( const string &name, const string &type )
+{
+	size_t id = findPublisher( name, type );
+	for ( size_t handle = 0; handle < mPublisherHandles.size(); ++handle ) {
+		if ( mPublisherHandles[handle].mName == name && mPublisherHandles[handle].mType == type ) {
+			mPublisherHandles[handle].mId = id;
+			return handle;
+		}
+	}
+	mPublisherHandles.push_back( PublisherHandle{ name, type, id } );
+	return mPublisherHandles.size() - 1;
+}
+
+void Connection::updatePublisherHandles()
+{
+	for ( auto & handle : mPublisherHandles )
+		handle.mId = findPublisher( handle.mName, handle.mType );
+}
+
+void Connection::endFrame( size_t publisherId )
+{
+	if ( publisherId != NO_ENDPOINT && mPublisherStates[publisherId].mIsDeferring ) {
+		auto &state = mPublisherStates[publisherId];
+		state.mPending += "}}";
+		state.mIsDeferring = false;
+		return;
+	}
+
+	mFrame += "}}";
+	writeFrame( publisherId, mFrame );
+}
+
+void Connection::writeFrame( size_t publisherId, const string &frame )
+{
+	Priority priority = PRIORITY_CONTROL;
+	if ( publisherId != NO_ENDPOINT ) {
+		auto &state = mPublisherStates[publisherId];
+		priority = state.mPriority;
+		if ( state.mFilter.isActive() ) {
+			state.mLastSendTime = getElapsedSeconds();
+			if ( state.mFilter.getHeartbeat() > 0 && &frame != &state.mLastFrame )
+				state.mLastFrame = frame;
+		}
+	}
+	// stamped on the way out, so held back and repeated frames get numbers in the order they leave
+	const string &out = mIsSequencing && publisherId != NO_ENDPOINT ? stampFrame( publisherId, frame ) : frame;
+
+	// other shards have sockets of their own, so the budget and lanes of this one don't apply
+	if ( publisherId != NO_ENDPOINT && mPublisherStates[publisherId].mShard > 0 ) {
+		writeShard( mPublisherStates[publisherId].mShard, out );
+		return;
+	}
+
+	// flushLanes() only leaves frames queued once the budget is spent, so while there is budget
+	// left every lane is empty and writing now can't overtake anything
+	if ( mMaxWritesPerUpdate == 0 || mNumWritesThisUpdate < mMaxWritesPerUpdate ) {
+		mNumWritesThisUpdate++;
+		transmitFrame( out );
+		return;
+	}
+
+	mStats.writesQueued++;
+	mLanes[priority].push_back( QueuedFrame() );
+	QueuedFrame &queued = mLanes[priority].back();
+	queued.mPublisherId = publisherId;
+	if ( ! mSpareFrames.empty() ) {
+		queued.mFrame.swap( mSpareFrames.back() );
+		mSpareFrames.pop_back();
+	}
+	queued.mFrame.assign( out );
+}
+
+const string& Connection::stampFrame( size_t publisherId, const string &frame )
+{
+	// message frames end with the "}}" closing the message and the frame
+	if ( frame.size() < 2 || frame.compare( frame.size() - 2, 2, "}}" ) != 0 )
+		return frame;
+
+	mStampedFrame.assign( frame, 0, frame.size() - 2 );
+	mStampedFrame += ",\"sbx\":{\"seq\":";
+	mStampedFrame += to_string( ++mPublisherStates[publisherId].mSequence );
+	mStampedFrame += ",\"e\":";
+	mStampedFrame += to_string( mPublisherStates[publisherId].mEpoch );
+	mStampedFrame += ",\"t\":";
+	mStampedFrame += to_string( getMillisSinceEpoch() );
+	mStampedFrame += "}}}";
+	return mStampedFrame;
+}
+
+void Connection::transmitFrame( const string &frame )
+{
+	if ( mRecorder )
+		mRecorder->record( Recorder::OUTBOUND, frame );
+
+	if ( mIsBatching && frame.compare( 0, 11, "{\"message\":" ) == 0 ) {
+		mBatch += mBatch.empty() ? '[' : ',';
+		mBatch += frame;
+		mNumBatched++;
+		if ( mBatch.size() >= mMaxBatchBytes )
+			flush();
+		return;
+	}
+
+	// anything else goes out on its own, after the messages sent before it
+	flush();
+	auto lock = lockTransport();
+	mTransport->write( frame );
+}
+
+void Connection::flush()
+{
+	if ( mBatch.empty() )
+		return;
+
+	if ( mNumBatched == 1 ) {
+		// a batch of one is just a message
+		mBatch.erase( 0, 1 );
+	}
+	else {
+		mBatch += ']';
+		mStats.batchesSent++;
+	}
+	{
+		auto lock = lockTransport();
+		mTransport->write( mBatch );
+	}
+	mBatch.clear();
+	mNumBatched = 0;
+}
+
+void Connection::setBatching( bool batching, size_t maxBytes )
+{
+	if ( ! batching )
+		flush();
+	mIsBatching = batching;
+	mMaxBatchBytes = maxBytes;
+}
+
+void Connection::flushLanes()
+{
+	for ( auto &lane : mLanes ) {
+		while ( ! lane.empty() && ( mMaxWritesPerUpdate == 0 || mNumWritesThisUpdate < mMaxWritesPerUpdate ) ) {
+			mNumWritesThisUpdate++;
+			transmitFrame( lane.front().mFrame );
+			mSpareFrames.push_back( std::move( lane.front().mFrame ) );
+			lane.pop_front();
+		}
+	}
+}
+
+void Connection::clearLanes()
+{
+	for ( auto &lane : mLanes ) {
+		for ( auto &queued : lane )
+			mSpareFrames.push_back( std::move( queued.mFrame ) );
+		lane.clear();
+	}
+}
+
+bool Connection::hasQueuedFrames() const
+{
+	for ( auto &lane : mLanes ) {
+		if ( ! lane.empty() )
+			return true;
+	}
+	return false;
+}
+
+void Connection::setMaxWritesPerUpdate( size_t maxWrites )
+{
+	mMaxWritesPerUpdate = maxWrites;
+	if ( maxWrites == 0 )
+		flushLanes();
+}
+
+void Connection::setPublisherShard( const string &name, size_t shard )
+{
+	mPublisherShards[name] = shard;
+	while ( mShards.size() < shard ) {
+		size_t index = mShards.size() + 1;
+		TransportRef transport = mShardFactory ? mShardFactory() : WebSocketTransport::create();
+		transport->connectOpenEventHandler( [this, index]() { onShardConnect( index ); } );
+		transport->connectCloseEventHandler( [this, index]() { onShardDisconnect( index ); } );
+		transport->connectFailEventHandler( []( const string &err ){ CI_LOG_E( err ); } );
+		transport->connectMessageEventHandler( std::bind( &Connection::onRead, this, std::placeholders::_1 ) );
+		mShards.push_back( Shard() );
+		mShards.back().mTransport = transport;
+		if ( mIsConnected )
+			connectShard( index );
+	}
+
+	bool isMoved = false;
+	for ( auto & state : mPublisherStates ) {
+		if ( state.mName != name || state.mShard == shard )
+			continue;
+		state.mShard = shard;
+		state.mHeader.clear();
+		appendHeader( getShardClientName( shard ), state.mName, state.mType, state.mHeader );
+		isMoved = true;
+	}
+	if ( ! isMoved )
+		return;
+
+	// both the client that lost the publisher and the one that gained it register again
+	updateRouteCounts();
+	mConfigFrame.clear();
+	if ( mIsConnected )
+		updatePubSub();
+	for ( size_t i = 0; i < mShards.size(); ++i ) {
+		if ( mShards[i].mIsConnected )
+			writeShard( i + 1, getShardConfig( i + 1 ) );
+	}
+}
+
+string Connection::getShardClientName( size_t shard ) const
+{
+	return shard == 0 ? mConfig.getName() : mConfig.getName() + "#" + to_string( shard );
+}
+
+size_t Connection::getPublisherShard( const string &name ) const
+{
+	auto it = mPublisherShards.find( name );
+	return it != mPublisherShards.end() ? it->second : 0;
+}
+
+string Connection::getShardConfig( size_t shard ) const
+{
+	if ( mPublisherShards.empty() )
+		return shard == 0 ? mConfig.getJSON() : string();
+
+	Config config( getShardClientName( shard ), mConfig.getDescription() );
+	for ( auto & publisher : mConfig.getPublishers() ) {
+		if ( getPublisherShard( publisher.getName() ) == shard )
+			config.addPublish( publisher );
+	}
+	if ( shard == 0 ) {
+		for ( auto & subscriber : mConfig.getSubscribers() )
+			config.addSubscribe( subscriber );
+	}
+	return config.getJSON();
+}
+
+void Connection::connectShard( size_t shard )
+{
+	// shards follow the main connection to whichever server it ended up on
+	string url = mHost;
+	{
+		auto lock = lockTransport();
+		if ( auto failover = std::dynamic_pointer_cast<FailoverTransport>( mTransport ) )
+			url = failover->getActiveUrl();
+	}
+	mShards[shard - 1].mLastTimeTriedConnect = getElapsedSeconds();
+	mShards[shard - 1].mTransport->connect( url );
+}
+
+void Connection::onShardConnect( size_t shard )
+{
+	mShards[shard - 1].mIsConnected = true;
+	recordHandshake( *mShards[shard - 1].mTransport );
+	writeShard( shard, getShardConfig( shard ) );
+}
+
+void Connection::recordHandshake( const Transport &transport )
+{
+	Transport::HandshakeInfo handshake = transport.getHandshakeInfo();
+	if ( ! handshake.isSecure )
+		return;
+	mStats.tlsHandshakes++;
+	if ( handshake.isResumed )
+		mStats.tlsResumptions++;
+	mStats.lastHandshakeSeconds = handshake.seconds;
+}
+
+void Connection::onShardDisconnect( size_t shard )
+{
+	mShards[shard - 1].mIsConnected = false;
+	mShards[shard - 1].mLastTimeTriedConnect = getElapsedSeconds();
+}
+
+void Connection::writeShard( size_t shard, const string &frame )
+{
+	Shard &target = mShards[shard - 1];
+	if ( ! target.mIsConnected ) {
+		mStats.shardWritesDropped++;
+		return;
+	}
+	if ( mRecorder )
+		mRecorder->record( Recorder::OUTBOUND, frame );
+	target.mTransport->write( frame );
+}
+
+void Connection::setPublishPriority( const string &name, Priority priority )
+{
+	auto found = mPublisherIds.find( name );
+	if ( found == mPublisherIds.end() ) {
+		CI_LOG_E( "Can't prioritize " << name << ", it isn't a publisher!" );
+		return;
+	}
+	if ( priority == NUM_PRIORITIES ) {
+		CI_LOG_E( "Invalid priority for " << name );
+		return;
+	}
+
+	// frames already queued move along, so this publisher's order holds
+	size_t id = found->second;
+	Priority previous = mPublisherStates[id].mPriority;
+	mPublisherStates[id].mPriority = priority;
+	if ( previous == priority || mLanes[previous].empty() )
+		return;
+
+	auto &from = mLanes[previous];
+	auto moved = std::stable_partition( from.begin(), from.end(), [id]( const QueuedFrame &queued ) {
+		return queued.mPublisherId != id;
+	} );
+	for ( auto it = moved; it != from.end(); ++it )
+		mLanes[priority].push_back( std::move( *it ) );
+	from.erase( moved, from.end() );
+}
+
+Connection::FilterResult Connection::applyFilter( PublisherState &state, const double *number, double now )
+{
+	const PublishFilter &filter = state.mFilter;
+
+	if ( number && state.mHasSent ) {
+		double delta = std::abs( *number - state.mLastNumber );
+		if ( ( filter.getDeadband() > 0 && delta <= filter.getDeadband() ) ||
+			 ( filter.getRelativeDeadband() > 0 && delta <= filter.getRelativeDeadband() * std::abs( state.mLastNumber ) ) ) {
+			// back within the deadband of what receivers already have, nothing left to trail
+			state.mHasPending = false;
+			return FILTER_DROP;
+		}
+	}
+
+	if ( filter.getMaxRate() > 0 && state.mHasSent && now - state.mLastSendTime < 1.0 / filter.getMaxRate() ) {
+		state.mHasPending = true;
+		if ( number )
+			state.mPendingNumber = *number;
+		return FILTER_DEFER;
+	}
+
+	state.mHasSent = true;
+	state.mHasPending = false;
+	if ( number )
+		state.mLastNumber = *number;
+	return FILTER_SEND;
+}
+
+void Connection::updateFilters( double now )
+{
+	for ( size_t id : mFilteredPublishers ) {
+		auto &state = mPublisherStates[id];
+		const PublishFilter &filter = state.mFilter;
+		if ( state.mHasPending && now - state.mLastSendTime >= 1.0 / filter.getMaxRate() ) {
+			state.mHasPending = false;
+			state.mLastNumber = state.mPendingNumber;
+			writeFrame( id, state.mPending );
+		}
+		else if ( filter.getHeartbeat() > 0 && state.mHasSent && ! state.mLastFrame.empty()
+				  && now - state.mLastSendTime >= filter.getHeartbeat() ) {
+			writeFrame( id, state.mLastFrame );
+		}
+	}
+}
+
+void Connection::onConnect()
+{
+    mIsConnected = true;
+	{
+		auto lock = lockTransport();
+		recordHandshake( *mTransport );
+	}
+    updatePubSub();
+	if ( mIsRouteTracking || mIsAdminMode )
+		sendAdminRegistration();
+	for ( size_t i = 0; i < mShards.size(); ++i ) {
+		if ( ! mShards[i].mIsConnected )
+			connectShard( i + 1 );
+	}
+
+	vector<function<void ()>> waiters;
+	waiters.swap( mConnectWaiters );
+	for ( auto & waiter : waiters )
+		waiter();
+}
+
+void Connection::onDisconnect()
+{
+    mIsConnected = false;
+	// shards follow the main connection, they come back with it
+	for ( auto & shard : mShards ) {
+		shard.mTransport->disconnect();
+		shard.mIsConnected = false;
+	}
+	// values received so far may have changed while we're away
+	mLatestValues.markStale();
+	// queued frames belonged to the old link, the new one starts with a fresh config
+	clearLanes();
+	mBatch.clear();
+	mNumBatched = 0;
+	// the server sends everything again when we re-register
+	mHasRouteSnapshot = false;
+	mIsRouteSnapshotPending = false;
+	if ( mIsAdminMode ) {
+		mTopology.clear();
+		mAdminQueue.clear();
+		mAdminQueueStart = 0;
+		onTopologyChanged.emit();
+	}
+	if ( ! mRoutes.empty() ) {
+		mRoutes.clear();
+		updateRouteCounts();
+	}
+    //TODO: Figure out the time
+	mLastTimeTriedConnect = getElapsedSeconds();
+}
+
+void Connection::onRead( const string &message )
+{
+	if ( mRecorder )
+		mRecorder->record( Recorder::INBOUND, message );
+
+	const char *begin = message.data();
+	const char *end = begin + message.size();
+	const char *first = skipSpace( begin, end );
+	if ( first == end || *first != '[' ) {
+		readFrame( begin, end );
+		return;
+	}
+
+	// a batch of messages, or the admin snapshot. Either way each element stands on its own.
+	bool isValid = scanArray( first, end, [this]( const char *element, const char *elementEnd ) {
+		readFrame( element, elementEnd );
+	} );
+	if ( ! isValid )
+		CI_LOG_E( "Malformed frame: " << message );
+}
+
+void Connection::readFrame( const char *begin, const char *end )
+{
+	MessageFields fields;
+	FrameKind kind = scanFrame( begin, end, fields );
+	if ( kind == FRAME_OTHER ) {
+		// admin notifications are rare, jsoncpp is fine for them
+		Json::Value json;
+		Json::Reader reader;
+		if ( reader.parse( begin, end, json ) )
+			onAdmin( json );
+		return;
+	}
+	uint64_t sequence, epoch, sentMillis;
+	bool isSequenced = kind == FRAME_MESSAGE && fields.mExtension.size() && parseExtension( fields.mExtension, sequence, epoch, sentMillis );
+
+	if ( kind == FRAME_MESSAGE && ! fields.mIsEscaped ) {
+		if ( isSequenced )
+			trackSequence( toView( fields.mName ), toView( fields.mClientName ), sequence, epoch, sentMillis );
+		mStats.messagesReceived++;
+		dispatch( makeView( fields ) );
+		return;
+	}
+
+	if ( kind == FRAME_MESSAGE ) {
+		MessageFields unescaped = fields;
+		if ( unescapeFields( unescaped, mUnescapedName, mUnescapedType, mUnescapedValue ) ) {
+			if ( isSequenced )
+				trackSequence( mUnescapedName, toView( fields.mClientName ), sequence, epoch, sentMillis );
+			mStats.messagesReceived++;
+			dispatch( makeView( unescaped ) );
+			return;
+		}
+	}
+
+	// frames the scanner can't make sense of get a second chance with jsoncpp, which always allocates
+	Message *m = mMessagePool.acquire();
+	if ( decodeJson( begin, end, *m ) ) {
+		mStats.messagesReceived++;
+		mStats.receiveAllocations++;
+		m->decodeArray();
+		dispatch( MessageView( *m ), m );
+	}
+	mMessagePool.release( m );
+}
+
+void Connection::trackSequence( const StringView &name, const StringView &clientName, uint64_t sequence, uint64_t epoch, uint64_t sentMillis )
+{
+	size_t id = findSubscriber( name.data(), name.size() );
+	if ( id == NO_ENDPOINT )
+		return;
+	auto &state = mSubscriberStates[id];
+	if ( ! state.mDelivery ) {
+		state.mDelivery = make_shared<Delivery>();
+		state.mDelivery->mStats.name = state.mName;
+	}
+	DeliveryStats &stats = state.mDelivery->mStats;
+	stats.received++;
+	if ( sentMillis > 0 ) {
+		uint64_t now = getMillisSinceEpoch();
+		stats.latencies.add( now > sentMillis ? now - sentMillis : 0 );
+	}
+
+	SenderSequence *sender = nullptr;
+	for ( auto & candidate : state.mDelivery->mSenders ) {
+		if ( candidate.mClientName == clientName ) {
+			sender = &candidate;
+			break;
+		}
+	}
+	if ( ! sender ) {
+		state.mDelivery->mSenders.push_back( SenderSequence() );
+		sender = &state.mDelivery->mSenders.back();
+		sender->mClientName.assign( clientName.data(), clientName.size() );
+		sender->mEpoch = epoch;
+		sender->mNext = sequence + 1;
+		sender->mWindow = 1;
+		return;
+	}
+
+	if ( epoch != sender->mEpoch ) {
+		// a late message counted before the restart we already saw, it says nothing about the new count
+		if ( epoch != 0 && epoch == sender->mPreviousEpoch )
+			return;
+		stats.restarts++;
+		sender->mPreviousEpoch = sender->mEpoch;
+		sender->mEpoch = epoch;
+		sender->mNext = sequence + 1;
+		sender->mWindow = 1;
+		sender->mLost = 0;
+		return;
+	}
+
+	if ( sequence >= sender->mNext ) {
+		uint64_t gap = sequence - sender->mNext;
+		if ( gap > 0 ) {
+			sender->mLost += gap;
+			stats.lost += gap;
+			stats.gaps.add( gap );
+		}
+		sender->mWindow = gap + 1 >= 64 ? 1 : ( sender->mWindow << ( gap + 1 ) ) | 1;
+		sender->mNext = sequence + 1;
+		return;
+	}
+
+	uint64_t distance = sender->mNext - 1 - sequence;
+	if ( distance >= 64 && epoch == 0 ) {
+		// without epochs, too far behind to be a late arrival means the publisher started counting again
+		stats.restarts++;
+		sender->mNext = sequence + 1;
+		sender->mWindow = 1;
+		sender->mLost = 0;
+	}
+	else if ( distance < 64 && sender->mWindow & ( uint64_t( 1 ) << distance ) ) {
+		stats.duplicates++;
+	}
+	else {
+		// older than the window is taken for late, not duplicated
+		if ( distance < 64 )
+			sender->mWindow |= uint64_t( 1 ) << distance;
+		stats.reordered++;
+		stats.reorderDistances.add( distance );
+		if ( sender->mLost > 0 ) {
+			sender->mLost--;
+			stats.lost--;
+		}
+	}
+}
+
+vector<Connection::DeliveryStats> Connection::getDeliveryStats() const
+{
+	vector<DeliveryStats> stats;
+	for ( auto & state : mSubscriberStates ) {
+		if ( state.mDelivery )
+			stats.push_back( state.mDelivery->mStats );
+	}
+	return stats;
+}
+
+void Connection::resetDeliveryStats()
+{
+	for ( auto & state : mSubscriberStates ) {
+		if ( state.mDelivery ) {
+			state.mDelivery->mStats = DeliveryStats();
+			state.mDelivery->mStats.name = state.mName;
+			// keep the sequences, late arrivals just don't make up for gaps counted before the reset
+			for ( auto & sender : state.mDelivery->mSenders )
+				sender.mLost = 0;
+		}
+	}
+}
+
+void Connection::setRouteTracking( bool track )
+{
+	if ( track == mIsRouteTracking )
+		return;
+
+	mIsRouteTracking = track;
+	mHasRouteSnapshot = false;
+	mIsRouteSnapshotPending = false;
+	mRoutes.clear();
+	updateRouteCounts();
+	if ( track && mIsConnected && ! mIsAdminMode )
+		sendAdminRegistration();
+}
+
+bool Connection::hasRoutes( const string &name ) const
+{
+	if ( ! mIsRouteTracking || ! mHasRouteSnapshot )
+		return true;
+	auto found = mPublisherIds.find( name );
+	return found != mPublisherIds.end() && mPublisherStates[found->second].mNumRoutes > 0;
+}
+
+void Connection::sendAdminRegistration()
+{
+	// no_msgs keeps the server from copying every routed message to us
+	writeFrame( NO_ENDPOINT, "{\"admin\":[{\"admin\":true,\"no_msgs\":true}]}" );
+}
+
+void Connection::onAdmin( const Json::Value &json )
+{
+	if ( json.isArray() ) {
+		for ( auto & element : json )
+			onAdmin( element );
+		return;
+	}
+	if ( ! json.isObject() )
+		return;
+
+	if ( mIsAdminMode )
+		mAdminQueue.push_back( json );
+	if ( ! mIsRouteTracking )
+		return;
+
+	// the server answers our registration with every client's config, then the routes. Until
+	// they're all in, a publisher without routes may just not have heard of its routes yet.
+	if ( ! mHasRouteSnapshot )
+		mIsRouteSnapshotPending = true;
+
+	bool changed = false;
+	if ( json.isMember( "route" ) ) {
+		const Json::Value &update = json["route"];
+		Route route;
+		route.publisher = toRouteEndpoint( update["publisher"] );
+		route.subscriber = toRouteEndpoint( update["subscriber"] );
+		auto existing = std::find( mRoutes.begin(), mRoutes.end(), route );
+		if ( update["type"].asString() == "add" && existing == mRoutes.end() ) {
+			mRoutes.push_back( route );
+			changed = true;
+		}
+		else if ( update["type"].asString() == "remove" && existing != mRoutes.end() ) {
+			mRoutes.erase( existing );
+			changed = true;
+		}
+	}
+	else if ( json.isMember( "remove" ) ) {
+		// clients that left take their routes with them
+		for ( auto & client : json["remove"] ) {
+			string name = client["name"].asString();
+			string address = client["remoteAddress"].asString();
+			auto removed = std::remove_if( mRoutes.begin(), mRoutes.end(), [&]( const Route &route ) {
+				return ( route.publisher.clientName == name && route.publisher.remoteAddress == address )
+					|| ( route.subscriber.clientName == name && route.subscriber.remoteAddress == address );
+			} );
+			changed = changed || removed != mRoutes.end();
+			mRoutes.erase( removed, mRoutes.end() );
+		}
+	}
+
+	if ( changed ) {
+		updateRouteCounts();
+		onRoutesChanged.emit();
+	}
+}
+
+void Connection::setAdminMode( bool admin )
+{
+	if ( admin == mIsAdminMode )
+		return;
+
+	mIsAdminMode = admin;
+	mTopology.clear();
+	mAdminQueue.clear();
+	mAdminQueueStart = 0;
+	// route tracking may already have registered us
+	if ( admin && mIsConnected && ! mIsRouteTracking )
+		sendAdminRegistration();
+}
+
+void Connection::updateTopology()
+{
+	size_t end = mAdminQueue.size();
+	if ( mMaxAdminUpdates > 0 )
+		end = std::min( end, mAdminQueueStart + mMaxAdminUpdates );
+
+	bool changed = false;
+	for ( size_t i = mAdminQueueStart; i < end; ++i )
+		changed = mTopology.apply( mAdminQueue[i] ) || changed;
+
+	mAdminQueueStart = end;
+	if ( mAdminQueueStart == mAdminQueue.size() ) {
+		mAdminQueue.clear();
+		mAdminQueueStart = 0;
+	}
+	if ( changed )
+		onTopologyChanged.emit();
+}
+
+signals::Connection Connection::addPrefixListener( const string &prefix, const function<void (const Message&)> &callback )
+{
+	return connectPattern( mPatterns.addPrefix( prefix ), callback );
+}
+
+signals::Connection Connection::addPatternListener( const string &pattern, const function<void (const Message&)> &callback )
+{
+	return connectPattern( mPatterns.addPattern( pattern ), callback );
+}
+
+HistoryRef Connection::enableHistory( const string &name, size_t capacity )
+{
+	size_t id = findSubscriber( name );
+	if ( id == NO_ENDPOINT ) {
+		CI_LOG_E( "No subscriber named " << name << ", add it before enabling its history" );
+		return nullptr;
+	}
+	if ( ! mSubscriberStates[id].mHistory )
+		mSubscriberStates[id].mHistory = History::create( capacity );
+	return mSubscriberStates[id].mHistory;
+}
+
+HistoryRef Connection::getHistory( const string &name ) const
+{
+	size_t id = findSubscriber( name );
+	return id != NO_ENDPOINT ? mSubscriberStates[id].mHistory : nullptr;
+}
+
+// these may run on any thread, so they go through the published index rather than the endpoint tables
+
+bool Connection::getLatestRaw( size_t subscriberId, string &raw ) const
+{
+	LatestValues::IndexRef index = mLatestValues.getIndex();
+	return subscriberId < index->mSubscribers.size() && mLatestValues.load( *index->mSubscribers[subscriberId], raw );
+}
+
+uint64_t Connection::getChangedSince( uint64_t version, vector<size_t> &subscriberIds ) const
+{
+	// read first, so a value changing during the scan is reported again next time
+	uint64_t current = mLatestValues.getVersion();
+	LatestValues::IndexRef index = mLatestValues.getIndex();
+	subscriberIds.clear();
+	for ( size_t id = 0; id < index->mSubscribers.size(); ++id ) {
+		if ( mLatestValues.getVersion( *index->mSubscribers[id] ) > version )
+			subscriberIds.push_back( id );
+	}
+	return current;
+}
+
+bool Connection::hasChangedSince( const string &name, uint64_t version ) const
+{
+	const LatestValues::Entry *entry = mLatestValues.getIndex()->find( name );
+	return entry && mLatestValues.getVersion( *entry ) > version;
+}
+
+bool Connection::isLatestStale( const string &name ) const
+{
+	const LatestValues::Entry *entry = mLatestValues.getIndex()->find( name );
+	return entry && mLatestValues.isStale( *entry );
+}
+
+void Connection::setParallelDispatch( bool enabled, size_t numThreads )
+{
+	// joins the workers once they ran everything already queued
+	mDispatchPool.reset();
+	if ( enabled )
+		mDispatchPool = DispatchPool::create( numThreads );
+}
+
+vector<Connection::ListenerStats> Connection::getListenerStats() const
+{
+	vector<ListenerStats> stats;
+	for ( auto & strand : mStrands ) {
+		ListenerStats entry;
+		entry.name = strand->mName;
+		entry.calls = strand->mCalls.load( memory_order_relaxed );
+		entry.totalSeconds = strand->mTotalNanos.load( memory_order_relaxed ) * 1e-9;
+		entry.maxSeconds = strand->mMaxNanos.load( memory_order_relaxed ) * 1e-9;
+		stats.push_back( entry );
+	}
+	return stats;
+}
+
+Connection::Strand* Connection::getStrand( size_t subscriberId )
+{
+	Strand *&strand = subscriberId != NO_ENDPOINT ? mSubscriberStates[subscriberId].mStrand : mUnmatchedStrand;
+	if ( ! strand ) {
+		mStrands.emplace_back( new Strand() );
+		strand = mStrands.back().get();
+		if ( subscriberId != NO_ENDPOINT )
+			strand->mName = mSubscriberStates[subscriberId].mName;
+	}
+	return strand;
+}
+
+void Connection::enqueueParallel( size_t subscriberId, const MessageView &view )
+{
+	Strand *strand = getStrand( subscriberId );
+	bool isIdle;
+	{
+		lock_guard<mutex> lock( strand->mMutex );
+		if ( strand->mNumPending == strand->mPending.size() )
+			strand->mPending.emplace_back();
+		StrandItem &item = strand->mPending[strand->mNumPending++];
+		view.toOwned( item.mMessage );
+		if ( subscriberId != NO_ENDPOINT ) {
+			item.mMessage.setEndpointId( mSubscriberStates[subscriberId].mEndpointId );
+			item.mSignal = mSubscriberStates[subscriberId].mSignal;
+		}
+		for ( size_t pattern : mPatternHits )
+			item.mPatternSignals.push_back( mPatternSignals[pattern] );
+		isIdle = ! strand->mIsScheduled;
+		strand->mIsScheduled = true;
+	}
+	if ( isIdle )
+		mDispatchPool->submit( [this, strand] { runStrand( strand ); } );
+}
+
+void Connection::runStrand( Strand *strand )
+{
+	for ( ;; ) {
+		size_t count;
+		{
+			lock_guard<mutex> lock( strand->mMutex );
+			count = strand->mNumPending;
+			if ( count == 0 ) {
+				strand->mIsScheduled = false;
+				return;
+			}
+			swap( strand->mPending, strand->mRunning );
+			strand->mNumPending = 0;
+		}
+
+		for ( size_t i = 0; i < count; ++i ) {
+			StrandItem &item = strand->mRunning[i];
+			auto start = chrono::steady_clock::now();
+			if ( item.mSignal )
+				item.mSignal->emit( item.mMessage );
+			for ( auto & patternSignal : item.mPatternSignals )
+				patternSignal->emit( item.mMessage );
+			uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - start ).count();
+
+			// only this worker writes to the strand's counters
+			strand->mCalls.fetch_add( 1, memory_order_relaxed );
+			strand->mTotalNanos.fetch_add( nanos, memory_order_relaxed );
+			if ( nanos > strand->mMaxNanos.load( memory_order_relaxed ) )
+				strand->mMaxNanos.store( nanos, memory_order_relaxed );
+			item.mSignal.reset();
+			item.mPatternSignals.clear();
+		}
+	}
+}
+
+unique_lock<mutex> Connection::lockTransport()
+{
+	return isIoThread() ? unique_lock<mutex>( mTransportMutex ) : unique_lock<mutex>();
+}
+
+void Connection::setIoThread( bool enabled, bool wakeApp )
+{
+	stopIoThread();
+	mIsWakingApp = wakeApp;
+	if ( enabled ) {
+		mIsIoStopping = false;
+		mIoThread = thread( &Connection::runIoThread, this );
+	}
+}
+
+void Connection::stopIoThread()
+{
+	if ( ! mIoThread.joinable() )
+		return;
+	mIsIoStopping = true;
+	mTransport->getWait()->wake();
+	mIoThread.join();
+	// whatever the thread read last is still delivered, in order
+	processIoEvents();
+}
+
+namespace {
+
+//! The connection whose I/O thread this is, if any
+thread_local Connection *sIoConnection = nullptr;
+//! Longest the I/O thread sleeps between polls with nothing to do
+const double IO_MAX_WAIT = 0.1;
+
+}
+
+void Connection::runIoThread()
+{
+	sIoConnection = this;
+	// the transport stays while the thread runs, setTransport() stops it first
+	TransportWaitRef wait = mTransport->getWait();
+	while ( ! mIsIoStopping ) {
+		{
+			lock_guard<mutex> lock( mTransportMutex );
+			mTransport->poll();
+		}
+		queueIoEvents();
+		// websocketpp's poll() doesn't block, so sleep until the socket or a write has work for it.
+		// Its timers only run in poll() as well, an idle link still gets one now and then.
+		wait->wait( IO_MAX_WAIT );
+	}
+}
+
+void Connection::handleTransportEvent( IoEventKind kind, const string &text )
+{
+	if ( sIoConnection != this ) {
+		// polled from update(), handled right away
+		if ( kind == IO_MESSAGE && mHasImmediateListeners )
+			dispatchImmediate( text );
+		runTransportEvent( kind, text );
+		return;
+	}
+
+	// the I/O thread holds the transport lock during the poll, queueIoEvents() takes it from here
+	if ( mNumIoPolled == mIoPolled.size() )
+		mIoPolled.emplace_back();
+	IoEvent &event = mIoPolled[mNumIoPolled++];
+	event.mKind = kind;
+	event.mText.assign( text );
+}
+
+void Connection::queueIoEvents()
+{
+	if ( mNumIoPolled == 0 )
+		return;
+	if ( mHasImmediateListeners ) {
+		for ( size_t i = 0; i < mNumIoPolled; ++i ) {
+			if ( mIoPolled[i].mKind == IO_MESSAGE )
+				dispatchImmediate( mIoPolled[i].mText );
+		}
+	}
+
+	{
+		lock_guard<mutex> lock( mIoEventMutex );
+		for ( size_t i = 0; i < mNumIoPolled; ++i ) {
+			if ( mNumIoEvents == mIoEvents.size() )
+				mIoEvents.emplace_back();
+			IoEvent &event = mIoEvents[mNumIoEvents++];
+			event.mKind = mIoPolled[i].mKind;
+			// swapped, so the buffers keep going round instead of being copied
+			event.mText.swap( mIoPolled[i].mText );
+		}
+	}
+	mNumIoPolled = 0;
+
+	// one wake-up at a time, it delivers everything queued until it runs
+	if ( mIsWakingApp && app::App::get() && ! mIsWakePending.exchange( true ) ) {
+		weak_ptr<bool> alive = mAliveToken;
+		app::App::get()->dispatchAsync( [this, alive] {
+			auto token = alive.lock();
+			if ( ! token || ! *token )
+				return;
+			mIsWakePending = false;
+			processIoEvents();
+		} );
+	}
+}
+
+void Connection::runTransportEvent( IoEventKind kind, const string &text )
+{
+	switch ( kind ) {
+		case IO_OPEN: onConnect(); break;
+		case IO_CLOSE: onDisconnect(); break;
+		case IO_INTERRUPT: onInterrupt(); break;
+		case IO_FAIL: CI_LOG_E( text ); break;
+		case IO_PING: onPing( text ); break;
+		case IO_MESSAGE: onRead( text ); break;
+	}
+}
+
+void Connection::processIoEvents()
+{
+	// a listener calling update() would swap the events being handled
+	if ( mIsProcessingIoEvents )
+		return;
+	size_t count;
+	{
+		lock_guard<mutex> lock( mIoEventMutex );
+		swap( mIoEvents, mIoProcessing );
+		count = mNumIoEvents;
+		mNumIoEvents = 0;
+	}
+
+	mIsProcessingIoEvents = true;
+	for ( size_t i = 0; i < count; ++i )
+		runTransportEvent( mIoProcessing[i].mKind, mIoProcessing[i].mText );
+	mIsProcessingIoEvents = false;
+}
+
+size_t Connection::addImmediateListener( const string &name, const function<void (const MessageView&)> &callback )
+{
+	lock_guard<mutex> lock( mImmediateMutex );
+	auto listeners = mImmediateListeners ? make_shared<vector<ImmediateListener>>( *mImmediateListeners ) : make_shared<vector<ImmediateListener>>();
+	listeners->push_back( ImmediateListener{ mNextImmediateId, name, callback } );
+	mImmediateListeners = listeners;
+	mHasImmediateListeners = true;
+	return mNextImmediateId++;
+}
+
+void Connection::removeImmediateListener( size_t id )
+{
+	lock_guard<mutex> lock( mImmediateMutex );
+	if ( ! mImmediateListeners )
+		return;
+	auto listeners = make_shared<vector<ImmediateListener>>( *mImmediateListeners );
+	for ( auto it = listeners->begin(); it != listeners->end(); ++it ) {
+		if ( it->mId == id ) {
+			listeners->erase( it );
+			break;
+		}
+	}
+	mImmediateListeners = listeners;
+	mHasImmediateListeners = ! listeners->empty();
+}
+
+void Connection::dispatchImmediate( const string &frame )
+{
+	// a snapshot, the listeners run without the lock and may add or remove listeners
+	shared_ptr<const vector<ImmediateListener>> listeners;
+	{
+		lock_guard<mutex> lock( mImmediateMutex );
+		listeners = mImmediateListeners;
+	}
+	if ( ! listeners )
+		return;
+
+	auto readElement = [this, &listeners]( const char *begin, const char *end ) {
+		MessageFields fields;
+		if ( scanFrame( begin, end, fields ) != FRAME_MESSAGE )
+			return;
+		if ( fields.mIsEscaped && ! unescapeFields( fields, mImmediateName, mImmediateType, mImmediateValue ) )
+			return;
+		MessageView view = makeView( fields );
+		for ( auto & listener : *listeners ) {
+			if ( view.getName() == listener.mName )
+				listener.mCallback( view );
+		}
+	};
+
+	const char *begin = frame.data();
+	const char *end = begin + frame.size();
+	const char *first = skipSpace( begin, end );
+	if ( first != end && *first == '[' )
+		scanArray( first, end, readElement );
+	else
+		readElement( begin, end );
+}
+
+signals::Connection Connection::connectPattern( size_t patternId, const function<void (const Message&)> &callback )
+{
+	if ( patternId == mPatternSignals.size() ) {
+		mPatternSignals.push_back( make_shared<signals::Signal<void (const Message&)>>() );
+		mPatternsVersion++;
+	}
+	return mPatternSignals[patternId]->connect( callback );
+}
+
+const vector<size_t>& Connection::matchPatterns( size_t subscriberId, const StringView &name )
+{
+	if ( subscriberId == NO_ENDPOINT ) {
+		mPatterns.match( name.data(), name.size(), mPatternScratch );
+		return mPatternScratch;
+	}
+
+	// subscriber names repeat with every message, so each is matched once per pattern change
+	auto &state = mSubscriberStates[subscriberId];
+	if ( state.mPatternsVersion != mPatternsVersion ) {
+		mPatterns.match( state.mName.data(), state.mName.size(), state.mPatternMatches );
+		state.mPatternsVersion = mPatternsVersion;
+	}
+	return state.mPatternMatches;
+}
+
+void Connection::whenConnected( const function<void ()> &callback )
+{
+	if ( mIsConnected )
+		callback();
+	else
+		mConnectWaiters.push_back( callback );
+}
+
+void Connection::whenMessage( const string &name, const function<void (const Message&)> &callback )
+{
+	mMessageWaiters.push_back( MessageWaiter( name, callback ) );
+}
+
+void Connection::whenSent( const function<void ()> &callback )
+{
+	mSentWaiters.push_back( callback );
+}
+
+void Connection::resumeMessageWaiters( const Message &message )
+{
+	// take the waiters out first, a resumed coroutine is likely to wait again
+	vector<MessageWaiter> ready;
+	for ( auto it = mMessageWaiters.begin(); it != mMessageWaiters.end(); ) {
+		if ( it->first == message.getName() ) {
+			ready.push_back( std::move( *it ) );
+			it = mMessageWaiters.erase( it );
+		}
+		else
+			++it;
+	}
+	for ( auto & waiter : ready )
+		waiter.second( message );
+}
+
+void Connection::updateRouteCounts()
+{
+	if ( auto shared = std::dynamic_pointer_cast<SharedMemoryTransport>( mTransport ) ) {
+		auto lock = lockTransport();
+		shared->setRoutes( mRoutes );
+	}
+
+	for ( auto & state : mPublisherStates )
+		state.mNumRoutes = 0;
+	for ( auto & route : mRoutes ) {
+		size_t id = findPublisher( route.publisher.name, route.publisher.type );
+		if ( id == NO_ENDPOINT )
+			continue;
+		// sharded publishers are routed from their shard's client
+		size_t shard = mPublisherStates[id].mShard;
+		if ( shard == 0 ? route.publisher.clientName == mConfig.getName() : route.publisher.clientName == getShardClientName( shard ) )
+			mPublisherStates[id].mNumRoutes++;
+	}
+}
+
+void Connection::dispatch( const MessageView &view, Message *owned )
+{
+	size_t id = findSubscriber( view.getName().data(), view.getName().size() );
+	size_t endpointId = id != NO_ENDPOINT ? mSubscriberStates[id].mEndpointId : UNKNOWN_ENDPOINT;
+	onMessageView.emit( MessageView( view.getName(), view.getType(), view.getRawValue(), endpointId ) );
+
+	if ( onMessageBatch.getNumSlots() > 0 )
+		mReceivedBatch.append( MessageView( view.getName(), view.getType(), view.getRawValue(), endpointId ), getElapsedSeconds() );
+
+	if ( id != NO_ENDPOINT )
+		mLatestValues.store( *mSubscriberStates[id].mLatest, view.getRawValue() );
+
+	if ( id != NO_ENDPOINT && mSubscriberStates[id].mHistory ) {
+		History &history = *mSubscriberStates[id].mHistory;
+		if ( view.getType() == TYPE_RANGE )
+			history.push( getElapsedSeconds(), view.valueAsRange() );
+		else if ( view.getType() == TYPE_BOOLEAN )
+			history.push( getElapsedSeconds(), view.valueAsBoolean() ? 1.0 : 0.0 );
+	}
+
+	auto signal = id != NO_ENDPOINT ? mSubscriberStates[id].mSignal.get() : nullptr;
+	mPatternHits.clear();
+	if ( ! mPatternSignals.empty() ) {
+		// copied, callbacks may add subscribers or patterns
+		const vector<size_t> &matches = matchPatterns( id, view.getName() );
+		for ( size_t pattern : matches ) {
+			if ( mPatternSignals[pattern]->getNumSlots() > 0 )
+				mPatternHits.push_back( pattern );
+		}
+	}
+	if ( mDispatchPool ) {
+		// subscription listeners run on the workers, onMessage and coroutine waiters stay on this thread
+		if ( signal || ! mPatternHits.empty() )
+			enqueueParallel( id, view );
+		if ( onMessage.getNumSlots() == 0 && mMessageWaiters.empty() )
+			return;
+		signal = nullptr;
+		mPatternHits.clear();
+	}
+	else if ( ! signal && mPatternHits.empty() && onMessage.getNumSlots() == 0 && mMessageWaiters.empty() )
+		return;
+
+	Message *m = owned;
+	if ( ! m ) {
+		size_t allocated = mMessagePool.getNumAllocated();
+		m = mMessagePool.acquire();
+		size_t capacity = m->getCapacity();
+		view.toOwned( *m );
+		if ( mMessagePool.getNumAllocated() != allocated || m->getCapacity() > capacity )
+			mStats.receiveAllocations++;
+	}
+	m->setEndpointId( endpointId );
+
+	if ( signal )
+		signal->emit( *m );
+	for ( size_t i = 0; i < mPatternHits.size(); ++i ) {
+		auto patternSignal = mPatternSignals[mPatternHits[i]];
+		patternSignal->emit( *m );
+	}
+	onMessage.emit( *m );
+	if ( ! mMessageWaiters.empty() )
+		resumeMessageWaiters( *m );
+
+	if ( ! owned )
+		mMessagePool.release( m );
 }
 
 }
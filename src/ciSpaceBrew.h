@@ -8,14 +8,42 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "WebSocketClient.h"
 #include "cinder/app/App.h"
+#include "cinder/Log.h"
 
 #include "jsoncpp/json.h"
 
+#if __cplusplus >= 201703L || ( defined( _MSVC_LANG ) && _MSVC_LANG >= 201703L )
+	#include <string_view>
+#else
+	#include <boost/utility/string_ref.hpp>
+#endif
+
+#if defined( __cpp_impl_coroutine ) && __cpp_impl_coroutine >= 201902L
+	#define SPACEBREW_COROUTINES
+	#include <coroutine>
+	#include <exception>
+#endif
+
 namespace Spacebrew {
+
+#if __cplusplus >= 201703L || ( defined( _MSVC_LANG ) && _MSVC_LANG >= 201703L )
+typedef std::string_view	StringView;
+#else
+typedef boost::string_ref	StringView;
+#endif
     
 // Some useful constants
 static const int            SPACEBREW_PORT  = 9000;
@@ -23,6 +51,52 @@ static const std::string    SPACEBREW_CLOUD = "sandbox.spacebrew.cc";
 static const std::string    TYPE_STRING     = "string";
 static const std::string    TYPE_RANGE      = "range";
 static const std::string    TYPE_BOOLEAN    = "boolean";
+static const std::string    TYPE_RANGE_ARRAY = "range_array";
+static const std::string    TYPE_FLOAT_ARRAY = "float_array";
+
+static const int            RANGE_MAX       = 1023;
+//! Endpoint id of a message that didn't arrive for one of our subscribers
+static const size_t         UNKNOWN_ENDPOINT = static_cast<size_t>( -1 );
+
+/**
+ * @brief Quantizes \a count normalized values in (0,1) to ranges between (0,1023), clamping
+ * out of range input and turning nan into 0. Uses SSE2 / NEON when available.
+ */
+void quantizeRange( const float *normalized, int *out, size_t count );
+
+/**
+ * @brief Appends \a length bytes of \a data to \a out as the contents of a JSON string,
+ * escaping quotes, backslashes and control characters. Runs that need no escaping are
+ * found 16 or 32 bytes at a time with SSE2 / AVX2 / NEON and copied in one go.
+ */
+void appendEscaped( const char *data, size_t length, std::string &out );
+inline void appendEscaped( const std::string &str, std::string &out ) { appendEscaped( str.data(), str.size(), out ); }
+
+/**
+ * @brief Appends the unescaped contents of a JSON string to \a out, decoding \uXXXX
+ * escapes to UTF-8. Returns false on a malformed escape sequence.
+ */
+bool appendUnescaped( const char *data, size_t length, std::string &out );
+
+/**
+ * @brief Appends \a values to \a out as a JSON array. Ranges are clamped to (0,1023), and
+ * floats that aren't finite are written as 0.
+ */
+void appendRangeArray( const int *values, size_t count, std::string &out );
+void appendFloatArray( const float *values, size_t count, std::string &out );
+
+/**
+ * @brief Parses a JSON array of numbers in \a raw into \a out, reusing its capacity.
+ * Returns false if \a raw is not an array of numbers, or holds a number that doesn't fit an
+ * int or a finite float. Parsing doesn't depend on the C locale.
+ */
+bool parseRangeArray( const std::string &raw, std::vector<int> &out );
+bool parseFloatArray( const std::string &raw, std::vector<float> &out );
+bool parseRangeArray( const StringView &raw, std::vector<int> &out );
+bool parseFloatArray( const StringView &raw, std::vector<float> &out );
+// string literals would be ambiguous between the two above
+inline bool parseRangeArray( const char *raw, std::vector<int> &out ) { return parseRangeArray( StringView( raw ), out ); }
+inline bool parseFloatArray( const char *raw, std::vector<float> &out ) { return parseFloatArray( StringView( raw ), out ); }
 
 /**
  * @brief Spacebrew message
@@ -47,6 +121,7 @@ public:
 	 * @brief Sets the name of this Message to \a name
 	 */
 	void setName( const std::string &name ) { mName = name; }
+	void setName( const char *name, size_t length ) { mName.assign( name, length ); }
 	
 	/**
 	 * @brief Returns a const reference to the Name of this message
@@ -57,6 +132,7 @@ public:
 	 * @brief Sets the type of the message to \a type
 	 */
 	void setType( const std::string &type ) { mType = type; }
+	void setType( const char *type, size_t length ) { mType.assign( type, length ); }
 	
 	/**
 	 * @brief Returns a const reference to the type of this message
@@ -67,6 +143,24 @@ public:
 	 * @brief Sets your value with \a value
 	 */
 	void setValue( const std::string &value ) { mValue = value; }
+	void setValue( const char *value, size_t length ) { mValue.assign( value, length ); }
+
+	/**
+	 * @brief Id of the subscriber this message arrived for: its schema row when the connection
+	 * has a schema, otherwise the order it was added in. UNKNOWN_ENDPOINT for anything else.
+	 */
+	size_t getEndpointId() const { return mEndpointId; }
+	void setEndpointId( size_t endpointId ) { mEndpointId = endpointId; }
+
+	/**
+	 * @brief Empties name, type and value while keeping their capacity for reuse
+	 */
+	void clear();
+
+	/**
+	 * @brief Returns the total capacity of this message's buffers, used to track receive path allocations
+	 */
+	size_t getCapacity() const;
 	
 	/**
 	 * @brief Returns a const reference to your value as a raw string
@@ -87,6 +181,22 @@ public:
 	 * @brief Returns the underlying value as a string
 	 */
 	const std::string& valueAsString() const;
+
+	/**
+	 * @brief Returns the underlying value as a contiguous array of ranges between (0,1023)
+	 */
+	const std::vector<int>& valueAsRangeArray() const;
+
+	/**
+	 * @brief Returns the underlying value as a contiguous array of floats
+	 */
+	const std::vector<float>& valueAsFloatArray() const;
+
+	/**
+	 * @brief Decodes the raw value into the array buffer matching this message's type.
+	 * Called by Spacebrew::Connection when an array message arrives.
+	 */
+	void decodeArray();
 	
 protected:
     /**
@@ -106,6 +216,14 @@ protected:
      * @type {std::string}
      */
     std::string mValue;
+
+    /**
+     * @brief Decoded values for TYPE_RANGE_ARRAY / TYPE_FLOAT_ARRAY messages
+     */
+    std::vector<int>	mRangeArray;
+    std::vector<float>	mFloatArray;
+
+    size_t	mEndpointId = UNKNOWN_ENDPOINT;
 	
     friend std::ostream& operator<<(std::ostream& os, const Message& vec);
 };
@@ -114,6 +232,63 @@ inline std::ostream& operator<<(std::ostream& os, const Message& m) {
     os << m.getName() << ", " << m.getType() << ", " << m.getRawValue() << std::endl;
     return os;
 }
+
+/**
+ * @brief Read-only Spacebrew message that points into the received frame instead of copying
+ * it. Only valid for the duration of the Connection::onMessageView callback, use toOwned()
+ * to keep the data around.
+ * @class Spacebrew::MessageView
+ */
+class MessageView {
+public:
+	MessageView() = default;
+	MessageView( const StringView &name, const StringView &type, const StringView &value, size_t endpointId = UNKNOWN_ENDPOINT )
+	: mName( name ), mType( type ), mValue( value ), mEndpointId( endpointId ) {}
+	//! Views the fields of \a message, which must outlive this view
+	explicit MessageView( const Message &message )
+	: mName( message.getName() ), mType( message.getType() ), mValue( message.getRawValue() ), mEndpointId( message.getEndpointId() ) {}
+
+	const StringView& getName() const { return mName; }
+	const StringView& getType() const { return mType; }
+	const StringView& getRawValue() const { return mValue; }
+	//! See Message::getEndpointId()
+	size_t getEndpointId() const { return mEndpointId; }
+
+	/**
+	 * @brief Returns the underlying value as a boolean
+	 */
+	bool valueAsBoolean() const;
+
+	/**
+	 * @brief Returns the underlying value as a range between (0,1023)
+	 */
+	int valueAsRange() const;
+
+	/**
+	 * @brief Returns the underlying value as a string view
+	 */
+	const StringView& valueAsString() const;
+
+	/**
+	 * @brief Decodes the underlying array value into \a out, reusing its capacity
+	 */
+	bool valueAsRangeArray( std::vector<int> &out ) const { return parseRangeArray( mValue, out ); }
+	bool valueAsFloatArray( std::vector<float> &out ) const { return parseFloatArray( mValue, out ); }
+
+	/**
+	 * @brief Copies this view into a Message that can be kept after the callback returns
+	 */
+	Message toOwned() const;
+
+	/**
+	 * @brief Copies this view into \a message, reusing its buffers
+	 */
+	void toOwned( Message &message ) const;
+
+private:
+	StringView	mName, mType, mValue;
+	size_t		mEndpointId = UNKNOWN_ENDPOINT;
+};
   
 /**
  * @brief Wrapper for Spacebrew config message. Gets created automatically by
@@ -141,10 +316,13 @@ public:
     void addPublish( const Message& m );
     
     std::string getJSON() const;
-	
+
 	const std::string& getName() const { return mName; }
 	const std::string& getDescription() const { return mDescription; }
-    
+
+	const std::vector<Message>& getPublishers() const { return mPublishers; }
+	const std::vector<Message>& getSubscribers() const { return mSubscribers; }
+
 private:
 	
 	std::string	mName, mDescription;
@@ -152,7 +330,1021 @@ private:
     std::vector<Message> mSubscribers;
 };
 
+/**
+ * @brief One row of an endpoint schema fixed at compile time, see Connection::setSchema()
+ * @example
+ * constexpr Spacebrew::SchemaEntry kSchema[] = {
+ *     { Spacebrew::SchemaEntry::PUBLISH,   "red",   "range",   "0" },
+ *     { Spacebrew::SchemaEntry::SUBSCRIBE, "start", "boolean", "false" },
+ * };
+ * constexpr size_t START = Spacebrew::schemaIndex( kSchema, "start" );
+ */
+struct SchemaEntry {
+	enum Direction { PUBLISH, SUBSCRIBE };
+
+	Direction	direction;
+	const char	*name, *type, *def;
+};
+
+constexpr bool schemaNameEquals( const char *a, const char *b )
+{
+	return *a == *b && ( *a == '\0' || schemaNameEquals( a + 1, b + 1 ) );
+}
+
+/**
+ * @brief Row of the \a direction endpoint called \a name, or N when there is none. Received
+ * messages carry it as their endpoint id, so handlers can switch on constants made with this.
+ */
+template<size_t N>
+constexpr size_t schemaIndex( const SchemaEntry (&schema)[N], const char *name, SchemaEntry::Direction direction = SchemaEntry::SUBSCRIBE, size_t row = 0 )
+{
+	return row == N ? N
+		: schema[row].direction == direction && schemaNameEquals( schema[row].name, name ) ? row
+		: schemaIndex( schema, name, direction, row + 1 );
+}
+
+// Tags for the built-in Spacebrew types, used with Publisher<T>, Subscriber<T> and Codec<T>
+struct String {};
+struct Range {};
+struct Boolean {};
+struct RangeArray {};
+struct FloatArray {};
+
+/**
+ * @brief Compile-time encoder / decoder for a typed endpoint. Specialize this for your own
+ * types to use them with Connection::addPublish<T>() and Connection::addSubscribe<T>().
+ * A specialization provides:
+ *     typedef ... value_type;
+ *     static const std::string& type();                                 // Spacebrew type name
+ *     static void encode( const value_type &value, std::string &out );  // append a JSON value
+ *     static bool decode( const std::string &raw, value_type &out );    // parse Message::getRawValue()
+ * @class Spacebrew::Codec
+ */
+template<typename T>
+struct Codec;
+
+template<>
+struct Codec<String> {
+	typedef std::string value_type;
+	static const std::string& type() { return TYPE_STRING; }
+	static void encode( const std::string &value, std::string &out )
+	{
+		out += '"';
+		appendEscaped( value, out );
+		out += '"';
+	}
+	static bool decode( const std::string &raw, std::string &out ) { out = raw; return true; }
+};
+
+template<>
+struct Codec<Range> {
+	typedef int value_type;
+	static const std::string& type() { return TYPE_RANGE; }
+	static void encode( int value, std::string &out ) { out += std::to_string( value ); }
+	static bool decode( const std::string &raw, int &out )
+	{
+		char *end = nullptr;
+		long value = std::strtol( raw.c_str(), &end, 10 );
+		if( end == raw.c_str() )
+			return false;
+		out = static_cast<int>( value );
+		return true;
+	}
+};
+
+template<>
+struct Codec<Boolean> {
+	typedef bool value_type;
+	static const std::string& type() { return TYPE_BOOLEAN; }
+	static void encode( bool value, std::string &out ) { out += value ? "\"true\"" : "\"false\""; }
+	static bool decode( const std::string &raw, bool &out ) { out = raw == "true"; return true; }
+};
+
+template<>
+struct Codec<RangeArray> {
+	typedef std::vector<int> value_type;
+	static const std::string& type() { return TYPE_RANGE_ARRAY; }
+	static void encode( const std::vector<int> &value, std::string &out ) { appendRangeArray( value.data(), value.size(), out ); }
+	static bool decode( const std::string &raw, std::vector<int> &out ) { return parseRangeArray( raw, out ); }
+};
+
+template<>
+struct Codec<FloatArray> {
+	typedef std::vector<float> value_type;
+	static const std::string& type() { return TYPE_FLOAT_ARRAY; }
+	static void encode( const std::vector<float> &value, std::string &out ) { appendFloatArray( value.data(), value.size(), out ); }
+	static bool decode( const std::string &raw, std::vector<float> &out ) { return parseFloatArray( raw, out ); }
+};
+
+/**
+ * @brief Per-publisher send filter, passed when a publisher is registered. Filtering happens
+ * before the value is encoded, so dropped values cost nothing but a comparison.
+ * @example spacebrew->addPublish( "dial", TYPE_RANGE, "0", PublishFilter().deadband( 2 ).maxRate( 30 ) );
+ * @class Spacebrew::PublishFilter
+ */
+class PublishFilter {
+public:
+	PublishFilter() : mDeadband( 0 ), mRelativeDeadband( 0 ), mMaxRate( 0 ), mHeartbeat( 0 ) {}
+
+	//! Drops numeric values within \a amount of the last value sent
+	PublishFilter& deadband( double amount ) { mDeadband = amount; return *this; }
+	//! Drops numeric values within \a fraction of the last value sent (0.01 is 1%)
+	PublishFilter& relativeDeadband( double fraction ) { mRelativeDeadband = fraction; return *this; }
+	//! Sends at most \a hz values per second. The last value held back is sent once the interval has passed.
+	PublishFilter& maxRate( double hz ) { mMaxRate = hz; return *this; }
+	//! Resends the last value every \a seconds while nothing else has been sent
+	PublishFilter& heartbeat( double seconds ) { mHeartbeat = seconds; return *this; }
+
+	double getDeadband() const { return mDeadband; }
+	double getRelativeDeadband() const { return mRelativeDeadband; }
+	double getMaxRate() const { return mMaxRate; }
+	double getHeartbeat() const { return mHeartbeat; }
+
+	//! Returns whether this filter does anything at all
+	bool isActive() const { return mDeadband > 0 || mRelativeDeadband > 0 || mMaxRate > 0 || mHeartbeat > 0; }
+
+private:
+	double	mDeadband, mRelativeDeadband, mMaxRate, mHeartbeat;
+};
+
+//! Numeric view of a value for deadband filtering. Values without one are never deadbanded.
+template<typename V>
+inline bool getFilterValue( const V &, double & ) { return false; }
+inline bool getFilterValue( int value, double &out ) { out = value; return true; }
+inline bool getFilterValue( bool value, double &out ) { out = value ? 1.0 : 0.0; return true; }
+
+/**
+ * @brief Recycles inbound Message objects, so their string and array buffers keep their
+ * capacity from one message to the next.
+ * @class Spacebrew::MessagePool
+ */
+class MessagePool : ci::Noncopyable {
+public:
+	//! Returns a cleared Message, allocating one only if none are free
+	Message*	acquire();
+	//! Returns \a message to the pool
+	void		release( Message *message );
+	//! Returns how many Messages this pool has ever allocated
+	size_t		getNumAllocated() const { return mMessages.size(); }
+
+private:
+	std::vector<std::unique_ptr<Message>>	mMessages;
+	std::vector<Message*>					mFree;
+};
+
+/**
+ * @brief Counts values in power-of-two buckets: bucket 0 holds values below 2, bucket i values in
+ * [2^i, 2^(i+1)) and the last bucket everything larger.
+ * @class Spacebrew::Histogram
+ */
+struct Histogram {
+	static const size_t NUM_BUCKETS = 20;
+
+	uint64_t	buckets[NUM_BUCKETS] = {};
+	uint64_t	count = 0;
+
+	void	add( uint64_t value );
+	//! Smallest value at least \a fraction of the counted values fall below, to bucket precision
+	uint64_t	getPercentile( double fraction ) const;
+};
+
+/**
+ * @brief Every message one Connection::update() received, as columns indexed by arrival order,
+ * so a listener can walk thousands of values in one pass. The columns keep their capacity from
+ * one update to the next.
+ * @class Spacebrew::MessageBatch
+ */
+struct MessageBatch {
+	//! See Message::getEndpointId()
+	std::vector<size_t>		endpointIds;
+	//! app::getElapsedSeconds() when each message was received
+	std::vector<double>		times;
+	//! Range values, booleans as 0 or 1, and NaN for the other types
+	std::vector<float>		values;
+	//! Raw values back to back, message i spans [rawOffsets[i], rawOffsets[i + 1])
+	std::string				rawValues;
+	std::vector<uint32_t>	rawOffsets;
+
+	size_t		size() const { return endpointIds.size(); }
+	bool		empty() const { return endpointIds.empty(); }
+	StringView	getRawValue( size_t i ) const { return StringView( rawValues.data() + rawOffsets[i], rawOffsets[i + 1] - rawOffsets[i] ); }
+
+	void		append( const MessageView &view, double time );
+	void		clear();
+};
+
+/**
+ * @brief Last value received by each subscriber, behind Connection::getLatest(). Written by
+ * Connection::update() and readable from any thread: values up to INLINE_SIZE bytes are read
+ * without locking, retrying in the rare case a read overlaps a write, longer ones are copied
+ * under a lock of their entry. Entries are allocated in pages and never move. Readers find them
+ * through an Index of the current subscribers, which is replaced as a whole when they change.
+ * @class Spacebrew::LatestValues
+ */
+class LatestValues : ci::Noncopyable {
+public:
+	static const size_t INLINE_SIZE = 64;
+
+	class Entry {
+	public:
+		Entry();
+
+	private:
+		static const size_t INLINE_WORDS = INLINE_SIZE / sizeof( uint64_t );
+
+		//! Odd while store() is writing
+		std::atomic<uint64_t>	mSequence;
+		//! 0 until a value was stored
+		std::atomic<uint64_t>	mVersion;
+		std::atomic<size_t>		mSize;
+		std::atomic<bool>		mIsStale;
+		std::atomic<uint64_t>	mText[INLINE_WORDS];
+		//! Values longer than INLINE_SIZE, written and read under mLongMutex
+		mutable std::mutex		mLongMutex;
+		std::string				mLongText;
+
+		friend class LatestValues;
+	};
+
+	//! Entries of the current subscribers, never modified once published
+	struct Index {
+		//! In subscriber id order
+		std::vector<const Entry*>						mSubscribers;
+		std::unordered_map<std::string, const Entry*>	mNames;
+
+		//! Entry of subscriber \a name, or nullptr
+		const Entry*	find( const std::string &name ) const;
+	};
+	typedef std::shared_ptr<const Index> IndexRef;
+
+	LatestValues();
+
+	//! Entry of subscriber \a name, created on first use and kept for the name from then on. Update thread only.
+	Entry*		acquire( const std::string &name );
+	//! Stores \a raw in \a entry under a new version. Update thread only.
+	void		store( Entry &entry, const StringView &raw );
+	//! Replaces \a raw with the value of \a entry, or returns false when nothing was stored yet
+	bool		load( const Entry &entry, std::string &raw ) const;
+	//! Flags every value stale under a new version, they predate the current connection. Update thread only.
+	void		markStale();
+	//! Replaces the index returned by getIndex(). Update thread only.
+	void		publish( const IndexRef &index ) { std::atomic_store_explicit( &mIndex, index, std::memory_order_release ); }
+	//! Snapshot of the current subscribers, kept valid by the caller's reference. Any thread.
+	IndexRef	getIndex() const { return std::atomic_load_explicit( &mIndex, std::memory_order_acquire ); }
+
+	//! Bumped by every store() and markStale()
+	uint64_t	getVersion() const { return mVersion.load( std::memory_order_acquire ); }
+	//! Version of the last change to \a entry, 0 when nothing was stored yet
+	uint64_t	getVersion( const Entry &entry ) const { return entry.mVersion.load( std::memory_order_acquire ); }
+	bool		isStale( const Entry &entry ) const { return entry.mIsStale.load( std::memory_order_acquire ); }
+
+private:
+	static const size_t PAGE_SIZE = 64;
+
+	//! Sets the fields of \a entry under its seqlock
+	void		write( Entry &entry, uint64_t version, const StringView *raw );
+
+	std::vector<std::unique_ptr<Entry[]>>		mPages;
+	size_t										mNumEntries = 0;
+	std::unordered_map<std::string, Entry*>		mEntries;
+	std::atomic<uint64_t>						mVersion;
+	//! Only accessed through std::atomic_load() and std::atomic_store()
+	IndexRef									mIndex;
+};
+
+class Connection;
+
+/**
+ * @brief Handle to a publisher registered with Connection::addPublish<T>(). The endpoint and
+ * its message header are resolved once at registration, so sending only encodes the value.
+ * Handles are cheap to copy and must not outlive the Connection that created them. They follow
+ * their publisher through config changes, and refuse to send once it was removed.
+ * @class Spacebrew::Publisher
+ */
+template<typename T>
+class Publisher {
+public:
+	typedef typename Codec<T>::value_type value_type;
+
+	Publisher() : mConnection( nullptr ), mHandle( 0 ) {}
+
+	/**
+	 * @brief Encodes \a value with Codec<T> and sends it on this endpoint. A default constructed
+	 * handle logs an error and sends nothing.
+	 */
+	void send( const value_type &value ) const;
+
+	//! Returns the index of this publisher in the Connection's Config, or UNKNOWN_ENDPOINT once a new config removed it
+	size_t getId() const;
+	//! Returns the name of this publisher, or an empty string for a default constructed handle
+	const std::string& getName() const;
+	//! Returns whether this handle was returned by a Connection
+	bool isValid() const { return mConnection != nullptr; }
+
+private:
+	Publisher( Connection *connection, size_t handle ) : mConnection( connection ), mHandle( handle ) {}
+
+	Connection	*mConnection;
+	//! Index in Connection::mPublisherHandles, which stays put when the publishers are renumbered
+	size_t		mHandle;
+
+	friend class Connection;
+};
+
+/**
+ * @brief Handle to a subscriber registered with Connection::addSubscribe<T>(). Incoming
+ * messages on this endpoint are decoded with Codec<T> and handed to the callback.
+ * @class Spacebrew::Subscriber
+ */
+template<typename T>
+class Subscriber {
+public:
+	typedef typename Codec<T>::value_type value_type;
+	typedef std::function<void (const value_type&)> Callback;
+
+	Subscriber() : mId( 0 ), mLatest( nullptr ) {}
+
+	//! Returns the index of this subscriber in the Connection's Config
+	size_t getId() const { return mId; }
+	//! Stops delivering messages to this handle's callback
+	void disconnect() { mSignalConnection.disconnect(); }
+
+private:
+	Subscriber( size_t id, const ci::signals::Connection &connection, const LatestValues::Entry *latest )
+	: mId( id ), mSignalConnection( connection ), mLatest( latest ) {}
+
+	size_t						mId;
+	ci::signals::Connection		mSignalConnection;
+	//! Latest value of the subscriber's name, which stays put when the subscribers are renumbered
+	const LatestValues::Entry	*mLatest = nullptr;
+
+	friend class Connection;
+};
+
+
+/**
+ * @brief Minimal memory-mapped file, used for capture files
+ * @class Spacebrew::MappedFile
+ */
+class MappedFile : ci::Noncopyable {
+public:
+	//! READ_WRITE_EXISTING maps a file for writing like READ_WRITE, but fails instead of creating it
+	enum Mode { READ, READ_WRITE, READ_WRITE_EXISTING };
+
+	MappedFile();
+	~MappedFile();
+
+	/**
+	 * @brief Maps the file at \a path. In READ_WRITE mode the file is created if needed. In either
+	 * writable mode it's grown to at least \a size bytes.
+	 */
+	bool	open( const std::string &path, Mode mode, size_t size = 0 );
+	//! Grows or shrinks a writable file to \a size bytes and remaps it
+	bool	resize( size_t size );
+	//! Unmaps and closes the file
+	void	close();
+
+	bool		isOpen() const { return mData != nullptr; }
+	char*		getData() { return mData; }
+	const char*	getData() const { return mData; }
+	size_t		getSize() const { return mSize; }
+
+private:
+	bool	map();
+	void	unmap();
+
+	char	*mData;
+	size_t	mSize;
+	Mode	mMode;
+#if defined( CINDER_MSW )
+	void	*mFile, *mMapping;
+#else
+	int		mFile;
+#endif
+};
+
+using RecorderRef = std::shared_ptr<class Recorder>;
+/**
+ * @brief Appends timestamped inbound and outbound frames to a memory-mapped capture file.
+ * Attach one with Connection::setRecorder() and play the file back with Spacebrew::Replayer.
+ * @class Spacebrew::Recorder
+ */
+class Recorder : ci::Noncopyable {
+public:
+	enum Direction { INBOUND, OUTBOUND };
+
+	//! Creates (or truncates) the capture file at \a path. Returns nullptr if it can't be opened.
+	static RecorderRef create( const std::string &path );
+	~Recorder();
+
+	//! Appends \a frame, timestamped relative to when this Recorder was created
+	void		record( Direction direction, const std::string &frame );
+	//! Trims the file to the frames recorded so far and closes it
+	void		close();
+
+	uint64_t	getNumFrames() const { return mNumFrames; }
+	size_t		getNumBytes() const { return mUsed; }
+
+private:
+	Recorder();
+
+	MappedFile	mFile;
+	size_t		mUsed;
+	uint64_t	mNumFrames;
+	std::chrono::steady_clock::time_point mStartTime;
+};
+
+using ReplayerRef = std::shared_ptr<class Replayer>;
+/**
+ * @brief Plays a capture file written by Spacebrew::Recorder back into a Connection, either
+ * through its dispatch (inbound frames, as if they came from the server) or onto the wire
+ * (outbound frames, as if the app sent them).
+ * @class Spacebrew::Replayer
+ */
+class Replayer : ci::Noncopyable {
+public:
+	enum Target { DISPATCH, WIRE };
+
+	//! Opens the capture file at \a path. Returns nullptr if it isn't a valid capture.
+	static ReplayerRef create( const std::string &path );
+
+	//! 1 replays in real time, 2 twice as fast and so on. 0 replays everything as fast as possible.
+	void	setSpeed( double speed ) { mSpeed = speed; }
+	double	getSpeed() const { return mSpeed; }
+
+	/**
+	 * @brief Replays the frames that are due into \a connection. Call this every frame,
+	 * e.g. from your app's update(). Returns the number of frames replayed.
+	 */
+	size_t	update( Connection &connection, Target target = DISPATCH );
+	//! Replays every remaining frame immediately, returns the number of frames replayed
+	size_t	replayAll( Connection &connection, Target target = DISPATCH );
+	//! Starts over from the first frame
+	void	rewind();
+
+	bool		isDone() const { return mOffset >= mEnd; }
+	uint64_t	getNumReplayed() const { return mNumReplayed; }
+
+private:
+	Replayer();
+	//! Replays frames up to \a untilNanos
+	size_t	replay( Connection &connection, Target target, uint64_t untilNanos );
+
+	MappedFile	mFile;
+	size_t		mOffset, mEnd;
+	uint64_t	mFirstNanos, mNumReplayed;
+	double		mSpeed;
+	bool		mIsStarted;
+	std::chrono::steady_clock::time_point mStartTime;
+};
+
+/**
+ * @brief A route between a publisher and a subscriber, as reported by the Spacebrew server
+ * @class Spacebrew::Route
+ */
+struct Route {
+	struct Endpoint {
+		std::string	clientName, name, type, remoteAddress;
+
+		bool operator==( const Endpoint &other ) const
+		{
+			return clientName == other.clientName && name == other.name && type == other.type && remoteAddress == other.remoteAddress;
+		}
+	};
+
+	Endpoint	publisher, subscriber;
+
+	bool operator==( const Route &other ) const { return publisher == other.publisher && subscriber == other.subscriber; }
+};
+
+/**
+ * @brief Every client, publisher, subscriber and route on a Spacebrew server, kept up to date
+ * from the admin notifications of a Connection in admin mode. Updates are applied one delta at
+ * a time, and clients and endpoints are indexed so queries don't scan the whole server.
+ * @class Spacebrew::Topology
+ */
+class Topology {
+public:
+	struct Client {
+		std::string						name, description, remoteAddress;
+		std::vector<Route::Endpoint>	publishers, subscribers;
+	};
+
+	Topology() : mVersion( 0 ) {}
+
+	//! Applies one admin notification (a "config", "remove" or "route" object). Returns whether anything changed.
+	bool	apply( const Json::Value &update );
+	//! Forgets everything, e.g. when the connection to the server drops
+	void	clear();
+
+	//! Returns the client with \a name at \a remoteAddress, or nullptr
+	const Client*				findClient( const std::string &name, const std::string &remoteAddress ) const;
+	//! Returns every client called \a name, on any address
+	std::vector<const Client*>	findClients( const std::string &name ) const;
+	//! Returns the routes to and from a client
+	std::vector<const Route*>	getRoutes( const std::string &name, const std::string &remoteAddress ) const;
+	//! Returns the routes to or from an endpoint
+	std::vector<const Route*>	getRoutes( const Route::Endpoint &endpoint ) const;
+
+	const std::unordered_map<std::string, Client>&	getClients() const { return mClients; }
+	const std::unordered_map<std::string, Route>&	getAllRoutes() const { return mRoutes; }
+	//! Incremented by every change, so views can tell when they need refreshing
+	uint64_t	getVersion() const { return mVersion; }
+
+private:
+	typedef std::unordered_map<std::string, std::vector<std::string>> RouteIndex;
+
+	bool	addRoute( const Route &route );
+	bool	removeRoute( const std::string &key );
+	bool	removeClient( const std::string &key );
+	void	unindexRoute( RouteIndex &index, const std::string &indexKey, const std::string &routeKey );
+
+	//! Keyed by client name and address
+	std::unordered_map<std::string, Client>							mClients;
+	std::unordered_multimap<std::string, std::string>				mClientsByName;
+	//! Keyed by publisher and subscriber
+	std::unordered_map<std::string, Route>							mRoutes;
+	//! Route keys by client key and by endpoint key
+	RouteIndex														mRoutesByClient, mRoutesByEndpoint;
+	uint64_t														mVersion;
+};
+
+/**
+ * @brief Character trie of name patterns, behind Connection's prefix and wildcard listeners.
+ * In a pattern, * matches any part of a single '/' separated segment and a trailing ** matches
+ * the rest of the name. Matching walks the name once, so it costs about the same no matter
+ * how many patterns there are.
+ * @class Spacebrew::PatternIndex
+ */
+class PatternIndex {
+public:
+	PatternIndex() : mNodes( 1 ) {}
 
+	//! Adds \a pattern and returns its id. Adding the same pattern again returns the same id.
+	size_t	addPattern( const std::string &pattern );
+	//! Adds a pattern matching every name that starts with \a prefix, taken literally
+	size_t	addPrefix( const std::string &prefix );
+	//! Replaces \a out with the ids of the patterns that match \a name, in ascending order
+	void	match( const char *name, size_t length, std::vector<size_t> &out ) const;
+
+	size_t	size() const { return mIds.size(); }
+
+private:
+	struct Node {
+		std::vector<std::pair<char, uint32_t>>	mChildren;
+		//! Node reached through a '*', or 0
+		uint32_t								mStar = 0;
+		//! Patterns ending here, and patterns matching whatever follows
+		std::vector<uint32_t>					mExact, mRest;
+	};
+
+	uint32_t	getChild( uint32_t node, char c );
+	uint32_t	getStar( uint32_t node );
+	size_t		add( const std::string &key, uint32_t node, bool isRest );
+	void		matchFrom( uint32_t node, const char *p, const char *end, std::vector<size_t> &out ) const;
+
+	std::vector<Node>						mNodes;
+	std::unordered_map<std::string, size_t>	mIds;
+};
+
+using HistoryRef = std::shared_ptr<class History>;
+
+/**
+ * @brief Fixed-size ring of the latest numeric values of one subscriber, each stamped with
+ * app::getElapsedSeconds() when it was received. Written by Connection::update() and readable
+ * from any thread without locking: readers retry in the rare case they overlap a write.
+ * @example float x = history->sample( ci::app::getElapsedSeconds() - 0.1 );
+ * @class Spacebrew::History
+ */
+class History : ci::Noncopyable {
+public:
+	enum Interpolation { HOLD, LINEAR };
+
+	struct Sample {
+		double time, value;
+	};
+
+	//! \a capacity is rounded up to a power of two
+	static HistoryRef create( size_t capacity ) { return HistoryRef( new History( capacity ) ); }
+
+	//! Appends a value. Times must not decrease, and only one thread may push.
+	void	push( double time, double value );
+
+	/**
+	 * @brief Value at \a time, interpolated between the samples around it. Before the oldest
+	 * sample it returns the oldest value and after the newest it holds the newest value.
+	 * Returns \a fallback when nothing was received yet.
+	 */
+	double	sample( double time, Interpolation interpolation = LINEAR, double fallback = 0.0 ) const;
+	//! Replaces \a out with the samples received between \a from and \a to, oldest first
+	size_t	read( double from, double to, std::vector<Sample> &out ) const;
+	//! Newest sample, or false when nothing was received yet
+	bool	getLatest( Sample &out ) const;
+
+	size_t	getCapacity() const { return mMask + 1; }
+	size_t	getSize() const;
+	void	clear();
+
+private:
+	explicit History( size_t capacity );
+
+	struct Slot {
+		std::atomic<double>	time, value;
+	};
+
+	//! Index in [first, count) of the first sample later than \a time, or not earlier when \a orEqual
+	uint64_t	findAfter( double time, bool orEqual, uint64_t first, uint64_t count ) const;
+	//! Index of the oldest sample still in the ring
+	uint64_t	getFirst( uint64_t count ) const { return count > mMask + 1 ? count - ( mMask + 1 ) : 0; }
+
+	std::unique_ptr<Slot[]>	mSlots;
+	size_t					mMask;
+	//! Odd while push() is writing
+	std::atomic<uint64_t>	mSequence;
+	std::atomic<uint64_t>	mCount;
+};
+
+using DispatchPoolRef = std::shared_ptr<class DispatchPool>;
+
+/**
+ * @brief Fixed set of worker threads, each with its own task deque. A worker takes its newest
+ * task first and, when it runs dry, steals the oldest task of another worker. Behind
+ * Connection::setParallelDispatch(). Destroying the pool runs the remaining tasks, then joins.
+ * @class Spacebrew::DispatchPool
+ */
+class DispatchPool : ci::Noncopyable {
+public:
+	//! \a numThreads of 0 uses one thread per core
+	static DispatchPoolRef create( size_t numThreads = 0 ) { return DispatchPoolRef( new DispatchPool( numThreads ) ); }
+	~DispatchPool();
+
+	//! Queues \a task on the calling worker, or on the next worker in turn from other threads
+	void		submit( std::function<void ()> task );
+
+	size_t		getNumThreads() const { return mThreads.size(); }
+	//! Tasks a worker took from another worker's deque
+	uint64_t	getNumStolen() const { return mNumStolen.load( std::memory_order_relaxed ); }
+
+private:
+	explicit DispatchPool( size_t numThreads );
+
+	struct Worker {
+		std::mutex							mMutex;
+		std::deque<std::function<void ()>>	mTasks;
+	};
+
+	bool	take( size_t index, std::function<void ()> &task );
+	void	run( size_t index );
+
+	std::vector<std::unique_ptr<Worker>>	mWorkers;
+	std::vector<std::thread>				mThreads;
+	std::mutex								mWakeMutex;
+	std::condition_variable					mWake;
+	//! Submitted tasks not taken yet, changed under mWakeMutex when it grows
+	std::atomic<int64_t>					mPending;
+	std::atomic<size_t>						mNext;
+	std::atomic<uint64_t>					mNumStolen;
+	bool									mIsStopping = false;
+};
+
+using TransportWaitRef = std::shared_ptr<class TransportWait>;
+/**
+ * @brief What the I/O thread blocks on between polls: the sockets of the transports sharing it,
+ * and wake() from writes and other threads. Transports made of other transports share theirs
+ * with them, see Transport::setWait().
+ * @class Spacebrew::TransportWait
+ */
+class TransportWait : ci::Noncopyable {
+public:
+#if defined( CINDER_MSW )
+	typedef uintptr_t	Socket;
+#else
+	typedef int			Socket;
+#endif
+	static const Socket	NO_SOCKET = static_cast<Socket>( -1 );
+
+	TransportWait();
+	~TransportWait();
+
+	/**
+	 * @brief Blocks until a watched socket is readable, wake() is called or \a seconds passed,
+	 * whichever comes first, and no longer than the shortest poll interval. Returns right away
+	 * when woken since the last wait(). One thread waits at a time.
+	 */
+	void	wait( double seconds );
+	//! Ends the current or the next wait(), callable from any thread. Cheap while nobody waits.
+	void	wake();
+
+	//! Wakes wait() when \a socket is readable, one socket per \a owner
+	void	watch( const void *owner, Socket socket );
+	void	unwatch( const void *owner );
+	//! Caps wait() for an \a owner that has to look for work it can't watch, like timers. 0 removes the cap.
+	void	setPollInterval( const void *owner, double seconds );
+
+private:
+	struct Entry {
+		const void	*mOwner;
+		Socket		mSocket;
+		double		mPollInterval;
+	};
+
+	//! The entry of \a owner, called with mMutex held
+	Entry&	getEntry( const void *owner );
+	void	removeUnused();
+
+	std::mutex					mMutex;
+	std::condition_variable		mCondition;
+	std::vector<Entry>			mEntries;
+	std::atomic<bool>			mIsWoken{ false }, mIsWaiting{ false };
+#if ! defined( CINDER_MSW )
+	//! wake() writes to it to end a poll() on the sockets, created by the first wait()
+	int							mPipe[2];
+#endif
+};
+
+using TransportRef = std::shared_ptr<class Transport>;
+
+#if defined( SPACEBREW_COROUTINES )
+class ConnectAwaiter;
+class MessageAwaiter;
+class SentAwaiter;
+#endif
+/**
+ * @brief What a Connection talks to the Spacebrew server through. The event handlers mirror
+ * WebSocketClient's, and are only called from within poll().
+ * @class Spacebrew::Transport
+ */
+class Transport : ci::Noncopyable {
+public:
+	typedef std::function<void ()>						EventHandler;
+	typedef std::function<void (const std::string&)>	MessageHandler;
+
+	Transport() : mWait( std::make_shared<TransportWait>() ) {}
+	virtual ~Transport() = default;
+
+	//! Starts connecting to \a url, dropping any current connection
+	virtual void	connect( const std::string &url ) = 0;
+	virtual void	disconnect() = 0;
+	virtual void	write( const std::string &frame ) = 0;
+	//! Delivers pending events, called from Connection::update()
+	virtual void	poll() = 0;
+	//! Whether the transport is still working on a connect() by itself, so the Connection shouldn't retry yet
+	virtual bool	isConnecting() const { return false; }
+
+	struct HandshakeInfo {
+		bool	isSecure = false;
+		//! Whether the TLS session of an earlier connection was resumed, skipping the full handshake
+		bool	isResumed = false;
+		double	seconds = 0;
+	};
+
+	//! TLS handshake of the current connection
+	virtual HandshakeInfo	getHandshakeInfo() const { return HandshakeInfo(); }
+
+	//! What the I/O thread waits on between polls. Transports wake it when write() or another
+	//! thread leaves work for poll(), and watch their sockets with it.
+	const TransportWaitRef&	getWait() const { return mWait; }
+	//! Makes the transport use \a wait instead of its own, before connect(). Transports made of
+	//! others pass it on to them.
+	virtual void			setWait( const TransportWaitRef &wait ) { mWait = wait; }
+
+	void connectOpenEventHandler( const EventHandler &handler ) { mOpenHandler = handler; }
+	void connectCloseEventHandler( const EventHandler &handler ) { mCloseHandler = handler; }
+	void connectInterruptEventHandler( const EventHandler &handler ) { mInterruptHandler = handler; }
+	void connectFailEventHandler( const MessageHandler &handler ) { mFailHandler = handler; }
+	void connectPingEventHandler( const MessageHandler &handler ) { mPingHandler = handler; }
+	void connectMessageEventHandler( const MessageHandler &handler ) { mMessageHandler = handler; }
+
+protected:
+	void handleOpen() { if( mOpenHandler ) mOpenHandler(); }
+	void handleClose() { if( mCloseHandler ) mCloseHandler(); }
+	void handleInterrupt() { if( mInterruptHandler ) mInterruptHandler(); }
+	void handleFail( const std::string &error ) { if( mFailHandler ) mFailHandler( error ); }
+	void handlePing( const std::string &message ) { if( mPingHandler ) mPingHandler( message ); }
+	void handleMessage( const std::string &message ) { if( mMessageHandler ) mMessageHandler( message ); }
+
+	EventHandler	mOpenHandler, mCloseHandler, mInterruptHandler;
+	MessageHandler	mFailHandler, mPingHandler, mMessageHandler;
+	TransportWaitRef	mWait;
+};
+
+using WebSocketTransportRef = std::shared_ptr<class WebSocketTransport>;
+/**
+ * @brief The default Transport, a websocket through Cinder-WebSocketPP
+ * @class Spacebrew::WebSocketTransport
+ */
+class WebSocketTransport : public Transport {
+public:
+	static WebSocketTransportRef create() { return WebSocketTransportRef( new WebSocketTransport() ); }
+	~WebSocketTransport();
+
+	//! Connects over TLS for wss:// urls, which needs a build with SPACEBREW_ENABLE_TLS defined and OpenSSL 1.1.1 or newer
+	void	connect( const std::string &url ) override;
+	void	disconnect() override;
+	void	write( const std::string &frame ) override;
+	void	poll() override;
+	HandshakeInfo	getHandshakeInfo() const override;
+
+	struct TlsOptions {
+		//! Check the server's certificate and host name
+		bool		verifyPeer = true;
+		//! PEM file of trusted certificates, like a local router's self-signed one. Empty uses the system's.
+		std::string	caFile;
+		//! Resume the TLS session of the last connection to the same host:port, saving a round trip and the key exchange
+		bool		resumeSessions = true;
+	};
+
+	//! Applies to wss:// connections opened afterwards, by every WebSocketTransport. Forgets cached sessions.
+	static void	setTlsOptions( const TlsOptions &options );
+
+private:
+	WebSocketTransport();
+
+	void	onOpen();
+	//! Stops watching the socket of a connection that's gone
+	void	onClosed();
+
+	std::unique_ptr<WebSocketClient>	mClient;
+#if defined( SPACEBREW_ENABLE_TLS )
+	std::unique_ptr<class TlsWebSocketClient>	mTlsClient;
+#endif
+};
+
+using LoopbackTransportRef = std::shared_ptr<class LoopbackTransport>;
+/**
+ * @brief In-memory Transport with no sockets involved. Every message written, batched or not, is
+ * delivered back as if the server had routed it to a subscriber of the same name, and config
+ * frames are swallowed. Useful to test and measure the encode, decode and dispatch path on its own.
+ * @class Spacebrew::LoopbackTransport
+ */
+class LoopbackTransport : public Transport {
+public:
+	static LoopbackTransportRef create() { return LoopbackTransportRef( new LoopbackTransport() ); }
+
+	void	connect( const std::string &url ) override;
+	void	disconnect() override;
+	void	write( const std::string &frame ) override;
+	void	poll() override;
+
+	//! Queues \a frame to be received on the next poll(), as if the server had sent it
+	void	inject( const std::string &frame );
+	//! Whether written messages come back to this client. On by default.
+	void	setEcho( bool echo ) { mEcho = echo; }
+
+	uint64_t	getNumWritten() const { return mNumWritten; }
+	uint64_t	getNumDelivered() const { return mNumDelivered; }
+
+private:
+	LoopbackTransport();
+
+	bool	mIsOpen, mIsOpening, mIsClosing, mEcho;
+	uint64_t	mNumWritten, mNumDelivered;
+	//! Frames waiting for poll(), and delivered frames kept around to reuse their capacity
+	std::vector<std::string>	mPending, mDelivering, mSpare;
+};
+
+using FailoverTransportRef = std::shared_ptr<class FailoverTransport>;
+/**
+ * @brief Transport over an ordered list of redundant servers. Connection attempts are staggered
+ * across the list and the first to complete its handshake is used. A failed attempt starts the
+ * next one right away, and when the active link drops the next server is tried immediately
+ * instead of after the Connection's reconnect interval.
+ * @class Spacebrew::FailoverTransport
+ */
+class FailoverTransport : public Transport {
+public:
+	typedef std::function<TransportRef ()> Factory;
+
+	//! \a factory makes the transport for each server, a WebSocketTransport by default
+	static FailoverTransportRef create( const std::vector<std::string> &urls = std::vector<std::string>(), const Factory &factory = Factory() )
+	{
+		return FailoverTransportRef( new FailoverTransport( urls, factory ) );
+	}
+
+	//! Races every server, with \a url first when it isn't in the list already. An open link is
+	//! dropped, and its close reported from the next poll().
+	void	connect( const std::string &url ) override;
+	void	disconnect() override;
+	void	write( const std::string &frame ) override;
+	void	poll() override;
+	bool	isConnecting() const override { return mIsConnecting; }
+	HandshakeInfo	getHandshakeInfo() const override;
+	void	setWait( const TransportWaitRef &wait ) override;
+
+	//! Replaces the servers, in order of preference, dropping an open link like connect().
+	//! Takes effect on the next connect().
+	void	setUrls( const std::vector<std::string> &urls );
+	const std::vector<std::string>&	getUrls() const { return mUrls; }
+
+	//! Seconds before the next server is tried while earlier attempts are still pending. 0 races them all at once.
+	void	setStagger( double seconds ) { mStagger = seconds; }
+	//! Seconds after which a pending attempt counts as failed
+	void	setAttemptTimeout( double seconds ) { mAttemptTimeout = seconds; }
+
+	//! The server currently connected to, or an empty string
+	const std::string&	getActiveUrl() const;
+	uint64_t			getNumFailovers() const { return mNumFailovers; }
+
+private:
+	FailoverTransport( const std::vector<std::string> &urls, const Factory &factory );
+
+	enum AttemptState { ATTEMPT_IDLE, ATTEMPT_CONNECTING, ATTEMPT_OPEN, ATTEMPT_FAILED };
+
+	struct Attempt {
+		TransportRef	mTransport;
+		AttemptState	mState = ATTEMPT_IDLE;
+		double			mStartTime = 0;
+	};
+
+	//! Drops every attempt and the active link at once
+	void	stopAll();
+	//! Starts the attempts in mOrder, from the beginning
+	void	startRace();
+	void	startNextAttempt( double now );
+	void	stopAttempt( size_t index, AttemptState state );
+	void	onAttemptOpen( size_t index );
+	void	onAttemptLost( size_t index, const std::string &error );
+	double	now() const;
+
+	static const size_t NO_ATTEMPT = static_cast<size_t>( -1 );
+
+	Factory						mFactory;
+	std::vector<std::string>	mUrls;
+	std::vector<Attempt>		mAttempts;
+	//! Indices into mAttempts in the order they are tried, and the next one to start
+	std::vector<size_t>			mOrder;
+	size_t						mNextAttempt, mActive;
+	//! mIsClosePending is a link dropped by connect() or setUrls(), which poll() reports
+	bool						mIsConnecting, mIsClosing, mIsClosePending;
+	double						mStagger, mAttemptTimeout, mNextStartTime;
+	uint64_t					mNumFailovers;
+	std::string					mLastError;
+	std::chrono::steady_clock::time_point	mEpoch;
+};
+
+using SharedMemoryTransportRef = std::shared_ptr<class SharedMemoryTransport>;
+/**
+ * @brief Short-circuits the server for clients on the same host. Each client owns an inbox, a
+ * lock-free ring in a memory-mapped file, and a publisher whose routes all lead to live local
+ * inboxes writes its messages straight into them. Everything else, including every message of
+ * a publisher with any remote route, goes through the fallback transport, so nothing arrives
+ * twice. Needs route tracking, which Connection::setTransport() turns on for this transport.
+ * @class Spacebrew::SharedMemoryTransport
+ */
+class SharedMemoryTransport : public Transport {
+public:
+	/**
+	 * @param clientName Name of the Connection's client, which names its inbox
+	 * @param fallback Transport to the server, a WebSocketTransport by default
+	 * @param directory Where inboxes live, /dev/shm or the temp directory by default
+	 */
+	static SharedMemoryTransportRef create( const std::string &clientName, const TransportRef &fallback = TransportRef(), const std::string &directory = "" )
+	{
+		return SharedMemoryTransportRef( new SharedMemoryTransport( clientName, fallback, directory ) );
+	}
+	~SharedMemoryTransport();
+
+	//! Opens this client's inbox and connects the fallback to \a url
+	void	connect( const std::string &url ) override;
+	void	disconnect() override;
+	void	write( const std::string &frame ) override;
+	void	poll() override;
+	bool	isConnecting() const override { return mFallback->isConnecting(); }
+	void	setWait( const TransportWaitRef &wait ) override;
+
+	//! Works out which publishers can deliver locally, called by the Connection when routes change
+	void	setRoutes( const std::vector<Route> &routes );
+
+	const TransportRef&	getFallback() const { return mFallback; }
+	//! Messages written to and read from inboxes
+	uint64_t	getNumLocalWrites() const { return mNumLocalWrites; }
+	uint64_t	getNumLocalReads() const { return mNumLocalReads; }
+	//! Local messages lost because a subscriber's inbox was full, or read back with a corrupt length
+	uint64_t	getNumDropped() const { return mNumDropped; }
+
+private:
+	SharedMemoryTransport( const std::string &clientName, const TransportRef &fallback, const std::string &directory );
+
+	//! A mapped inbox, either ours or a peer's
+	struct Ring;
+	struct Target {
+		std::string		mClientName, mSubscriberName;
+	};
+
+	std::string	getInboxPath( const std::string &clientName ) const;
+	//! Returns a live peer inbox, reopening it when its owner restarted, or nullptr
+	Ring*		findPeer( const std::string &clientName );
+	bool		writeLocal( const std::string &frame, size_t nameBegin, size_t nameEnd, const std::vector<Target> &targets );
+
+	std::string							mClientName, mDirectory;
+	TransportRef						mFallback;
+	std::unique_ptr<Ring>				mInbox;
+	//! Local subscribers by publisher name and type
+	std::unordered_map<std::string, std::vector<Target>>	mLocalRoutes;
+	std::unordered_map<std::string, std::unique_ptr<Ring>>	mPeers;
+	std::string							mLookupKey, mLocalFrame, mReadFrame;
+	uint64_t							mNumLocalWrites, mNumLocalReads, mNumDropped;
+};
 
 using ConnectionRef = std::shared_ptr<class Connection>;
 /**
@@ -162,6 +1354,10 @@ using ConnectionRef = std::shared_ptr<class Connection>;
  */
 class Connection : ci::Noncopyable {
 public:
+
+	//! Outbound priority classes. With a write budget set, see setMaxWritesPerUpdate(), higher lanes
+	//! are always drained first. Without one they have no effect.
+	enum Priority { PRIORITY_CONTROL, PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_BULK, NUM_PRIORITIES };
     
 	static ConnectionRef create( const std::string& host = SPACEBREW_CLOUD,
 								 const std::string& name = "Cinder App",
@@ -185,6 +1381,15 @@ public:
     void connect();
     void connect( const std::string &host, const Config &config );
     void connect( const std::string &host, const uint16_t &port, const Config &config );
+
+    /**
+     * @brief Connect to the first of several redundant servers to complete its handshake, and
+     * fail over to the others when it drops. Installs a FailoverTransport unless one is set already.
+     * @param {std::vector<std::string>} hosts Hosts in order of preference
+     * @param {uint16_t} port Port shared by all hosts
+     * @param {Spacebrew::Config} config
+     */
+    void connect( const std::vector<std::string> &hosts, const uint16_t &port, const Config &config );
     
     /**
      * @brief Send a message
@@ -214,6 +1419,30 @@ public:
      * @param {bool}        value   Value
      */
     void sendBoolean( const std::string &name, bool value );
+
+    /**
+     * @brief Send a whole array of ranges in one message
+     * @param {std::string} name    Name of message
+     * @param {const int*}  values  Ranges between (0,1023), others are clamped
+     * @param {size_t}      count   Number of values
+     */
+    void sendRangeArray( const std::string &name, const int *values, size_t count );
+
+    /**
+     * @brief Quantize normalized values in (0,1) to ranges and send them in one message
+     * @param {std::string}  name       Name of message
+     * @param {const float*} normalized Values between (0,1)
+     * @param {size_t}       count      Number of values
+     */
+    void sendRangeArray( const std::string &name, const float *normalized, size_t count );
+
+    /**
+     * @brief Send a whole array of floats in one message
+     * @param {std::string}  name   Name of message
+     * @param {const float*} values Values
+     * @param {size_t}       count  Number of values
+     */
+    void sendFloatArray( const std::string &name, const float *values, size_t count );
     
     /**
      * Send a Spacebrew Message object
@@ -223,7 +1452,8 @@ public:
     
     /**
      * @brief Send a Spacebrew Message object. Use this method if you've overridden Spacebrew::Message
-     * (especially) if you've created a custom getJson() method!)
+     * (especially) if you've created a custom getJson() method!) Like the default, a custom
+     * getJSON() must return a frame ending in "}}".
      * @param {Spacebrew::Message} m
      */
     void send( Message * m );
@@ -248,13 +1478,108 @@ public:
      * @param {std::string} def  Default value
      */
     void addPublish( const std::string &name, const std::string &type, const std::string &def = "" );
+
+    /**
+     * @brief Add message of specific name + type to publish, filtering what gets sent
+     * @param {std::string}   name   Name of message
+     * @param {std::string}   typ    Message type ("string", "boolean", "range", or custom type)
+     * @param {std::string}   def    Default value
+     * @param {PublishFilter} filter Deadband, rate limit and heartbeat applied to send*() calls
+     */
+    void addPublish( const std::string &name, const std::string &type, const std::string &def, const PublishFilter &filter );
+
+    /**
+     * @brief Replaces the publishers and subscribers with a table fixed at compile time. The
+     * config frame is built once here, and each subscriber's endpoint id is its row in the table.
+     * The table must outlive the connection, which a constexpr global does.
+     * @example spacebrew->setSchema( kSchema );
+     */
+	template<size_t N>
+	void setSchema( const SchemaEntry (&schema)[N] ) { setSchema( schema, N ); }
+	void setSchema( const SchemaEntry *schema, size_t size );
+
+    /**
+     * @brief Replace the filter on an existing publisher
+     */
+    void setPublishFilter( const std::string &name, const PublishFilter &filter );
+
+    /**
+     * @brief Puts an existing publisher in a priority lane. Publishers start in PRIORITY_NORMAL,
+     * config and admin frames always go in PRIORITY_CONTROL. A publisher's messages keep their order.
+     * Lanes only come into play once setMaxWritesPerUpdate() sets a budget: without one every
+     * frame is written as soon as it is sent, so priorities change nothing.
+     */
+    void setPublishPriority( const std::string &name, Priority priority );
+
+    /**
+     * @brief Limits how many frames are handed to the transport per update(). Frames over the
+     * budget wait in their priority lane, so a burst of bulk data can't hold up control cues.
+     * This budget is what makes setPublishPriority() take effect. There is no budget by default,
+     * because a budget holds frames back to the next update() and no one size suits every app.
+     * Pick one a little above the frames a busy update() normally sends.
+     * @param {size_t} maxWrites 0, the default, writes everything straight away and ignores priorities
+     */
+    void setMaxWritesPerUpdate( size_t maxWrites );
+
+    /**
+     * @brief Packs the messages sent between two update()s into one frame, a JSON array of
+     * message objects. Only for routers that understand it, received batches are always unpacked.
+     * Other frames, such as config, are still sent on their own and in order.
+     * @param {bool} batching Defaults to true
+     * @param {size_t} maxBytes A batch is written early once it grows past this size
+     */
+    void setBatching( bool batching = true, size_t maxBytes = 64 * 1024 );
+	bool isBatching() const { return mIsBatching; }
+
+    /**
+     * @brief Writes the current batch now instead of at the end of the next update()
+     */
+    void flush();
+
+    /**
+     * @return Frames waiting in \a priority's lane
+     */
+	size_t getNumQueued( Priority priority ) const { return mLanes[priority].size(); }
+
+    /**
+     * @brief Sends publisher \a name over a websocket of its own, so a heavy publisher doesn't
+     * hold up the others. Shard 0 is the main connection. Every other shard connects to the same
+     * server once the main connection is up, and registers as client "<name>#<shard>" with just
+     * its publishers, so that is the client to route them from. Subscribers stay on the main
+     * connection, and whatever a shard receives is dispatched like the rest.
+     * @param {std::string} name Name of a publisher, which doesn't need to be added yet
+     * @param {size_t} shard Shard to send it on
+     */
+    void setPublisherShard( const std::string &name, size_t shard );
+	size_t getNumShards() const { return mShards.size() + 1; }
+	bool isShardConnected( size_t shard ) const { return shard == 0 ? mIsConnected : mShards[shard - 1].mIsConnected; }
+	//! Creates the transports of the extra shards, WebSocketTransport by default
+	void setShardTransportFactory( const std::function<TransportRef ()> &factory ) { mShardFactory = factory; }
     
     /**
      * @brief Add message to publish
      * @param {Spacebrew::Message} m
      */
     void addPublish( const Message &m );
-    
+
+    /**
+     * @brief Add a typed publisher. The returned handle sends with no name lookup or type checks.
+     * @param {std::string} name Name of message
+     * @param {std::string} def  Default value
+     * @example auto red = spacebrew->addPublish<Spacebrew::Range>( "red" ); red.send( 512 );
+     */
+    template<typename T>
+    Publisher<T> addPublish( const std::string &name, const std::string &def = "", const PublishFilter &filter = PublishFilter() );
+
+    /**
+     * @brief Add a typed subscriber. Incoming values are decoded with Codec<T> and passed to \a callback
+     * @param {std::string} name Name of message
+     * @param {Callback}    callback Called with each decoded value
+     * @example spacebrew->addSubscribe<Spacebrew::Range>( "red", [&]( int v ){ mRed = v; } );
+     */
+    template<typename T>
+    Subscriber<T> addSubscribe( const std::string &name, const typename Subscriber<T>::Callback &callback );
+
     /**
      * @return Current Spacebrew::Config (list of publish/subscribe, etc)
      */
@@ -264,6 +1589,129 @@ public:
      * @return Are we connected?
      */
 	bool isConnected() { return mIsConnected; }
+
+    /**
+     * @brief Track the server's routes, and skip sending on publishers nobody is routed to.
+     * This registers the connection for the server's admin notifications. Sends are only skipped
+     * after the update() that received the server's reply, which lists the existing routes.
+     * @param {bool} track Defaults to true
+     */
+	void setRouteTracking( bool track = true );
+	bool isRouteTracking() const { return mIsRouteTracking; }
+
+    /**
+     * @return Routes the server has reported, if route tracking is on
+     */
+	const std::vector<Route>& getRoutes() const { return mRoutes; }
+
+    /**
+     * @return Whether anything is routed to publisher \a name. Always true until the server has
+     * reported its routes, or if route tracking is off.
+     */
+	bool hasRoutes( const std::string &name ) const;
+
+    /**
+     * @brief Emitted whenever a route to or from this client is added or removed
+     */
+	ci::signals::Signal<void ()> onRoutesChanged;
+
+    /**
+     * @brief Turns admin mode on or off. In admin mode the connection keeps a Topology of
+     * the whole server, applying the admin notifications that arrived since the last update()
+     * as one batch.
+     * @param {bool} admin Defaults to true
+     */
+	void setAdminMode( bool admin = true );
+	bool isAdminMode() const { return mIsAdminMode; }
+
+    /**
+     * @brief Caps how many admin notifications are applied per update(), so a mass reconnect
+     * is spread over several frames. 0, the default, applies everything.
+     */
+	void setMaxAdminUpdatesPerFrame( size_t maxUpdates ) { mMaxAdminUpdates = maxUpdates; }
+
+    /**
+     * @return Everything on the server, when in admin mode
+     */
+	const Topology& getTopology() const { return mTopology; }
+
+    /**
+     * @brief Emitted at most once per update() when the Topology has changed
+     */
+	ci::signals::Signal<void ()> onTopologyChanged;
+
+    /**
+     * @brief Replaces the transport to the server, e.g. with a LoopbackTransport for testing.
+     * The current transport is disconnected. Call connect() afterwards.
+     */
+	void setTransport( const TransportRef &transport );
+	const TransportRef& getTransport() const { return mTransport; }
+
+    /**
+     * @brief Records every frame sent and received to \a recorder. Pass nullptr to stop recording.
+     */
+	void setRecorder( const RecorderRef &recorder ) { mRecorder = recorder; }
+	const RecorderRef& getRecorder() const { return mRecorder; }
+
+	struct Stats {
+		//! Message frames received and decoded
+		uint64_t	messagesReceived = 0;
+		//! Sends skipped because their publisher had no routes
+		uint64_t	sendsSuppressed = 0;
+		//! Message objects and buffers the receive path had to allocate. Stays flat once warmed up.
+		uint64_t	receiveAllocations = 0;
+		//! Frames that had to wait in a priority lane for the write budget
+		uint64_t	writesQueued = 0;
+		//! Multi-message frames written while batching
+		uint64_t	batchesSent = 0;
+		//! Messages dropped because their shard's connection wasn't up
+		uint64_t	shardWritesDropped = 0;
+		//! TLS connections made, and how many of them resumed an earlier session
+		uint64_t	tlsHandshakes = 0, tlsResumptions = 0;
+		//! Duration of the last TLS handshake, in seconds
+		double		lastHandshakeSeconds = 0;
+	};
+
+    /**
+     * @return Counters for this connection
+     */
+	const Stats& getStats() const { return mStats; }
+
+    /**
+     * @brief Adds a sequence number, counted per publisher, and the send time to every outgoing
+     * message, in an "sbx" field other Spacebrew clients ignore. Receivers use them to measure
+     * delivery in getDeliveryStats(). Each count carries a random epoch, so receivers tell a
+     * restarted publisher from a late message.
+     * @param {bool} enabled Off by default
+     */
+	void setSequencing( bool enabled ) { mIsSequencing = enabled; }
+	bool isSequencing() const { return mIsSequencing; }
+
+	struct DeliveryStats {
+		//! Subscriber name
+		std::string	name;
+		//! Sequenced messages received, including duplicates
+		uint64_t	received = 0;
+		//! Messages skipped over by gaps, less the ones that turned up late
+		uint64_t	lost = 0;
+		uint64_t	duplicates = 0;
+		//! Messages that arrived after a later one from the same publisher
+		uint64_t	reordered = 0;
+		//! Times a publisher's sequence started over, like after a restart
+		uint64_t	restarts = 0;
+		//! Gap sizes, in messages
+		Histogram	gaps;
+		//! How many messages behind the newest the reordered ones were
+		Histogram	reorderDistances;
+		//! Milliseconds from send to receive. Only meaningful when the clocks of both hosts are in sync.
+		Histogram	latencies;
+	};
+
+    /**
+     * @return Delivery quality of each subscription that received sequenced messages
+     */
+	std::vector<DeliveryStats> getDeliveryStats() const;
+	void resetDeliveryStats();
 	
     /**
      * @brief Turn on/off auto reconnect (try to connect when/if Spacebrew server closes)
@@ -302,7 +1750,130 @@ public:
      * };
      */
 	ci::signals::Signal<void (const Message&)> onMessage;
+
+    /**
+     * @brief Zero-copy version of onMessage. The view points into the received frame and is only
+     * valid during the callback. When only this signal is connected, no Message is built at all.
+     */
+	ci::signals::Signal<void (const MessageView&)> onMessageView;
+
+    /**
+     * @brief Emitted once per update() with everything received during it, as long as something
+     * was. Messages still go to the per-message listeners too, so a visualizer that only
+     * connects here pays no per-message callback at all.
+     * @example spacebrew->onMessageBatch.connect( [&]( const Spacebrew::MessageBatch &batch ){ ... } );
+     */
+	ci::signals::Signal<void (const MessageBatch&)> onMessageBatch;
     
+    /**
+     * @brief Calls \a callback for every message whose name starts with \a prefix. Disconnect
+     * the returned connection to stop listening.
+     * @example spacebrew->addPrefixListener( "zoneA/", [&]( const Spacebrew::Message &m ){ ... } );
+     */
+	ci::signals::Connection addPrefixListener( const std::string &prefix, const std::function<void (const Message&)> &callback );
+
+    /**
+     * @brief Calls \a callback for every message whose name matches \a pattern, where * matches
+     * any part of one '/' separated segment and a trailing ** matches the rest of the name
+     * @example spacebrew->addPatternListener( "zoneA/sensor*", [&]( const Spacebrew::Message &m ){ ... } );
+     */
+	ci::signals::Connection addPatternListener( const std::string &pattern, const std::function<void (const Message&)> &callback );
+
+    /**
+     * @brief Keeps the last \a capacity values received by subscriber \a name with the time they
+     * arrived, so the render loop can sample a smooth value from any thread. Range and boolean
+     * values are recorded, other types are ignored. Calling it again returns the same History.
+     * @param {std::string} name Name of an existing subscriber
+     * @param {size_t} capacity Number of values kept, rounded up to a power of two
+     */
+	HistoryRef enableHistory( const std::string &name, size_t capacity = 64 );
+	//! History of subscriber \a name, or nullptr if enableHistory() wasn't called for it
+	HistoryRef getHistory( const std::string &name ) const;
+
+    /**
+     * @brief Runs message listeners on a pool of worker threads, so a slow listener only holds
+     * up its own subscription. Listeners of one subscription still get its messages in order and
+     * one at a time, while different subscriptions run in parallel. onMessage, onMessageView and
+     * coroutines stay on the update thread. Subscription and pattern listeners then run off the main
+     * thread: they must not call into the Connection, hand results back with
+     * app::App::get()->dispatchAsync() instead.
+     * @param {bool} enabled Pass false to wait for queued listeners and go back to running them in update()
+     * @param {size_t} numThreads Number of workers, 0 for one per core
+     */
+	void setParallelDispatch( bool enabled, size_t numThreads = 0 );
+	bool isParallelDispatch() const { return mDispatchPool != nullptr; }
+
+	struct ListenerStats {
+		//! Subscriber name, empty for messages no subscriber matched
+		std::string	name;
+		uint64_t	calls = 0;
+		double		totalSeconds = 0, maxSeconds = 0;
+	};
+
+    /**
+     * @return How long the listeners of each subscription took per message, measured on the
+     * workers while parallel dispatch is on
+     */
+	std::vector<ListenerStats> getListenerStats() const;
+
+    /**
+     * @brief Last value received by subscriber \a name, decoded with Codec<T>. Every subscriber's
+     * latest value is kept, so an app can poll for it instead of keeping a member per subscription.
+     * Safe to call from any thread, also while subscribers are added or the config is replaced.
+     * @return false when nothing was received yet or the value doesn't decode
+     * @example int red; if ( spacebrew->getLatest<Spacebrew::Range>( "red", red ) ) ...
+     */
+	template<typename T>
+	bool getLatest( const std::string &name, typename Codec<T>::value_type &out ) const;
+	//! Same as above, without the name lookup. The handle keeps reading its name's value across config changes.
+	template<typename T>
+	bool getLatest( const Subscriber<T> &subscriber, typename Codec<T>::value_type &out ) const;
+	//! Undecoded value of subscriber \a subscriberId, as in Subscriber::getId()
+	bool getLatestRaw( size_t subscriberId, std::string &raw ) const;
+
+    /**
+     * @return A version bumped by every value received; pass it to getChangedSince() later
+     */
+	uint64_t getLatestVersion() const { return mLatestValues.getVersion(); }
+
+    /**
+     * @brief Replaces \a subscriberIds with the ids of the subscribers whose latest value changed,
+     * or went stale, after \a version
+     * @return The current version, to pass next time
+     */
+	uint64_t getChangedSince( uint64_t version, std::vector<size_t> &subscriberIds ) const;
+	bool hasChangedSince( const std::string &name, uint64_t version ) const;
+
+    /**
+     * @return Whether the latest value of \a name was received before the connection last dropped.
+     * The server doesn't send values again on reconnect, so it may be out of date.
+     */
+	bool isLatestStale( const std::string &name ) const;
+
+    /**
+     * @brief Polls the transport on a thread of its own instead of in update(), so frames are read
+     * as soon as they arrive. The thread sleeps on the transport's TransportWait in between.
+     * Immediate listeners run on that thread right away; everything else is still delivered
+     * from update(), or sooner with \a wakeApp.
+     * @param {bool} enabled Pass false to stop the thread and poll from update() again
+     * @param {bool} wakeApp Asks the app to deliver queued messages with app::App::dispatchAsync()
+     * as soon as they arrive, instead of waiting for the next update()
+     */
+	void setIoThread( bool enabled, bool wakeApp = false );
+	bool isIoThread() const { return mIoThread.joinable(); }
+
+    /**
+     * @brief Calls \a callback for every message to subscriber \a name the moment its frame is
+     * read, before it is queued for update(). It runs on the I/O thread when setIoThread() is on,
+     * otherwise from the poll in update(), with no lock held. Keep it short. Adding and removing
+     * immediate listeners from it is fine and takes effect with the next frame; anything else
+     * goes back to the Connection through app::App::get()->dispatchAsync(). The view is only
+     * valid during the call.
+     * @return An id for removeImmediateListener()
+     */
+	size_t addImmediateListener( const std::string &name, const std::function<void (const MessageView&)> &callback );
+	void removeImmediateListener( size_t id );
+
     /**
      * @brief Helper function to automatically add a listener to a connections onMessage Signal
      */
@@ -311,16 +1882,198 @@ public:
     {
         onMessage.connect( std::bind( callback, callbackObject, std::placeholders::_1 ) );
     }
-    
+
+    /**
+     * @brief Calls \a callback once connected, right away if already connected. Like all
+     * the when* callbacks it runs from update(), and only once.
+     */
+	void whenConnected( const std::function<void ()> &callback );
+
+    /**
+     * @brief Calls \a callback with the next message received for subscriber \a name
+     */
+	void whenMessage( const std::string &name, const std::function<void (const Message&)> &callback );
+
+    /**
+     * @brief Calls \a callback at the end of the next update(), once everything sent so far,
+     * including frames deferred by a PublishFilter, has been handed to the transport
+     */
+	void whenSent( const std::function<void ()> &callback );
+
+#if defined( SPACEBREW_COROUTINES )
+    /**
+     * @brief Connects, and resumes the awaiting coroutine from update() once connected
+     * @example co_await spacebrew->connectAsync();
+     */
+	ConnectAwaiter connectAsync();
+
+    /**
+     * @brief Resumes the awaiting coroutine from update() with the next message for \a name
+     * @example Spacebrew::Message start = co_await spacebrew->nextMessage( "start" );
+     */
+	MessageAwaiter nextMessage( const std::string &name );
+
+    /**
+     * @brief Resumes the awaiting coroutine once everything sent so far has been written
+     * @example co_await spacebrew->flushAsync();
+     */
+	SentAwaiter flushAsync();
+#endif
+
+    /**
+     * @brief Polls the transport and dispatches received messages. Called automatically from
+     * your app's update signal, call it yourself when running without a Cinder App.
+     */
+	virtual void update();
     
 protected:
 	Connection( const std::string& host, const uint16_t &port, const std::string& name, const std::string& description );
 	void initialize();
-	
-	virtual void update();
-	void updatePubSub() { mClient->write( mConfig.getJSON() ); }
-	
-	std::unique_ptr<WebSocketClient> mClient;
+	//! Sends the config, which is only encoded again after it changed
+	void updatePubSub();
+
+	static const size_t NO_ENDPOINT = static_cast<size_t>( -1 );
+
+	struct PublisherState {
+		std::string		mName, mType;
+		//! Pre-encoded message up to and including "value":
+		std::string		mHeader;
+
+		PublishFilter	mFilter;
+		Priority		mPriority = PRIORITY_NORMAL;
+		//! Last sequence number sent, and what tells this count apart from earlier ones that started over
+		uint64_t		mSequence = 0, mEpoch = 0;
+		//! Socket the messages go out on, see setPublisherShard()
+		size_t			mShard = 0;
+		size_t			mNumRoutes = 0;
+		bool			mHasSent = false, mHasPending = false, mIsDeferring = false;
+		double			mLastNumber = 0, mPendingNumber = 0, mLastSendTime = 0;
+		//! Frame held back by the rate limit, and the last frame sent for heartbeats
+		std::string		mPending, mLastFrame;
+	};
+
+	enum FilterResult { FILTER_SEND, FILTER_DROP, FILTER_DEFER };
+
+	struct Strand;
+
+	//! Sequence tracking of one publisher sending to a subscriber
+	struct SenderSequence {
+		std::string		mClientName;
+		//! Epoch of the count being tracked and of the one before it, 0 for senders without epochs
+		uint64_t		mEpoch = 0, mPreviousEpoch = 0;
+		//! Sequence number expected next
+		uint64_t		mNext = 0;
+		//! Bit i is set if mNext - 1 - i was received
+		uint64_t		mWindow = 0;
+		//! This sender's share of DeliveryStats::lost, so a late arrival only makes up for its own gaps
+		uint64_t		mLost = 0;
+	};
+
+	struct Delivery {
+		DeliveryStats				mStats;
+		std::vector<SenderSequence>	mSenders;
+	};
+
+	struct SubscriberState {
+		std::string		mName, mType;
+		//! Reported in Message::getEndpointId()
+		size_t			mEndpointId = UNKNOWN_ENDPOINT;
+		//! Listener patterns matching mName, valid while mPatternsVersion matches the connection's
+		std::vector<size_t>	mPatternMatches;
+		size_t			mPatternsVersion = 0;
+		std::shared_ptr<ci::signals::Signal<void (const Message&)>> mSignal;
+		HistoryRef		mHistory;
+		//! Parallel dispatch queue, owned by mStrands
+		Strand			*mStrand = nullptr;
+		std::shared_ptr<Delivery>	mDelivery;
+		//! Owned by mLatestValues
+		LatestValues::Entry	*mLatest = nullptr;
+	};
+
+	size_t	registerPublisher( const std::string &name, const std::string &type );
+	size_t	registerSubscriber( const std::string &name, const std::string &type );
+	//! Rebuilds the endpoint tables after mConfig has been replaced
+	void	rebuildEndpoints();
+	size_t	findPublisher( const std::string &name, const std::string &type ) const;
+	size_t	findSubscriber( const std::string &name ) const { return findSubscriber( name.data(), name.size() ); }
+	size_t	findSubscriber( const char *name, size_t length ) const;
+	//! Adds a subscriber to mSubscriberTable, growing it when it gets crowded
+	void	indexSubscriber( size_t subscriberId );
+	//! Publishes the latest value entries of mSubscriberStates to readers on other threads
+	void	publishLatestIndex();
+	ci::signals::Signal<void (const Message&)>& getSubscriberSignal( size_t subscriberId );
+
+	//! Returns the reusable frame buffer filled with the publisher's header, or nullptr if
+	//! not connected or the publisher's filter dropped \a number
+	std::string*	beginFrame( size_t publisherId, const double *number = nullptr );
+	//! Same as above for a publisher that may not be registered. \a publisherId receives its id or NO_ENDPOINT
+	std::string*	beginFrame( const std::string &name, const std::string &type, size_t *publisherId, const double *number = nullptr );
+	//! Same as above for a Publisher<T> handle, nullptr once its publisher was removed
+	std::string*	beginHandleFrame( size_t handle, size_t *publisherId, const double *number = nullptr );
+	//! Sends \a m as encoded by Message::getJSON(), through beginFrame() and endFrame()
+	void			sendMessage( const Message &m );
+	//! Closes and writes the frame started with beginFrame()
+	void			endFrame( size_t publisherId );
+	//! Every outgoing message frame ends up here
+	void			writeFrame( size_t publisherId, const std::string &frame );
+	//! Copy of \a frame with the publisher's next sequence number and the time added
+	const std::string&	stampFrame( size_t publisherId, const std::string &frame );
+
+	struct Shard {
+		TransportRef	mTransport;
+		bool			mIsConnected = false;
+		double			mLastTimeTriedConnect = 0;
+	};
+
+	//! Client name shard \a shard registers as
+	std::string		getShardClientName( size_t shard ) const;
+	size_t			getPublisherShard( const std::string &name ) const;
+	//! Config frame registering the endpoints that go over shard \a shard
+	std::string		getShardConfig( size_t shard ) const;
+	void			connectShard( size_t shard );
+	void			onShardConnect( size_t shard );
+	void			onShardDisconnect( size_t shard );
+	//! Counts the TLS handshake of a transport that just opened in mStats
+	void			recordHandshake( const Transport &transport );
+	void			writeShard( size_t shard, const std::string &frame );
+	//! Hands a frame to the transport, past the priority lanes
+	void			transmitFrame( const std::string &frame );
+	//! Writes queued frames, highest priority first, until the write budget runs out
+	void			flushLanes();
+	void			clearLanes();
+	bool			hasQueuedFrames() const;
+
+	FilterResult	applyFilter( PublisherState &state, const double *number, double now );
+	//! Sends rate limited values that are due and heartbeats
+	void			updateFilters( double now );
+
+	template<typename T>
+	void	sendValue( const std::string &name, const typename Codec<T>::value_type &value );
+
+	//! Handles frames that aren't messages, i.e. admin notifications
+	void	onAdmin( const Json::Value &json );
+	//! Registers for admin notifications, needed for route tracking and admin mode
+	void	sendAdminRegistration();
+	//! Applies queued admin notifications to mTopology
+	void	updateTopology();
+	ci::signals::Connection	connectPattern( size_t patternId, const std::function<void (const Message&)> &callback );
+	//! Returns the listener patterns matching a received name, cached per subscriber
+	const std::vector<size_t>&	matchPatterns( size_t subscriberId, const StringView &name );
+
+	//! Decodes and dispatches one frame, or one element of a batch
+	void	readFrame( const char *begin, const char *end );
+	//! Counts a sequenced message from \a clientName in its subscriber's DeliveryStats
+	void	trackSequence( const StringView &name, const StringView &clientName, uint64_t sequence, uint64_t epoch, uint64_t sentMillis );
+	//! Calls the one-shot callbacks waiting for a message called message.getName()
+	void	resumeMessageWaiters( const Message &message );
+	//! Recounts the routes of each publisher after mRoutes has changed
+	void	updateRouteCounts();
+
+	//! Emits \a view to onMessageView, then builds a Message for subscriber and onMessage
+	//! listeners if there are any. \a owned is the already decoded message, if any.
+	void	dispatch( const MessageView &view, Message *owned = nullptr );
+
+	TransportRef	mTransport;
 	//This is the connection to your Cinder App's Update Method
 	ci::signals::Connection mUpdateConnection;
 	
@@ -331,7 +2084,363 @@ protected:
 					mShouldAutoReconnect;
     double			mLastTimeTriedConnect,
 					mReconnectInterval;
+
+	std::vector<PublisherState>					mPublisherStates;
+	std::vector<SubscriberState>				mSubscriberStates;
+	std::unordered_map<std::string, size_t>		mPublisherIds;
+
+	//! What a Publisher<T> handle points at. Handles keep their index in mPublisherHandles while
+	//! rebuildEndpoints() renumbers the publishers, and look up the new id here.
+	struct PublisherHandle {
+		std::string		mName, mType;
+		//! NO_ENDPOINT once the publisher is gone
+		size_t			mId;
+	};
+	std::vector<PublisherHandle>				mPublisherHandles;
+	//! Index in mPublisherHandles for publisher \a name, shared by all its handles
+	size_t	acquirePublisherHandle( const std::string &name, const std::string &type );
+	//! Points the handles at the publishers' new ids after rebuildEndpoints()
+	void	updatePublisherHandles();
+
+	//! Open-addressed subscriber ids + 1 by name hash, so dispatch can look up a name in place
+	std::vector<uint32_t>						mSubscriberTable;
+	const SchemaEntry							*mSchema = nullptr;
+	size_t										mSchemaSize = 0;
+	//! Encoded mConfig, empty when it needs encoding again
+	std::string									mConfigFrame;
+
+	PatternIndex								mPatterns;
+	std::vector<std::shared_ptr<ci::signals::Signal<void (const Message&)>>>	mPatternSignals;
+	//! Bumped when a pattern is added, to invalidate the per-subscriber matches
+	size_t										mPatternsVersion = 1;
+	std::vector<size_t>							mPatternScratch, mPatternHits;
+	std::string									mFrame;
+	//! Unescaped copies of the fields of the frame being dispatched, when it had escapes
+	std::string									mUnescapedName, mUnescapedType, mUnescapedValue;
+	std::vector<int>							mQuantized;
+	std::vector<size_t>							mFilteredPublishers;
+	MessagePool									mMessagePool;
+	//! Collected for onMessageBatch while it has listeners
+	MessageBatch								mReceivedBatch;
+	Stats										mStats;
+	RecorderRef									mRecorder;
+
+	struct QueuedFrame {
+		size_t			mPublisherId;
+		std::string		mFrame;
+	};
+
+	//! Frames over the write budget, one FIFO per Priority, and emptied strings kept for their capacity
+	std::deque<QueuedFrame>						mLanes[NUM_PRIORITIES];
+	std::vector<std::string>					mSpareFrames;
+	size_t										mMaxWritesPerUpdate = 0, mNumWritesThisUpdate = 0;
+
+	//! Messages waiting to go out in one frame, as a JSON array under construction
+	bool										mIsBatching = false;
+	std::string									mBatch;
+	size_t										mMaxBatchBytes = 64 * 1024, mNumBatched = 0;
+
+	bool										mIsSequencing = false;
+	std::string									mStampedFrame;
+
+	//! Shards 1 and up, shard 0 is mTransport
+	std::vector<Shard>							mShards;
+	std::unordered_map<std::string, size_t>		mPublisherShards;
+	std::function<TransportRef ()>				mShardFactory;
+
+	bool										mIsRouteTracking = false, mHasRouteSnapshot = false;
+	//! The server's reply to our registration arrived, mHasRouteSnapshot is set at the end of the update()
+	bool										mIsRouteSnapshotPending = false;
+	std::vector<Route>							mRoutes;
+
+	bool										mIsAdminMode = false;
+	size_t										mMaxAdminUpdates = 0;
+	Topology									mTopology;
+	//! Admin notifications waiting to be applied to mTopology, oldest first from mAdminQueueStart
+	std::vector<Json::Value>					mAdminQueue;
+	size_t										mAdminQueueStart = 0;
+
+	typedef std::pair<std::string, std::function<void (const Message&)>> MessageWaiter;
+	std::vector<std::function<void ()>>			mConnectWaiters, mSentWaiters;
+	std::vector<MessageWaiter>					mMessageWaiters;
+
+	typedef std::shared_ptr<ci::signals::Signal<void (const Message&)>> SignalRef;
+
+	//! A message copied for a worker, with the listeners it goes to
+	struct StrandItem {
+		Message					mMessage;
+		SignalRef				mSignal;
+		std::vector<SignalRef>	mPatternSignals;
+	};
+
+	//! Serial queue of one subscription. Items are appended to mPending by update() and swapped
+	//! into mRunning by the worker, both reused so a warmed up strand doesn't allocate.
+	struct Strand {
+		std::string				mName;
+		std::mutex				mMutex;
+		std::vector<StrandItem>	mPending, mRunning;
+		size_t					mNumPending = 0;
+		bool					mIsScheduled = false;
+		std::atomic<uint64_t>	mCalls{ 0 }, mTotalNanos{ 0 }, mMaxNanos{ 0 };
+	};
+
+	Strand*	getStrand( size_t subscriberId );
+	//! Copies \a view into its strand and schedules the strand if it was idle
+	void	enqueueParallel( size_t subscriberId, const MessageView &view );
+	//! Runs \a strand's messages on a worker until it is empty
+	void	runStrand( Strand *strand );
+
+	std::vector<std::unique_ptr<Strand>>		mStrands;
+	Strand										*mUnmatchedStrand = nullptr;
+	//! Declared after mStrands so it is joined before they go away
+	DispatchPoolRef								mDispatchPool;
+
+	LatestValues								mLatestValues;
+
+	enum IoEventKind { IO_OPEN, IO_CLOSE, IO_INTERRUPT, IO_FAIL, IO_PING, IO_MESSAGE };
+
+	//! A transport event read on the I/O thread, waiting for update()
+	struct IoEvent {
+		IoEventKind	mKind;
+		std::string	mText;
+	};
+
+	struct ImmediateListener {
+		size_t											mId;
+		std::string										mName;
+		std::function<void (const MessageView&)>		mCallback;
+	};
+
+	//! Locks the transport while the I/O thread runs, and does nothing otherwise
+	std::unique_lock<std::mutex>	lockTransport();
+	//! Hands a transport event to its handler, or queues it for update() on the I/O thread
+	void	handleTransportEvent( IoEventKind kind, const std::string &text );
+	void	runTransportEvent( IoEventKind kind, const std::string &text );
+	//! Runs the handlers of the events queued by the I/O thread
+	void	processIoEvents();
+	void	runIoThread();
+	void	stopIoThread();
+	//! Calls the immediate listeners of the messages in \a frame
+	void	dispatchImmediate( const std::string &frame );
+	//! Runs the immediate listeners of what the I/O thread polled, once the transport lock is released, then queues it
+	void	queueIoEvents();
+
+	std::thread									mIoThread;
+	std::atomic<bool>							mIsIoStopping{ false }, mIsWakePending{ false };
+	bool										mIsWakingApp = false, mIsProcessingIoEvents = false;
+	std::mutex									mTransportMutex, mIoEventMutex;
+	//! All reused. mIoPolled collects one poll on the I/O thread, mIoEvents holds what it queued
+	//! for update(), which swaps it into mIoProcessing.
+	std::vector<IoEvent>						mIoPolled, mIoEvents, mIoProcessing;
+	size_t										mNumIoPolled = 0, mNumIoEvents = 0;
+	//! Cleared on destruction, so a wake-up still queued with the app does nothing
+	std::shared_ptr<bool>						mAliveToken;
+
+	std::mutex									mImmediateMutex;
+	//! Replaced on every change, so listeners run on a snapshot without the lock and may change it
+	std::shared_ptr<const std::vector<ImmediateListener>>	mImmediateListeners;
+	size_t										mNextImmediateId = 1;
+	std::atomic<bool>							mHasImmediateListeners{ false };
+	//! Unescape buffers of the immediate path, separate from readFrame()'s as it may run on another thread
+	std::string									mImmediateName, mImmediateType, mImmediateValue;
+
+	template<typename T> friend class Publisher;
+	friend class Replayer;
+};
+
+template<typename T>
+void Publisher<T>::send( const value_type &value ) const
+{
+	if( ! mConnection ) {
+		CI_LOG_E( "Send failed, the publisher handle wasn't returned by a Connection!" );
+		return;
+	}
+	double number;
+	size_t id;
+	std::string *frame = mConnection->beginHandleFrame( mHandle, &id, getFilterValue( value, number ) ? &number : nullptr );
+	if( frame ) {
+		Codec<T>::encode( value, *frame );
+		mConnection->endFrame( id );
+	}
+}
+
+template<typename T>
+size_t Publisher<T>::getId() const
+{
+	return mConnection ? mConnection->mPublisherHandles[mHandle].mId : UNKNOWN_ENDPOINT;
+}
+
+template<typename T>
+const std::string& Publisher<T>::getName() const
+{
+	static const std::string empty;
+	return mConnection ? mConnection->mPublisherHandles[mHandle].mName : empty;
+}
+
+template<typename T>
+Publisher<T> Connection::addPublish( const std::string &name, const std::string &def, const PublishFilter &filter )
+{
+	if( findPublisher( name, Codec<T>::type() ) == NO_ENDPOINT ) {
+		addPublish( name, Codec<T>::type(), def, filter );
+	}
+	else if( filter.isActive() ) {
+		setPublishFilter( name, filter );
+	}
+	return Publisher<T>( this, acquirePublisherHandle( name, Codec<T>::type() ) );
+}
+
+template<typename T>
+Subscriber<T> Connection::addSubscribe( const std::string &name, const typename Subscriber<T>::Callback &callback )
+{
+	size_t id = findSubscriber( name );
+	if( id == NO_ENDPOINT ) {
+		addSubscribe( name, Codec<T>::type() );
+		id = findSubscriber( name );
+	}
+	auto connection = getSubscriberSignal( id ).connect( [callback]( const Message &m ) {
+		typename Codec<T>::value_type value;
+		if( Codec<T>::decode( m.getRawValue(), value ) )
+			callback( value );
+	} );
+	return Subscriber<T>( id, connection, mSubscriberStates[id].mLatest );
+}
+
+template<typename T>
+bool Connection::getLatest( const std::string &name, typename Codec<T>::value_type &out ) const
+{
+	// kept per thread, so warmed up reads don't allocate
+	static thread_local std::string raw;
+	// the index is held for the lookup only, the entry it finds never moves
+	const LatestValues::Entry *entry = mLatestValues.getIndex()->find( name );
+	return entry && mLatestValues.load( *entry, raw ) && Codec<T>::decode( raw, out );
+}
+
+template<typename T>
+bool Connection::getLatest( const Subscriber<T> &subscriber, typename Codec<T>::value_type &out ) const
+{
+	static thread_local std::string raw;
+	return subscriber.mLatest && mLatestValues.load( *subscriber.mLatest, raw ) && Codec<T>::decode( raw, out );
+}
+
+#if defined( SPACEBREW_COROUTINES )
+
+/**
+ * @brief Minimal coroutine return type for control sequences driven by a Connection. The
+ * coroutine starts right away and runs until its first co_await; nothing waits for it to finish.
+ * @example Spacebrew::Task run() { co_await spacebrew->connectAsync(); ... }
+ */
+struct Task {
+	struct promise_type {
+		Task				get_return_object() { return Task(); }
+		std::suspend_never	initial_suspend() noexcept { return {}; }
+		std::suspend_never	final_suspend() noexcept { return {}; }
+		void				return_void() {}
+		void				unhandled_exception() { std::terminate(); }
+	};
+};
+
+/**
+ * @brief Coroutine suspended on a Connection's when* callback. It is resumed at most once, and
+ * destroyed if the callback is dropped without being called, which is what happens to coroutines
+ * still waiting when their Connection is destroyed.
+ */
+class SuspendedCoroutine {
+public:
+	explicit SuspendedCoroutine( std::coroutine_handle<> handle ) : mHandle( handle ) {}
+	~SuspendedCoroutine() { if( mHandle ) mHandle.destroy(); }
+
+	SuspendedCoroutine( const SuspendedCoroutine& ) = delete;
+	SuspendedCoroutine& operator=( const SuspendedCoroutine& ) = delete;
+
+	void resume()
+	{
+		std::coroutine_handle<> handle = mHandle;
+		mHandle = nullptr;
+		handle.resume();
+	}
+
+private:
+	std::coroutine_handle<>	mHandle;
+};
+
+/**
+ * @brief The awaiters resume coroutines from Connection::update(), and must not outlive the
+ * Connection. A coroutine still waiting on one when the Connection is destroyed never resumes:
+ * its frame is destroyed along with the Connection, which runs the destructors of its locals.
+ * A coroutine holding a ConnectionRef keeps its Connection alive while it waits.
+ */
+class ConnectAwaiter {
+public:
+	explicit ConnectAwaiter( Connection *connection ) : mConnection( connection ) {}
+
+	bool	await_ready() const { return mConnection->isConnected(); }
+	void	await_suspend( std::coroutine_handle<> handle )
+	{
+		auto suspended = std::make_shared<SuspendedCoroutine>( handle );
+		mConnection->whenConnected( [suspended] { suspended->resume(); } );
+	}
+	void	await_resume() const {}
+
+private:
+	Connection	*mConnection;
+};
+
+class MessageAwaiter {
+public:
+	MessageAwaiter( Connection *connection, const std::string &name ) : mConnection( connection ), mName( name ) {}
+
+	bool	await_ready() const { return false; }
+	void	await_suspend( std::coroutine_handle<> handle )
+	{
+		// the awaiter lives in the coroutine frame until resumed, so it can hold the message
+		auto suspended = std::make_shared<SuspendedCoroutine>( handle );
+		mConnection->whenMessage( mName, [this, suspended]( const Message &message ) {
+			mMessage = message;
+			suspended->resume();
+		} );
+	}
+	Message	await_resume() { return std::move( mMessage ); }
+
+private:
+	Connection	*mConnection;
+	std::string	mName;
+	Message		mMessage;
+};
+
+class SentAwaiter {
+public:
+	explicit SentAwaiter( Connection *connection ) : mConnection( connection ) {}
+
+	bool	await_ready() const { return false; }
+	void	await_suspend( std::coroutine_handle<> handle )
+	{
+		auto suspended = std::make_shared<SuspendedCoroutine>( handle );
+		mConnection->whenSent( [suspended] { suspended->resume(); } );
+	}
+	void	await_resume() const {}
+
+private:
+	Connection	*mConnection;
 };
+
+inline ConnectAwaiter Connection::connectAsync()
+{
+	if ( ! mIsConnected )
+		connect();
+	return ConnectAwaiter( this );
+}
+
+inline MessageAwaiter Connection::nextMessage( const std::string &name )
+{
+	return MessageAwaiter( this, name );
+}
+
+inline SentAwaiter Connection::flushAsync()
+{
+	return SentAwaiter( this );
+}
+
+#endif
     
 //Creating the Routes
     
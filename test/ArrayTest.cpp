@@ -0,0 +1,146 @@
+// Range and float arrays: quantizing normalized values, encoding them, and parsing arrays from
+// other clients, which must not depend on the C locale nor let through what JSON can't hold
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <cfloat>
+#include <clocale>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+
+using namespace Spacebrew;
+
+namespace {
+
+std::string encodeFloats( const std::vector<float> &values )
+{
+	std::string out;
+	appendFloatArray( values.data(), values.size(), out );
+	return out;
+}
+
+bool parsesTo( const std::string &raw, const std::vector<float> &expected )
+{
+	std::vector<float> out;
+	return parseFloatArray( raw, out ) && out == expected;
+}
+
+bool parsesTo( const std::string &raw, const std::vector<int> &expected )
+{
+	std::vector<int> out;
+	return parseRangeArray( raw, out ) && out == expected;
+}
+
+//! Every float in \a values comes back exactly from its encoding
+void checkRoundTrip( const std::vector<float> &values )
+{
+	std::vector<float> decoded;
+	CHECK( parseFloatArray( encodeFloats( values ), decoded ) );
+	CHECK( decoded == values );
+}
+
+}
+
+int main()
+{
+	// quantizing: the vector loop takes groups of 4 and the rest is scalar, both clamp the same
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	std::vector<float> normalized = { 0.0f, 1.0f, 0.5f, -0.5f, 2.0f, nan, 0.25f, 1.0f / 1023, 1.0f, -1.0f, nan };
+	std::vector<int> expected = { 0, 1023, 512, 0, 1023, 0, 256, 1, 1023, 0, 0 };
+	for ( size_t count = 1; count <= normalized.size(); ++count ) {
+		std::vector<int> ranges( count );
+		quantizeRange( normalized.data(), ranges.data(), count );
+		CHECK( std::equal( ranges.begin(), ranges.end(), expected.begin() ) );
+	}
+
+	// encoding: ranges are clamped, floats that JSON can't hold are written as 0
+	std::vector<int> ranges = { -5, 0, 7, 1023, 5000, std::numeric_limits<int>::min() };
+	std::string encoded;
+	appendRangeArray( ranges.data(), ranges.size(), encoded );
+	CHECK( encoded == "[0,0,7,1023,1023,0]" );
+	encoded = "prefix";
+	appendRangeArray( nullptr, 0, encoded );
+	CHECK( encoded == "prefix[]" );
+	CHECK( encodeFloats( { 0.5f, -1.25f, 3.0f, std::numeric_limits<float>::infinity(), nan } ) == "[0.5,-1.25,3,0,0]" );
+
+	// encoded floats parse back exactly, down to denormals and up to the largest float
+	checkRoundTrip( { 0.0f, -0.0f, 1.0f, 0.1f, -3.14159274f, FLT_MIN, std::numeric_limits<float>::denorm_min(), FLT_MAX, -FLT_MAX, 1e-30f, 1e30f } );
+	std::mt19937 random( 27 );
+	std::uniform_int_distribution<uint32_t> bits;
+	std::vector<float> values;
+	while ( values.size() < 100000 ) {
+		uint32_t word = bits( random );
+		float value;
+		memcpy( &value, &word, sizeof( value ) );
+		if ( std::isfinite( value ) )
+			values.push_back( value );
+	}
+	checkRoundTrip( values );
+
+	// parsing follows JSON's number grammar
+	CHECK( parsesTo( " [ 1 , 2.5e3,-0.25 ,1E+2, 0.0001e4 ] ", std::vector<float>{ 1, 2500, -0.25f, 100, 1 } ) );
+	CHECK( parsesTo( "[]", std::vector<float>{} ) );
+	CHECK( parsesTo( "[0.1000000000000000000000000001]", std::vector<float>{ 0.1f } ) );
+	CHECK( parsesTo( "[123456789012345678901234567890]", std::vector<float>{ 1.23456789e29f } ) );
+	CHECK( parsesTo( "[1e-50, -1e-99999999]", std::vector<float>{ 0, -0.0f } ) );
+	const char *invalidFloats[] = {
+		"[nan]", "[NaN]", "[inf]", "[-inf]", "[infinity]", "[0x10]", "[0x1p3]", "[1e39]", "[-1e39]",
+		"[1e99999999]", "[1.]", "[.5]", "[1e]", "[1e+]", "[--1]", "[+1]", "[1 2]", "[1,]", "[1", "1", "[\"1\"]"
+	};
+	for ( const char *raw : invalidFloats ) {
+		std::vector<float> out;
+		CHECK( ! parseFloatArray( raw, out ) );
+	}
+	CHECK( parsesTo( "[0,7,1023, -1 ]", std::vector<int>{ 0, 7, 1023, -1 } ) );
+	CHECK( parsesTo( "[2147483647,1.9,5e2]", std::vector<int>{ 2147483647, 1, 5 } ) );
+	const char *invalidRanges[] = { "[2147483648]", "[99999999999999999999]", "[a]", "[1,]", "[1" };
+	for ( const char *raw : invalidRanges ) {
+		std::vector<int> out;
+		CHECK( ! parseRangeArray( raw, out ) );
+	}
+
+	// a C locale with a decimal comma changes neither, when the system has one
+	const char *commaLocales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "German" };
+	for ( const char *name : commaLocales ) {
+		if ( ! setlocale( LC_NUMERIC, name ) )
+			continue;
+		CHECK( encodeFloats( { 0.5f, -1.25f } ) == "[0.5,-1.25]" );
+		CHECK( parsesTo( "[0.5,-1.25]", std::vector<float>{ 0.5f, -1.25f } ) );
+		checkRoundTrip( values );
+		setlocale( LC_NUMERIC, "C" );
+		break;
+	}
+
+	// through a Connection: range arrays sent from ints are clamped, from floats quantized
+	auto connection = Connection::create( "localhost", "ArrayTest" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->addPublish( "levels", TYPE_RANGE_ARRAY, "[]" );
+	connection->addSubscribe( "levels", TYPE_RANGE_ARRAY );
+	connection->addPublish( "samples", TYPE_FLOAT_ARRAY, "[]" );
+	connection->addSubscribe( "samples", TYPE_FLOAT_ARRAY );
+	std::vector<std::vector<int>> receivedRanges;
+	std::vector<std::vector<float>> receivedFloats;
+	connection->onMessage.connect( [&]( const Message &m ) {
+		if ( m.getName() == "levels" )
+			receivedRanges.push_back( m.valueAsRangeArray() );
+		else if ( m.getName() == "samples" )
+			receivedFloats.push_back( m.valueAsFloatArray() );
+	} );
+	connection->connect();
+	connection->update();
+	const int levels[] = { -1, 5, 1024 };
+	connection->sendRangeArray( "levels", levels, 3 );
+	const float levelsNormalized[] = { -1.0f, 0.5f, 2.0f };
+	connection->sendRangeArray( "levels", levelsNormalized, 3 );
+	const float samples[] = { 0.1f, -2.5f, FLT_MAX };
+	connection->sendFloatArray( "samples", samples, 3 );
+	connection->update();
+	connection->update();
+	CHECK( receivedRanges.size() == 2 );
+	CHECK( receivedRanges[0] == ( std::vector<int>{ 0, 5, 1023 } ) );
+	CHECK( receivedRanges[1] == ( std::vector<int>{ 0, 512, 1023 } ) );
+	CHECK( receivedFloats.size() == 1 && receivedFloats[0] == std::vector<float>( samples, samples + 3 ) );
+	return 0;
+}
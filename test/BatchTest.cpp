@@ -0,0 +1,131 @@
+// Batching: the messages sent between two update()s leave as one JSON array, a lone message and
+// other frames leave on their own and in order, and arrays received are unpacked in order
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+//! Names of the messages in a frame written by the Connection, a batch or a single message
+std::vector<std::string> getBatchNames( const std::string &frame )
+{
+	Json::Value json;
+	Json::Reader reader;
+	CHECK( reader.parse( frame, json ) );
+	std::vector<std::string> names;
+	if ( json.isArray() ) {
+		for ( auto & element : json )
+			names.push_back( element["message"]["name"].asString() );
+	}
+	else
+		names.push_back( json["message"]["name"].asString() );
+	return names;
+}
+
+bool isBatch( const std::string &frame )
+{
+	return ! frame.empty() && frame.front() == '[' && frame.back() == ']';
+}
+
+bool isConfig( const std::string &frame )
+{
+	return frame.compare( 0, 10, "{\"config\":" ) == 0;
+}
+
+typedef std::vector<std::string> Names;
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "BatchTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	for ( const char *name : { "a", "b", "c", "d" } ) {
+		connection->addPublish( name, TYPE_RANGE, "0" );
+		connection->addSubscribe( name, TYPE_RANGE );
+	}
+	connection->setBatching();
+	connection->connect();
+	connection->update();
+	transport->clearWritten();
+
+	// the messages of one update() go out together when it ends
+	connection->sendRange( "a", 1 );
+	connection->sendRange( "b", 2 );
+	connection->send( Message( "c", TYPE_RANGE, "3" ) );
+	CHECK( transport->getWritten( false ).empty() );
+	connection->update();
+	auto written = transport->getWritten( false );
+	CHECK( written.size() == 1 && isBatch( written[0] ) );
+	CHECK( getBatchNames( written[0] ) == ( Names{ "a", "b", "c" } ) );
+	CHECK( connection->getStats().batchesSent == 1 );
+	transport->clearWritten();
+
+	// a batch of one is a plain message
+	connection->sendRange( "d", 4 );
+	connection->update();
+	written = transport->getWritten( false );
+	CHECK( written.size() == 1 && written[0].compare( 0, 11, "{\"message\":" ) == 0 && getFrameName( written[0] ) == "d" );
+	CHECK( connection->getStats().batchesSent == 1 );
+	transport->clearWritten();
+
+	// a config frame writes the messages sent before it first, and those after wait for update()
+	connection->sendRange( "a", 5 );
+	connection->sendRange( "b", 6 );
+	connection->addPublish( "late", TYPE_RANGE, "0" );
+	connection->sendRange( "c", 7 );
+	written = transport->getWritten( false );
+	CHECK( written.size() == 2 && isBatch( written[0] ) && isConfig( written[1] ) );
+	CHECK( getBatchNames( written[0] ) == ( Names{ "a", "b" } ) );
+	connection->update();
+	written = transport->getWritten( false );
+	CHECK( written.size() == 3 && getFrameName( written[2] ) == "c" && ! isBatch( written[2] ) );
+	transport->clearWritten();
+
+	// a batch is written as soon as a message takes it past maxBytes, the rest waits for update()
+	const size_t maxBytes = 256;
+	connection->setBatching( true, maxBytes );
+	for ( int i = 0; i < 22; ++i )
+		connection->sendRange( "late", 100 + i );
+	written = transport->getWritten( false );
+	CHECK( written.size() > 1 );
+	for ( auto & frame : written ) {
+		size_t messageSize = frame.size() / getBatchNames( frame ).size();
+		CHECK( frame.size() >= maxBytes && frame.size() - messageSize < maxBytes );
+	}
+	size_t numEarly = written.size();
+	connection->update();
+	written = transport->getWritten( false );
+	CHECK( written.size() == numEarly + 1 && written.back().size() < maxBytes );
+	Names names;
+	for ( auto & frame : written ) {
+		auto batch = getBatchNames( frame );
+		names.insert( names.end(), batch.begin(), batch.end() );
+	}
+	CHECK( names == Names( 22, "late" ) );
+	transport->clearWritten();
+
+	// turning batching off writes what's pending, and later messages go out one by one
+	connection->sendRange( "a", 8 );
+	connection->sendRange( "b", 9 );
+	connection->setBatching( false );
+	written = transport->getWritten( false );
+	CHECK( written.size() == 1 && getBatchNames( written[0] ) == ( Names{ "a", "b" } ) );
+	connection->sendRange( "c", 10 );
+	connection->sendRange( "d", 11 );
+	CHECK( transport->getWritten( false ).size() == 3 );
+	transport->clearWritten();
+
+	// received arrays are unpacked and dispatched in order, whatever sits between them
+	Names received;
+	connection->onMessage.connect( [&]( const Message &m ) { received.push_back( m.getName() + "=" + m.getRawValue() ); } );
+	transport->receive( "[" + makeMessageFrame( "b", TYPE_RANGE, "1" ) + " , " + makeMessageFrame( "a", TYPE_RANGE, "2" ) + "," + makeMessageFrame( "c", TYPE_RANGE, "3" ) + "]" );
+	transport->receive( makeMessageFrame( "d", TYPE_RANGE, "4" ) );
+	transport->receive( " [" + makeMessageFrame( "a", TYPE_RANGE, "5" ) + "]" );
+	connection->update();
+	CHECK( received == ( Names{ "b=1", "a=2", "c=3", "d=4", "a=5" } ) );
+	return 0;
+}
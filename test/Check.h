@@ -0,0 +1,13 @@
+// CHECK() for the tests, which stays on in release builds unlike assert()
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+#define CHECK( condition ) \
+	do { \
+		if( ! ( condition ) ) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK( " #condition " ) failed" << std::endl; \
+			std::exit( 1 ); \
+		} \
+	} while( 0 )
@@ -0,0 +1,80 @@
+// Coroutines over LoopbackTransport, C++20 only: connectAsync(), flushAsync() and nextMessage()
+// resume from update() in order, and a coroutine still waiting when its Connection is destroyed
+// is destroyed with it rather than leaked
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+//! Sets its flag when destroyed, to see a coroutine's locals go
+struct Sentinel {
+	explicit Sentinel( bool &destroyed ) : mDestroyed( destroyed ) {}
+	~Sentinel() { mDestroyed = true; }
+
+	bool &mDestroyed;
+};
+
+Task pingPong( Connection *connection, std::vector<std::string> &log )
+{
+	co_await connection->connectAsync();
+	log.push_back( "connected" );
+	connection->sendString( "ping", "hello" );
+	co_await connection->flushAsync();
+	log.push_back( "flushed" );
+	Message reply = co_await connection->nextMessage( "pong" );
+	log.push_back( "received " + reply.getRawValue() );
+}
+
+Task waitForever( Connection *connection, bool &destroyed, bool &resumed )
+{
+	Sentinel sentinel( destroyed );
+	co_await connection->nextMessage( "never" );
+	resumed = true;
+}
+
+}
+
+int main()
+{
+	std::vector<std::string> log;
+	bool destroyed = false, resumed = false;
+	{
+		auto connection = Connection::create( "localhost", "CoroutineTest" );
+		auto transport = LoopbackTransport::create();
+		transport->setEcho( false );
+		connection->setTransport( transport );
+		connection->addPublish( "ping", TYPE_STRING, "" );
+		connection->addSubscribe( "pong", TYPE_STRING );
+		connection->addSubscribe( "never", TYPE_STRING );
+
+		// runs up to its first co_await, connectAsync() starts connecting
+		pingPong( connection.get(), log );
+		CHECK( log.empty() );
+		waitForever( connection.get(), destroyed, resumed );
+
+		// connecting and writing the ping both end in the same update()
+		connection->update();
+		CHECK( connection->isConnected() );
+		CHECK( ( log == std::vector<std::string>{ "connected", "flushed" } ) );
+		uint64_t written = transport->getNumWritten();
+		connection->update();
+		CHECK( log.size() == 2 && transport->getNumWritten() == written );
+
+		// the reply resumes it from the update() that receives it
+		transport->inject( "{\"message\":{\"clientName\":\"other\",\"name\":\"pong\",\"type\":\"string\",\"value\":\"hello\"}}" );
+		connection->update();
+		CHECK( ( log == std::vector<std::string>{ "connected", "flushed", "received hello" } ) );
+
+		// already connected, connectAsync() doesn't suspend
+		pingPong( connection.get(), log );
+		CHECK( log.size() == 4 && log[3] == "connected" );
+		connection->update();
+		CHECK( log.size() == 5 && log[4] == "flushed" );
+		CHECK( ! destroyed && ! resumed );
+	}
+	// the coroutines still waiting went with the Connection, without resuming
+	CHECK( destroyed && ! resumed );
+	return 0;
+}
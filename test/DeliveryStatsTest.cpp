@@ -0,0 +1,96 @@
+// Delivery stats of sequenced messages: restarts are told apart by epoch, and a late arrival
+// only makes up for a gap of its own sender
+#include "RecordingTransport.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+std::string sequencedFrame( const std::string &clientName, uint64_t sequence, uint64_t epoch )
+{
+	std::string frame = makeMessageFrame( "level", "range", "\"1\"", clientName );
+	frame.insert( frame.size() - 2, ",\"sbx\":{\"seq\":" + std::to_string( sequence ) + ",\"e\":" + std::to_string( epoch ) + "}" );
+	return frame;
+}
+
+//! Receives the frames in one update and returns the stats of "level"
+Connection::DeliveryStats receive( Connection &connection, RecordingTransport &transport, const std::vector<std::string> &frames )
+{
+	for( auto &frame : frames )
+		transport.receive( frame );
+	connection.update();
+	auto stats = connection.getDeliveryStats();
+	CHECK( stats.size() == 1 );
+	return stats[0];
+}
+
+//! Value of the numeric field \a key in the "sbx" object of a written frame
+uint64_t getExtensionField( const std::string &frame, const std::string &key )
+{
+	size_t extension = frame.find( "\"sbx\":" );
+	CHECK( extension != std::string::npos );
+	size_t begin = frame.find( "\"" + key + "\":", extension );
+	CHECK( begin != std::string::npos );
+	return std::stoull( frame.substr( begin + key.size() + 3 ) );
+}
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "DeliveryStatsTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	connection->addSubscribe( "level", TYPE_RANGE );
+	connection->connect();
+	connection->update();
+
+	// a restart shows up right away, even when the new count is close behind the old one
+	auto stats = receive( *connection, *transport, { sequencedFrame( "a", 1, 7 ), sequencedFrame( "a", 2, 7 ), sequencedFrame( "a", 3, 7 ), sequencedFrame( "a", 1, 8 ) } );
+	CHECK( stats.restarts == 1 );
+	CHECK( stats.duplicates == 0 && stats.reordered == 0 && stats.lost == 0 );
+
+	// stragglers from before the restart don't count as another one
+	stats = receive( *connection, *transport, { sequencedFrame( "a", 4, 7 ), sequencedFrame( "a", 2, 8 ) } );
+	CHECK( stats.restarts == 1 );
+	CHECK( stats.lost == 0 );
+
+	// with the same epoch, far behind is late, not a restart
+	stats = receive( *connection, *transport, { sequencedFrame( "a", 100, 8 ), sequencedFrame( "a", 3, 8 ) } );
+	CHECK( stats.restarts == 1 );
+	CHECK( stats.lost == 96 );
+	CHECK( stats.reordered == 1 );
+
+	// "b" loses one, which turns up after the reset, and mustn't cancel out what "a" loses since
+	connection->resetDeliveryStats();
+	stats = receive( *connection, *transport, { sequencedFrame( "b", 1, 9 ), sequencedFrame( "b", 3, 9 ) } );
+	CHECK( stats.lost == 1 );
+	connection->resetDeliveryStats();
+	stats = receive( *connection, *transport, { sequencedFrame( "a", 102, 8 ), sequencedFrame( "b", 2, 9 ) } );
+	CHECK( stats.lost == 1 );
+	CHECK( stats.reordered == 1 );
+
+	// sequence numbers and their epoch carry on over a rebuild of the endpoints
+	auto sender = Connection::create( "localhost", "Sender" );
+	auto sent = std::make_shared<RecordingTransport>();
+	sender->setTransport( sent );
+	sender->setSequencing( true );
+	sender->addPublish( "level", TYPE_RANGE, "0" );
+	sender->connect();
+	sender->update();
+	sender->sendRange( "level", 1 );
+	sender->update();
+	Config config( "Sender", "" );
+	config.addPublish( "other", TYPE_RANGE, "0" );
+	config.addPublish( "level", TYPE_RANGE, "0" );
+	sender->connect( "localhost", config );
+	sender->sendRange( "level", 2 );
+	sender->update();
+	auto written = sent->getWritten();
+	CHECK( written.size() == 2 );
+	CHECK( getExtensionField( written[0], "seq" ) == 1 && getExtensionField( written[1], "seq" ) == 2 );
+	CHECK( getExtensionField( written[0], "e" ) == getExtensionField( written[1], "e" ) );
+	CHECK( getExtensionField( written[0], "e" ) != 0 );
+	return 0;
+}
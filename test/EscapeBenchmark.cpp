@@ -0,0 +1,61 @@
+// Throughput of large sendString() payloads, clean and with characters to escape, through the
+// encoder, the LoopbackTransport and the decoder
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <chrono>
+
+using namespace Spacebrew;
+
+namespace {
+
+void run( const char *label, const std::string &payload, int count )
+{
+	auto connection = Connection::create( "localhost", "EscapeBenchmark" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->addPublish( "chat", TYPE_STRING, "" );
+	connection->addSubscribe( "chat", TYPE_STRING );
+	size_t received = 0;
+	connection->onMessage.connect( [&]( const Message &m ) { received += m.getRawValue().size(); } );
+	connection->connect();
+	connection->update();
+
+	auto start = std::chrono::steady_clock::now();
+	for( int i = 0; i < count; ++i ) {
+		connection->sendString( "chat", payload );
+		connection->update();
+	}
+	connection->update();
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	CHECK( received == payload.size() * count );
+
+	std::cout << label << ": " << payload.size() * count / seconds / ( 1 << 20 ) << " MB/s sent and received" << std::endl;
+
+	std::string escaped;
+	start = std::chrono::steady_clock::now();
+	for( int i = 0; i < count; ++i ) {
+		escaped.clear();
+		appendEscaped( payload, escaped );
+	}
+	seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	std::cout << label << ": " << payload.size() * count / seconds / ( 1 << 20 ) << " MB/s appendEscaped()" << std::endl;
+}
+
+}
+
+int main()
+{
+	const size_t size = 1 << 20;
+	std::string clean( size, 'x' );
+	std::string sparse = clean;
+	for( size_t i = 0; i < size; i += 1000 )
+		sparse[i] = '"';
+	std::string dense = clean;
+	for( size_t i = 0; i < size; i += 8 )
+		dense[i] = '\n';
+
+	run( "clean", clean, 200 );
+	run( "one escape per KB", sparse, 200 );
+	run( "one escape per 8 bytes", dense, 50 );
+	return 0;
+}
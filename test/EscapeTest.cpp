@@ -0,0 +1,157 @@
+// Escaping and unescaping of JSON strings: the checked-in corpus in corpus/escape, a seeded
+// round-trip fuzz of appendEscaped() / appendUnescaped(), and the same strings sent through a
+// Connection. jsoncpp serves as the reference decoder.
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <fstream>
+#include <random>
+#include <sstream>
+
+using namespace Spacebrew;
+
+namespace {
+
+std::string readFile( const std::string &path )
+{
+	std::ifstream file( path.c_str(), std::ios::binary );
+	CHECK( file.good() );
+	std::stringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+bool decodeWithJsoncpp( const std::string &literal, std::string &out )
+{
+	Json::Value json;
+	Json::Reader reader;
+	if( ! reader.parse( "[" + literal + "]", json ) || ! json[0].isString() )
+		return false;
+	out = json[0].asString();
+	return true;
+}
+
+void checkRoundTrip( const std::string &raw )
+{
+	std::string escaped;
+	appendEscaped( raw, escaped );
+	CHECK( escaped.find_first_of( std::string( "\0\n\r\t", 4 ) ) == std::string::npos );
+
+	std::string decoded;
+	CHECK( appendUnescaped( escaped.data(), escaped.size(), decoded ) );
+	CHECK( decoded == raw );
+
+	std::string reference;
+	CHECK( decodeWithJsoncpp( '"' + escaped + '"', reference ) );
+	CHECK( reference == raw );
+}
+
+//! Files named valid_* hold a JSON string literal that must decode like jsoncpp decodes it,
+//! invalid_* ones a malformed one that appendUnescaped() must reject
+void checkCorpusFile( const std::string &path )
+{
+	std::string name = path.substr( path.find_last_of( "/\\" ) + 1 );
+	bool isValid = name.compare( 0, 6, "valid_" ) == 0;
+	std::string literal = readFile( path );
+	CHECK( ! literal.empty() && literal[0] == '"' );
+	std::string body = literal.substr( 1 );
+	if( ! body.empty() && body.back() == '"' )
+		body.pop_back();
+
+	std::string decoded;
+	bool isDecoded = appendUnescaped( body.data(), body.size(), decoded );
+	if( isDecoded != isValid )
+		std::cerr << name << std::endl;
+	CHECK( isDecoded == isValid );
+	if( isValid ) {
+		std::string reference;
+		CHECK( decodeWithJsoncpp( literal, reference ) );
+		CHECK( decoded == reference );
+		checkRoundTrip( decoded );
+	}
+}
+
+//! Random bytes weighted towards what needs escaping, with clean runs long enough to take the
+//! vectorized path and end at every offset within a vector
+std::string makeRandomString( std::mt19937 &random )
+{
+	static const char special[] = { '"', '\\', '/', '\n', '\r', '\t', '\b', '\f', '\0', '\x01', '\x1f', '\x7f' };
+	std::string out;
+	size_t parts = random() % 8;
+	for( size_t i = 0; i < parts; ++i ) {
+		switch( random() % 3 ) {
+			case 0:
+				out.append( random() % 70, char( 'a' + random() % 26 ) );
+				break;
+			case 1:
+				out += special[random() % sizeof( special )];
+				break;
+			default:
+				out += char( 0x80 + random() % 0x80 );
+				break;
+		}
+	}
+	return out;
+}
+
+//! Corrupts an escaped string, appendUnescaped() must either reject it or decode something
+//! that survives another round trip
+void checkMutated( std::string escaped, std::mt19937 &random )
+{
+	static const char mutations[] = { '\\', 'u', 'd', '8', 'D', 'c', '0', 'f', 'G', '"' };
+	size_t count = 1 + random() % 4;
+	for( size_t i = 0; i < count; ++i ) {
+		size_t at = escaped.empty() ? 0 : random() % escaped.size();
+		if( random() % 4 == 0 )
+			escaped.resize( at );
+		else
+			escaped.insert( escaped.begin() + at, mutations[random() % sizeof( mutations )] );
+	}
+
+	std::string decoded;
+	if( appendUnescaped( escaped.data(), escaped.size(), decoded ) )
+		checkRoundTrip( decoded );
+}
+
+void testMessagePath( std::mt19937 &random )
+{
+	auto connection = Connection::create( "localhost", "EscapeTest" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->addPublish( "chat", TYPE_STRING, "" );
+	connection->addSubscribe( "chat", TYPE_STRING );
+	std::vector<std::string> received;
+	connection->onMessage.connect( [&]( const Message &m ) { received.push_back( m.valueAsString() ); } );
+	connection->connect();
+	connection->update();
+	CHECK( connection->isConnected() );
+
+	std::vector<std::string> sent;
+	for( int i = 0; i < 500; ++i ) {
+		sent.push_back( makeRandomString( random ) );
+		connection->sendString( "chat", sent.back() );
+		connection->update();
+	}
+	connection->update();
+	CHECK( received == sent );
+}
+
+}
+
+int main( int argc, char *argv[] )
+{
+	CHECK( argc > 1 );
+	for( int i = 1; i < argc; ++i )
+		checkCorpusFile( argv[i] );
+
+	std::mt19937 random( 20261019 );
+	for( int i = 0; i < 20000; ++i ) {
+		std::string raw = makeRandomString( random );
+		checkRoundTrip( raw );
+		std::string escaped;
+		appendEscaped( raw, escaped );
+		checkMutated( escaped, random );
+	}
+
+	testMessagePath( random );
+	return 0;
+}
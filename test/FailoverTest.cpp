@@ -0,0 +1,108 @@
+// FailoverTransport over RecordingTransports: attempts are staggered, a failed one starts the
+// next right away, the first to open wins, a dropped link fails over to the next server, and
+// reconnecting reports the old link's close from update() rather than from inside connect()
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+#include <thread>
+
+using namespace Spacebrew;
+
+namespace {
+
+typedef std::shared_ptr<RecordingTransport> RecordingTransportRef;
+
+void holdAll( const std::vector<RecordingTransportRef> &servers )
+{
+	for ( auto & server : servers )
+		server->hold();
+}
+
+bool hasConfig( RecordingTransport &server )
+{
+	for ( auto & frame : server.getWritten( false ) ) {
+		if ( frame.compare( 0, 10, "{\"config\":" ) == 0 )
+			return true;
+	}
+	return false;
+}
+
+}
+
+int main()
+{
+	std::vector<RecordingTransportRef> servers;
+	auto failover = FailoverTransport::create( { "ws://a:9000", "ws://b:9000", "ws://c:9000" }, [&]() -> TransportRef {
+		servers.push_back( std::make_shared<RecordingTransport>() );
+		return servers.back();
+	} );
+	CHECK( servers.size() == 3 );
+	const double stagger = 0.2;
+	failover->setStagger( stagger );
+	auto connection = Connection::create( "a", 9000, "FailoverTest" );
+	connection->setTransport( failover );
+	holdAll( servers );
+
+	// the first server is tried on its own until the stagger has passed
+	connection->connect();
+	connection->update();
+	CHECK( servers[0]->isPending() && servers[0]->getUrl() == "ws://a:9000" );
+	CHECK( servers[1]->getNumConnects() == 0 && servers[2]->getNumConnects() == 0 );
+	std::this_thread::sleep_for( std::chrono::duration<double>( stagger * 1.5 ) );
+	connection->update();
+	CHECK( servers[1]->isPending() && servers[1]->getUrl() == "ws://b:9000" );
+	CHECK( servers[2]->getNumConnects() == 0 );
+
+	// a failure doesn't wait for the stagger
+	servers[0]->fail( "refused" );
+	connection->update();
+	CHECK( ! servers[0]->isPending() && servers[2]->isPending() );
+	CHECK( failover->isConnecting() && ! connection->isConnected() );
+
+	// the first to open wins, whatever its place in the list, and the others are dropped
+	servers[2]->open();
+	connection->update();
+	CHECK( connection->isConnected() && failover->getActiveUrl() == "ws://c:9000" );
+	CHECK( ! failover->isConnecting() && ! servers[1]->isPending() && ! servers[1]->isOpen() );
+	CHECK( hasConfig( *servers[2] ) && ! hasConfig( *servers[0] ) && ! hasConfig( *servers[1] ) );
+	CHECK( failover->getNumFailovers() == 0 );
+
+	// a dropped link tries the server after it straight away, and itself last
+	holdAll( servers );
+	servers[2]->drop();
+	connection->update();
+	CHECK( ! connection->isConnected() && failover->getNumFailovers() == 1 );
+	CHECK( servers[0]->isPending() && servers[0]->getNumConnects() == 2 );
+	CHECK( ! servers[1]->isPending() && ! servers[2]->isPending() );
+	servers[0]->open();
+	connection->update();
+	CHECK( connection->isConnected() && failover->getActiveUrl() == "ws://a:9000" );
+	CHECK( hasConfig( *servers[0] ) );
+
+	// when two open in the same update(), the one polled first keeps the link
+	holdAll( servers );
+	servers[0]->drop();
+	std::this_thread::sleep_for( std::chrono::duration<double>( stagger * 1.5 ) );
+	connection->update();
+	CHECK( servers[1]->isPending() && failover->getNumFailovers() == 2 );
+	std::this_thread::sleep_for( std::chrono::duration<double>( stagger * 1.5 ) );
+	connection->update();
+	CHECK( servers[2]->isPending() );
+	servers[2]->open();
+	servers[1]->open();
+	connection->update();
+	CHECK( connection->isConnected() && failover->getActiveUrl() == "ws://b:9000" );
+	CHECK( servers[1]->isOpen() && ! servers[2]->isOpen() );
+
+	// connecting again drops the link, the Connection hears of it from the next update()
+	holdAll( servers );
+	connection->connect();
+	CHECK( connection->isConnected() && failover->getActiveUrl().empty() );
+	connection->update();
+	CHECK( ! connection->isConnected() && servers[0]->isPending() );
+	servers[0]->open();
+	connection->update();
+	CHECK( connection->isConnected() && failover->getActiveUrl() == "ws://a:9000" );
+	return 0;
+}
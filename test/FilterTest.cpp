@@ -0,0 +1,106 @@
+// Publish filters against a stopped clock: the deadband drops values close to the last one sent,
+// the rate limit holds values back and sends the last one when the interval is up, and heartbeats
+// repeat the last value while nothing else is sent. Message objects are filtered like the rest.
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+using namespace Spacebrew;
+using ci::app::setElapsedSeconds;
+
+namespace {
+
+//! Values written for \a name since the last call
+std::vector<std::string> getWrittenValues( RecordingTransport &transport, const std::string &name )
+{
+	std::vector<std::string> values;
+	for ( auto & frame : transport.getWritten() ) {
+		if ( getFrameName( frame ) == name )
+			values.push_back( getFrameValue( frame ) );
+	}
+	transport.clearWritten();
+	return values;
+}
+
+typedef std::vector<std::string> Values;
+
+}
+
+int main()
+{
+	setElapsedSeconds( 0 );
+	auto connection = Connection::create( "localhost", "FilterTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	connection->addPublish( "dial", TYPE_RANGE, "0", PublishFilter().deadband( 2 ) );
+	connection->addPublish( "fader", TYPE_RANGE, "0", PublishFilter().maxRate( 10 ) );
+	connection->addPublish( "status", TYPE_STRING, "", PublishFilter().heartbeat( 1 ) );
+	connection->connect();
+	connection->update();
+	CHECK( connection->isConnected() );
+	transport->clearWritten();
+
+	// deadband: within 2 of the last value sent is dropped, whichever way it's sent
+	connection->sendRange( "dial", 10 );
+	connection->sendRange( "dial", 11 );
+	connection->sendRange( "dial", 12 );
+	connection->send( Message( "dial", TYPE_RANGE, "8" ) );
+	connection->sendRange( "dial", 13 );
+	connection->send( Message( "dial", TYPE_RANGE, "14" ) );
+	connection->send( "dial", TYPE_RANGE, "16" );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "dial" ) == ( Values{ "10", "13", "16" } ) );
+
+	// rate limit: at most one value every 0.1s, the last one held back trails once it's up
+	setElapsedSeconds( 1 );
+	connection->sendRange( "fader", 1 );
+	connection->sendRange( "fader", 2 );
+	connection->send( Message( "fader", TYPE_RANGE, "3" ) );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ) == Values{ "1" } );
+	setElapsedSeconds( 1.05 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ).empty() );
+	setElapsedSeconds( 1.125 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ) == Values{ "3" } );
+	// the trailing send counts as a send, so the next value waits for an interval after it
+	setElapsedSeconds( 1.2 );
+	connection->send( Message( "fader", TYPE_RANGE, "4" ) );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ).empty() );
+	setElapsedSeconds( 1.25 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ) == Values{ "4" } );
+	// nothing held back, nothing trails
+	setElapsedSeconds( 2 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ).empty() );
+	connection->sendRange( "fader", 5 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "fader" ) == Values{ "5" } );
+
+	// heartbeat: the last value is repeated after a second without sends
+	setElapsedSeconds( 3 );
+	connection->sendString( "status", "ok" );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ) == Values{ "\"ok\"" } );
+	setElapsedSeconds( 3.5 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ).empty() );
+	setElapsedSeconds( 4 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ) == Values{ "\"ok\"" } );
+	// a new value restarts the interval and becomes the one repeated
+	setElapsedSeconds( 4.5 );
+	connection->send( Message( "status", TYPE_STRING, "busy" ) );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ) == Values{ "\"busy\"" } );
+	setElapsedSeconds( 5 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ).empty() );
+	setElapsedSeconds( 5.5 );
+	connection->update();
+	CHECK( getWrittenValues( *transport, "status" ) == Values{ "\"busy\"" } );
+	return 0;
+}
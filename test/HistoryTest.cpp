@@ -0,0 +1,130 @@
+// History: sampling with LINEAR and HOLD, read( from, to ), the ring wrapping around, and a
+// reader on another thread that must never see a sample half written while the ring fills
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace Spacebrew;
+using ci::app::setElapsedSeconds;
+
+namespace {
+
+std::vector<double> readTimes( const History &history, double from, double to )
+{
+	std::vector<History::Sample> samples;
+	history.read( from, to, samples );
+	std::vector<double> times;
+	for ( auto & sample : samples )
+		times.push_back( sample.time );
+	return times;
+}
+
+typedef std::vector<double> Times;
+
+}
+
+int main()
+{
+	CHECK( History::create( 5 )->getCapacity() == 8 && History::create( 0 )->getCapacity() == 2 );
+
+	// nothing received yet
+	auto history = History::create( 8 );
+	History::Sample latest;
+	CHECK( history->sample( 1, History::LINEAR, -1 ) == -1 && ! history->getLatest( latest ) );
+	CHECK( history->getSize() == 0 && readTimes( *history, 0, 10 ).empty() );
+
+	// sampling between, on, before and after the samples
+	history->push( 1, 10 );
+	history->push( 2, 20 );
+	history->push( 4, 40 );
+	CHECK( history->sample( 1.5 ) == 15 && history->sample( 3 ) == 30 && history->sample( 3.5 ) == 35 );
+	CHECK( history->sample( 1.5, History::HOLD ) == 10 && history->sample( 3.9, History::HOLD ) == 20 );
+	CHECK( history->sample( 2 ) == 20 && history->sample( 2, History::HOLD ) == 20 && history->sample( 4 ) == 40 );
+	CHECK( history->sample( 0 ) == 10 && history->sample( 0, History::HOLD ) == 10 );
+	CHECK( history->sample( 9 ) == 40 && history->sample( 9, History::HOLD ) == 40 );
+	CHECK( history->getLatest( latest ) && latest.time == 4 && latest.value == 40 );
+
+	// read() takes both ends
+	CHECK( readTimes( *history, 2, 4 ) == ( Times{ 2, 4 } ) );
+	CHECK( readTimes( *history, 1.5, 3.9 ) == Times{ 2 } );
+	CHECK( readTimes( *history, 0, 100 ) == ( Times{ 1, 2, 4 } ) );
+	CHECK( readTimes( *history, 5, 6 ).empty() && readTimes( *history, 3, 2 ).empty() );
+
+	// once full, the oldest samples make room
+	for ( int i = 5; i < 20; ++i )
+		history->push( i, i * 10 );
+	CHECK( history->getSize() == 8 );
+	CHECK( readTimes( *history, 0, 100 ) == ( Times{ 12, 13, 14, 15, 16, 17, 18, 19 } ) );
+	CHECK( history->sample( 1 ) == 120 && history->sample( 12.5 ) == 125 && history->sample( 30 ) == 190 );
+	CHECK( readTimes( *history, 17.5, 100 ) == ( Times{ 18, 19 } ) );
+	history->clear();
+	CHECK( history->getSize() == 0 && history->sample( 12, History::LINEAR, -1 ) == -1 );
+	history->push( 30, 300 );
+	CHECK( history->getLatest( latest ) && latest.time == 30 && readTimes( *history, 0, 100 ) == Times{ 30 } );
+
+	// a reader racing the writer: every sample has value == time and follows the one before, so
+	// a read that overlapped a push() shows. The ring is large enough that the reader is usually
+	// part way through one when its thread is preempted, even on a single core
+	const size_t capacity = 1024;
+	auto shared = History::create( capacity );
+	std::atomic<bool> done( false );
+	std::atomic<uint64_t> reads( 0 );
+	std::thread reader( [&] {
+		std::vector<History::Sample> samples;
+		while ( ! done ) {
+			History::Sample newest;
+			if ( shared->getLatest( newest ) ) {
+				CHECK( newest.value == newest.time );
+				// half way between two samples or, once the writer has pushed them out of the
+				// ring, the oldest sample left
+				double t = newest.time - 100.5;
+				double value = shared->sample( t );
+				CHECK( value == t || ( value > t && value == std::floor( value ) ) );
+				value = shared->sample( t, History::HOLD );
+				CHECK( value == std::floor( t ) || ( value > t && value == std::floor( value ) ) );
+			}
+			shared->read( 0, 1e18, samples );
+			CHECK( samples.size() <= capacity );
+			for ( size_t i = 0; i < samples.size(); ++i ) {
+				CHECK( samples[i].value == samples[i].time );
+				CHECK( i == 0 || samples[i].time == samples[i - 1].time + 1 );
+			}
+			++reads;
+		}
+	} );
+	auto start = std::chrono::steady_clock::now();
+	for ( double i = 0; reads < 100 || std::chrono::steady_clock::now() - start < std::chrono::milliseconds( 500 ); ++i )
+		shared->push( i, i );
+	done = true;
+	reader.join();
+
+	// through a Connection: range and boolean values are recorded when they arrive
+	auto connection = Connection::create( "localhost", "HistoryTest" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->addPublish( "dial", TYPE_RANGE, "0" );
+	connection->addSubscribe( "dial", TYPE_RANGE );
+	connection->addPublish( "switch", TYPE_BOOLEAN, "false" );
+	connection->addSubscribe( "switch", TYPE_BOOLEAN );
+	CHECK( ! connection->enableHistory( "missing", 16 ) );
+	auto dial = connection->enableHistory( "dial", 16 );
+	auto toggle = connection->enableHistory( "switch", 16 );
+	CHECK( dial && connection->enableHistory( "dial", 4 ) == dial && connection->getHistory( "dial" ) == dial );
+	connection->connect();
+	connection->update();
+	for ( int i = 1; i <= 3; ++i ) {
+		setElapsedSeconds( i );
+		connection->sendRange( "dial", i * 100 );
+		connection->sendBoolean( "switch", i % 2 == 1 );
+		connection->update();
+	}
+	setElapsedSeconds( 4 );
+	connection->update();
+	setElapsedSeconds( -1 );
+	CHECK( dial->getSize() == 3 && toggle->getSize() == 3 );
+	CHECK( dial->sample( 2.5 ) == 250 && toggle->sample( 2.5, History::HOLD ) == 0 && toggle->sample( 3.5 ) == 1 );
+	return 0;
+}
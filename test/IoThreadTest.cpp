@@ -0,0 +1,130 @@
+// The I/O thread: it sleeps until there's something to read, and immediate listeners run
+// without the connection's locks, so they can change the listeners and the main thread can send meanwhile
+#include "RecordingTransport.h"
+#include "Check.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Spacebrew;
+
+namespace {
+
+//! Spins the update loop until \a done, for a few seconds at most
+template<typename Fn>
+bool updateUntil( Connection &connection, const Fn &done )
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 5 );
+	while( ! done() ) {
+		if( std::chrono::steady_clock::now() > deadline )
+			return false;
+		connection.update();
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	return true;
+}
+
+//! Seconds \a wait blocks for while \a fn runs on another thread after a moment
+template<typename Fn>
+double timeWait( TransportWait &wait, const Fn &fn )
+{
+	std::thread other( [&] {
+		std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+		fn();
+	} );
+	auto start = std::chrono::steady_clock::now();
+	wait.wait( 5 );
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	other.join();
+	return seconds;
+}
+
+}
+
+int main()
+{
+	// wake() and a readable socket end a wait
+	{
+		TransportWait wait;
+		CHECK( timeWait( wait, [&] { wait.wake(); } ) < 1 );
+		int sockets[2];
+		CHECK( socketpair( AF_UNIX, SOCK_STREAM, 0, sockets ) == 0 );
+		wait.watch( &wait, sockets[0] );
+		// watch() wakes the wait that was going on
+		wait.wait( 5 );
+		CHECK( timeWait( wait, [&] { CHECK( write( sockets[1], "x", 1 ) == 1 ); } ) < 1 );
+		wait.unwatch( &wait );
+		close( sockets[0] );
+		close( sockets[1] );
+	}
+
+	auto connection = Connection::create( "localhost", "IoThreadTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	connection->addPublish( "out", TYPE_RANGE, "0" );
+	connection->addSubscribe( "trigger", TYPE_RANGE );
+	connection->addSubscribe( "later", TYPE_RANGE );
+	connection->addSubscribe( "wake", TYPE_RANGE );
+	connection->setIoThread( true );
+	connection->connect();
+	CHECK( updateUntil( *connection, [&] { return connection->isConnected(); } ) );
+
+	// idle, it only polls for websocketpp's timers, and wakes up as soon as a frame comes in
+	std::atomic<int> numWoken( 0 );
+	size_t woken = connection->addImmediateListener( "wake", [&]( const MessageView & ) { numWoken++; } );
+	uint64_t polls = transport->getNumPolls();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 300 ) );
+	CHECK( transport->getNumPolls() - polls <= 6 );
+	auto start = std::chrono::steady_clock::now();
+	transport->receive( makeMessageFrame( "wake", "range", "\"0\"" ) );
+	while( numWoken == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds( 5 ) )
+		std::this_thread::yield();
+	CHECK( numWoken == 1 );
+	CHECK( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( 50 ) );
+	connection->removeImmediateListener( woken );
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool isListening = false, hasSent = false;
+	std::atomic<bool> hasWaited( false );
+	std::atomic<int> numTriggers( 0 ), numLater( 0 );
+	size_t own = 0;
+	own = connection->addImmediateListener( "trigger", [&]( const MessageView & ) {
+		numTriggers++;
+		connection->removeImmediateListener( own );
+		connection->addImmediateListener( "later", [&]( const MessageView & ) { numLater++; } );
+
+		// the main thread sends while this runs, which takes the transport lock
+		std::unique_lock<std::mutex> lock( mutex );
+		isListening = true;
+		condition.notify_all();
+		hasWaited = condition.wait_for( lock, std::chrono::seconds( 5 ), [&] { return hasSent; } );
+	} );
+
+	transport->receive( makeMessageFrame( "trigger", "range", "\"1\"" ) );
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		CHECK( condition.wait_for( lock, std::chrono::seconds( 5 ), [&] { return isListening; } ) );
+	}
+	connection->sendRange( "out", 1 );
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		hasSent = true;
+	}
+	condition.notify_all();
+
+	// the first listener is gone, the one it added hears "later"
+	transport->receive( makeMessageFrame( "trigger", "range", "\"2\"" ) );
+	transport->receive( makeMessageFrame( "later", "range", "\"3\"" ) );
+	CHECK( updateUntil( *connection, [&] { return numLater == 1; } ) );
+	connection->setIoThread( false );
+	CHECK( hasWaited );
+	CHECK( numTriggers == 1 );
+	auto written = transport->getWritten();
+	CHECK( written.size() == 1 && getFrameName( written[0] ) == "out" );
+	return 0;
+}
@@ -0,0 +1,76 @@
+// Latest values across config changes: rebuilding the endpoints renumbers the subscribers, while
+// getLatest() and friends may be read from another thread and Subscriber<T> handles are kept
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace Spacebrew;
+
+namespace {
+
+Config makeConfig( const std::vector<std::string> &names )
+{
+	Config config( "LatestValuesTest", "" );
+	for ( auto & name : names ) {
+		config.addPublish( name, TYPE_RANGE, "0" );
+		config.addSubscribe( name, TYPE_RANGE );
+	}
+	return config;
+}
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "LatestValuesTest" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->connect( "localhost", makeConfig( { "a", "b" } ) );
+	connection->update();
+
+	auto b = connection->addSubscribe<Range>( "b", []( int ) {} );
+	CHECK( b.getId() == 1 );
+	connection->send( "a", TYPE_RANGE, "1" );
+	connection->send( "b", TYPE_RANGE, "2" );
+	connection->update();
+	int value = 0;
+	CHECK( connection->getLatest( b, value ) && value == 2 );
+
+	// "b" moves to the front and "a" takes its old id, the handle still reads "b"
+	connection->connect( "localhost", makeConfig( { "b", "a" } ) );
+	connection->update();
+	CHECK( connection->getLatest( b, value ) && value == 2 );
+	CHECK( connection->getLatest<Range>( "a", value ) && value == 1 );
+
+	// readers on another thread while the subscribers are added and replaced under them
+	std::atomic<bool> done( false );
+	std::atomic<uint64_t> reads( 0 );
+	std::thread reader( [&] {
+		std::vector<size_t> changed;
+		while ( ! done ) {
+			int a = 0;
+			if ( connection->getLatest<Range>( "a", a ) )
+				CHECK( a == 1 );
+			connection->getChangedSince( 0, changed );
+			connection->hasChangedSince( "b", 0 );
+			connection->isLatestStale( "a" );
+			++reads;
+		}
+	} );
+	for ( int round = 0; round < 200; ++round ) {
+		std::vector<std::string> names = { "a", "b" };
+		for ( int i = 0; i < 32; ++i )
+			names.push_back( "extra" + std::to_string( ( round + i ) % 48 ) );
+		connection->connect( "localhost", makeConfig( names ) );
+		connection->addSubscribe( "added" + std::to_string( round ), TYPE_RANGE );
+		connection->update();
+	}
+	// the reader made progress before the loop ended
+	while ( reads < 100 )
+		std::this_thread::yield();
+	done = true;
+	reader.join();
+	CHECK( connection->getLatest( b, value ) && value == 2 );
+	return 0;
+}
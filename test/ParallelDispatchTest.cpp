@@ -0,0 +1,52 @@
+// Parallel dispatch: subscription listeners run on the workers, onMessage stays on the update thread
+#include "RecordingTransport.h"
+#include "Check.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace Spacebrew;
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "ParallelDispatchTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+
+	std::thread::id mainThread = std::this_thread::get_id();
+	std::atomic<int> numWorkerCalls( 0 ), numWorkerCallsOnMain( 0 );
+	auto listener = [&]( int ) {
+		numWorkerCalls++;
+		if( std::this_thread::get_id() == mainThread )
+			numWorkerCallsOnMain++;
+	};
+	connection->addSubscribe<Range>( "a", listener );
+	connection->addSubscribe<Range>( "b", listener );
+
+	// not synchronized on purpose, the sanitizers catch it if onMessage runs on two threads at once
+	int numMessages = 0;
+	bool isOffMain = false;
+	connection->onMessage.connect( [&]( const Message & ) {
+		numMessages++;
+		isOffMain |= std::this_thread::get_id() != mainThread;
+	} );
+
+	connection->setParallelDispatch( true, 4 );
+	connection->connect();
+	connection->update();
+	for( int i = 0; i < 100; ++i ) {
+		transport->receive( makeMessageFrame( "a", "range", "\"" + std::to_string( i ) + "\"" ) );
+		transport->receive( makeMessageFrame( "b", "range", "\"" + std::to_string( i ) + "\"" ) );
+		// nobody subscribes to "c", onMessage still hears it
+		transport->receive( makeMessageFrame( "c", "range", "\"" + std::to_string( i ) + "\"" ) );
+		connection->update();
+	}
+
+	// joins the workers after they ran what's queued
+	connection->setParallelDispatch( false );
+	CHECK( numMessages == 300 );
+	CHECK( ! isOffMain );
+	CHECK( numWorkerCalls == 200 );
+	CHECK( numWorkerCallsOnMain == 0 );
+	return 0;
+}
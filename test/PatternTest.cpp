@@ -0,0 +1,101 @@
+// Name patterns: PatternIndex on its own, where * stays within one '/' separated segment, a
+// trailing ** takes the rest and prefixes are literal, then prefix and pattern listeners on a
+// Connection, including patterns added after the subscribers' matches were cached
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+std::vector<size_t> match( const PatternIndex &index, const std::string &name )
+{
+	std::vector<size_t> out;
+	index.match( name.data(), name.size(), out );
+	return out;
+}
+
+bool matches( const PatternIndex &index, size_t id, const std::string &name )
+{
+	auto ids = match( index, name );
+	return std::find( ids.begin(), ids.end(), id ) != ids.end();
+}
+
+typedef std::vector<std::string> Names;
+
+}
+
+int main()
+{
+	PatternIndex index;
+	size_t sensor = index.addPattern( "zone/sensor*" );
+	size_t temp = index.addPattern( "*/temp" );
+	size_t zone = index.addPattern( "zone/**" );
+	size_t everything = index.addPattern( "**" );
+	size_t abc = index.addPattern( "a*b**c" );
+	size_t exact = index.addPattern( "zone" );
+	size_t prefix = index.addPrefix( "x*" );
+	size_t starX = index.addPattern( "x*" );
+	CHECK( index.size() == 8 && prefix != starX );
+	CHECK( index.addPattern( "zone/sensor*" ) == sensor && index.addPrefix( "x*" ) == prefix );
+
+	// a single * matches any part of one segment, including none of it
+	CHECK( matches( index, sensor, "zone/sensor1" ) && matches( index, sensor, "zone/sensor" ) );
+	CHECK( ! matches( index, sensor, "zone/sensor1/x" ) && ! matches( index, sensor, "zone/xsensor" ) && ! matches( index, sensor, "zone/senso" ) );
+	CHECK( matches( index, temp, "a/temp" ) && matches( index, temp, "/temp" ) );
+	CHECK( ! matches( index, temp, "a/b/temp" ) && ! matches( index, temp, "temp" ) && ! matches( index, temp, "a/temp2" ) );
+	// stars in the middle of a pattern, and runs of them, stay in their segment too
+	CHECK( matches( index, abc, "abc" ) && matches( index, abc, "aXXbYYc" ) && matches( index, abc, "abbbc" ) );
+	CHECK( ! matches( index, abc, "a/bc" ) && ! matches( index, abc, "ab/c" ) );
+	// a trailing ** takes the rest of the name, separators and all
+	CHECK( matches( index, zone, "zone/" ) && matches( index, zone, "zone/a/b/c" ) );
+	CHECK( ! matches( index, zone, "zone" ) && ! matches( index, zone, "zones/a" ) );
+	CHECK( matches( index, everything, "" ) && matches( index, everything, "any/thing" ) );
+	CHECK( matches( index, exact, "zone" ) && ! matches( index, exact, "zone/" ) );
+	// prefixes are taken literally
+	CHECK( matches( index, prefix, "x*" ) && matches( index, prefix, "x*/y" ) && ! matches( index, prefix, "xy" ) );
+	CHECK( matches( index, starX, "xy" ) && matches( index, starX, "x*" ) && ! matches( index, starX, "x/y" ) );
+	// every id once, in ascending order, however many ways a name reaches it
+	CHECK( ( match( index, "zone/sensor1" ) == std::vector<size_t>{ sensor, zone, everything } ) );
+	CHECK( ( match( index, "abbbbbc" ) == std::vector<size_t>{ everything, abc } ) );
+
+	// listeners on a Connection
+	auto connection = Connection::create( "localhost", "PatternTest" );
+	auto transport = LoopbackTransport::create();
+	connection->setTransport( transport );
+	for ( const char *name : { "zone/sensor1", "zone/sensor2", "zone/light", "other" } ) {
+		connection->addPublish( name, TYPE_RANGE, "0" );
+		connection->addSubscribe( name, TYPE_RANGE );
+	}
+	connection->connect();
+	connection->update();
+
+	Names sensors, zones, lights;
+	auto sensorListener = connection->addPatternListener( "zone/sensor*", [&]( const Message &m ) { sensors.push_back( m.getName() ); } );
+	connection->addPrefixListener( "zone/", [&]( const Message &m ) { zones.push_back( m.getName() ); } );
+	for ( const char *name : { "zone/sensor1", "zone/sensor2", "zone/light", "other" } )
+		connection->sendRange( name, 1 );
+	// a name we don't subscribe to is matched too
+	transport->inject( "{\"message\":{\"clientName\":\"other\",\"name\":\"zone/sensor9\",\"type\":\"range\",\"value\":2}}" );
+	connection->update();
+	connection->update();
+	CHECK( sensors == ( Names{ "zone/sensor1", "zone/sensor2", "zone/sensor9" } ) );
+	CHECK( zones == ( Names{ "zone/sensor1", "zone/sensor2", "zone/light", "zone/sensor9" } ) );
+
+	// a pattern added once every subscriber's matches are cached still reaches them
+	connection->addPatternListener( "*/light", [&]( const Message &m ) { lights.push_back( m.getName() ); } );
+	// a disconnected listener hears nothing more, another on the same pattern does
+	sensorListener.disconnect();
+	Names sensorsAgain;
+	connection->addPatternListener( "zone/sensor*", [&]( const Message &m ) { sensorsAgain.push_back( m.getName() ); } );
+	sensors.clear();
+	zones.clear();
+	for ( const char *name : { "zone/sensor1", "zone/light", "other" } )
+		connection->sendRange( name, 3 );
+	connection->update();
+	connection->update();
+	CHECK( lights == Names{ "zone/light" } );
+	CHECK( sensors.empty() && sensorsAgain == Names{ "zone/sensor1" } );
+	CHECK( zones == ( Names{ "zone/sensor1", "zone/light" } ) );
+	return 0;
+}
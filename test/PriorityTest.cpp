@@ -0,0 +1,65 @@
+// Priority lanes across endpoint rebuilds: a publisher keeps its priority, and frames already
+// queued follow their publisher to its new id
+#include "RecordingTransport.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+//! "name=value" of the messages written since the last call
+std::vector<std::string> takeWritten( RecordingTransport &transport )
+{
+	std::vector<std::string> out;
+	for( auto &frame : transport.getWritten() )
+		out.push_back( getFrameName( frame ) + "=" + getFrameValue( frame ) );
+	transport.clearWritten();
+	return out;
+}
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "PriorityTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	connection->addPublish( "a", TYPE_RANGE, "0" );
+	connection->addPublish( "b", TYPE_RANGE, "0" );
+	connection->addPublish( "c", TYPE_RANGE, "0" );
+	connection->setPublishPriority( "b", Connection::PRIORITY_HIGH );
+	connection->connect();
+	connection->update();
+	connection->setMaxWritesPerUpdate( 1 );
+
+	// the same publishers in another order, "a" and "b" swap ids
+	Config reordered( "PriorityTest", "" );
+	reordered.addPublish( "b", TYPE_RANGE, "0" );
+	reordered.addPublish( "a", TYPE_RANGE, "0" );
+	reordered.addPublish( "c", TYPE_RANGE, "0" );
+
+	// queued before the rebuild: a and c in the normal lane, b in the high one
+	connection->update();
+	transport->clearWritten();
+	connection->sendRange( "c", 1 );
+	connection->sendRange( "a", 2 );
+	connection->sendRange( "c", 3 );
+	connection->sendRange( "b", 4 );
+	connection->connect( "localhost", reordered );
+	CHECK( takeWritten( *transport ) == std::vector<std::string>{ "c=1" } );
+
+	// "a" moves to the bulk lane by its new id, which used to be "b"'s
+	connection->setPublishPriority( "a", Connection::PRIORITY_BULK );
+	for( int i = 0; i < 4; ++i )
+		connection->update();
+	CHECK( ( takeWritten( *transport ) == std::vector<std::string>{ "b=4", "c=3", "a=2" } ) );
+
+	// "b" is still high priority after the rebuild
+	connection->sendRange( "c", 5 );
+	connection->sendRange( "c", 6 );
+	connection->sendRange( "b", 7 );
+	for( int i = 0; i < 3; ++i )
+		connection->update();
+	CHECK( ( takeWritten( *transport ) == std::vector<std::string>{ "c=5", "b=7", "c=6" } ) );
+	return 0;
+}
@@ -0,0 +1,63 @@
+// Publisher<T> handles across config changes: rebuilding the endpoints renumbers the publishers,
+// handles must follow theirs or refuse to send once it's gone
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "PublisherHandleTest" );
+	auto transport = LoopbackTransport::create();
+	connection->setTransport( transport );
+	std::vector<std::string> received;
+	connection->onMessage.connect( [&]( const Message &m ) { received.push_back( m.getName() + "=" + m.getRawValue() ); } );
+
+	auto a = connection->addPublish<Range>( "a" );
+	auto b = connection->addPublish<Range>( "b" );
+	connection->connect();
+	connection->update();
+	CHECK( a.getId() == 0 && b.getId() == 1 );
+
+	// a new config that drops "a" and "b" and moves nothing into their place
+	Config onlyZ( "PublisherHandleTest", "" );
+	onlyZ.addPublish( "z", TYPE_RANGE, "0" );
+	onlyZ.addSubscribe( "z", TYPE_RANGE );
+	connection->connect( "localhost", onlyZ );
+	connection->update();
+	CHECK( a.getId() == UNKNOWN_ENDPOINT && b.getId() == UNKNOWN_ENDPOINT );
+	uint64_t written = transport->getNumWritten();
+	b.send( 5 );
+	connection->update();
+	CHECK( transport->getNumWritten() == written );
+
+	// "b" comes back at another position, the old handle finds it
+	Config withB( "PublisherHandleTest", "" );
+	withB.addPublish( "z", TYPE_RANGE, "0" );
+	withB.addPublish( "b", TYPE_RANGE, "0" );
+	withB.addSubscribe( "z", TYPE_RANGE );
+	withB.addSubscribe( "b", TYPE_RANGE );
+	connection->connect( "localhost", withB );
+	connection->update();
+	CHECK( b.getId() == 1 && b.getName() == "b" );
+	auto z = connection->addPublish<Range>( "z" );
+	CHECK( z.getId() == 0 );
+	received.clear();
+	b.send( 7 );
+	z.send( 3 );
+	connection->update();
+	CHECK( received.size() == 2 && received[0] == "b=7" && received[1] == "z=3" );
+
+	// a handle of the same name but another type stays refused
+	auto bString = connection->addPublish<String>( "b" );
+	CHECK( bString.getId() != b.getId() );
+
+	// a default constructed handle has no publisher and sends nothing
+	Publisher<Range> unset;
+	CHECK( ! unset.isValid() && unset.getId() == UNKNOWN_ENDPOINT && unset.getName().empty() );
+	written = transport->getNumWritten();
+	unset.send( 1 );
+	connection->update();
+	CHECK( transport->getNumWritten() == written );
+	return 0;
+}
@@ -0,0 +1,131 @@
+// Benchmark of the receive path that doubles as a test: once warmed up, reading frames and
+// dispatching them to listeners must not allocate. Counts every operator new in the process.
+// The onMessageBatch listener checks its columns against what onMessage saw during the update.
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> sNumAllocations( 0 );
+
+}
+
+void* operator new( size_t size )
+{
+	sNumAllocations++;
+	if( void *p = std::malloc( size ? size : 1 ) )
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete( void *p ) noexcept
+{
+	std::free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept
+{
+	std::free( p );
+}
+
+using namespace Spacebrew;
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "ReceiveAllocationTest" );
+	auto transport = LoopbackTransport::create();
+	transport->setEcho( false );
+	connection->setTransport( transport );
+	connection->addSubscribe( "level", TYPE_RANGE );
+	connection->addSubscribe( "chat", TYPE_STRING );
+	connection->addSubscribe( "on", TYPE_BOOLEAN );
+	connection->addSubscribe( "levels", TYPE_RANGE_ARRAY );
+	uint64_t sum = 0, numMessages = 0;
+	connection->onMessage.connect( [&]( const Message &m ) { sum += m.getRawValue().size(); } );
+
+	// the messages of the current update() as onMessage delivered them, cleared by the batch
+	// listener once compared; the buffers keep their capacity, so this allocates nothing either
+	std::vector<size_t> streamIds;
+	std::vector<float> streamValues;
+	std::string streamRaw;
+	std::vector<size_t> streamOffsets;
+	uint64_t numBatches = 0, batchedMessages = 0;
+	connection->onMessage.connect( [&]( const Message &m ) {
+		++numMessages;
+		streamIds.push_back( m.getEndpointId() );
+		if ( m.getType() == TYPE_RANGE )
+			streamValues.push_back( static_cast<float>( m.valueAsRange() ) );
+		else if ( m.getType() == TYPE_BOOLEAN )
+			streamValues.push_back( m.valueAsBoolean() ? 1.0f : 0.0f );
+		else
+			streamValues.push_back( std::numeric_limits<float>::quiet_NaN() );
+		streamOffsets.push_back( streamRaw.size() );
+		streamRaw += m.getRawValue();
+	} );
+	connection->onMessageBatch.connect( [&]( const MessageBatch &batch ) {
+		++numBatches;
+		batchedMessages += batch.size();
+		CHECK( batch.size() == streamIds.size() && batch.times.size() == batch.size() && batch.values.size() == batch.size() );
+		CHECK( batch.endpointIds == streamIds );
+		for ( size_t i = 0; i < batch.size(); ++i ) {
+			// arrays and strings have no single value
+			CHECK( batch.values[i] == streamValues[i] || ( std::isnan( batch.values[i] ) && std::isnan( streamValues[i] ) ) );
+			size_t end = i + 1 < batch.size() ? streamOffsets[i + 1] : streamRaw.size();
+			CHECK( batch.getRawValue( i ) == StringView( streamRaw.data() + streamOffsets[i], end - streamOffsets[i] ) );
+			CHECK( i == 0 || batch.times[i] >= batch.times[i - 1] );
+		}
+		streamIds.clear();
+		streamValues.clear();
+		streamRaw.clear();
+		streamOffsets.clear();
+	} );
+	connection->connect();
+	connection->update();
+	CHECK( connection->isConnected() );
+
+	const std::vector<std::string> frames = {
+		"{\"message\":{\"clientName\":\"sender\",\"name\":\"level\",\"type\":\"range\",\"value\":512,\"remoteAddress\":\"127.0.0.1\"}}",
+		"{\"message\":{\"clientName\":\"sender\",\"name\":\"chat\",\"type\":\"string\",\"value\":\"a \\\"quoted\\\" line that is long enough not to fit any small string buffer\",\"remoteAddress\":\"127.0.0.1\"}}",
+		"[{\"message\":{\"clientName\":\"sender\",\"name\":\"level\",\"type\":\"range\",\"value\":\"7\"}},{\"message\":{\"clientName\":\"sender\",\"name\":\"chat\",\"type\":\"string\",\"value\":\"hi\"}}]",
+		"{\"message\":{\"clientName\":\"sender\",\"name\":\"on\",\"type\":\"boolean\",\"value\":\"true\"}}",
+		"{\"message\":{\"clientName\":\"sender\",\"name\":\"levels\",\"type\":\"range_array\",\"value\":[1,1023,512]}}"
+	};
+	const int framesPerUpdate = 64, updates = 2000;
+	auto receive = [&]( int count ) {
+		for( int i = 0; i < count; ++i ) {
+			for( int j = 0; j < framesPerUpdate; ++j )
+				transport->inject( frames[j % frames.size()] );
+			connection->update();
+		}
+	};
+
+	// pools and buffers grow to what the load needs
+	receive( 10 );
+
+	CHECK( numBatches == 10 && batchedMessages == numMessages );
+	CHECK( streamIds.empty() );
+
+	uint64_t messagesBefore = numMessages;
+	uint64_t allocationsBefore = sNumAllocations;
+	uint64_t poolAllocationsBefore = connection->getStats().receiveAllocations;
+	auto start = std::chrono::steady_clock::now();
+	receive( updates );
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	uint64_t allocations = sNumAllocations - allocationsBefore;
+
+	double messages = double( numMessages - messagesBefore );
+	std::cout << messages / seconds / 1e6 << " M messages/s, " << allocations << " allocations, "
+			  << connection->getStats().receiveAllocations - poolAllocationsBefore << " counted by the pool" << std::endl;
+	CHECK( sum > 0 );
+	CHECK( numBatches == 10 + updates && batchedMessages == numMessages );
+	CHECK( allocations == 0 );
+	CHECK( connection->getStats().receiveAllocations == poolAllocationsBefore );
+	return 0;
+}
@@ -0,0 +1,139 @@
+// Transport for the tests: keeps every frame written, and delivers frames pushed with receive()
+// on the next poll(). Opens on the first poll() after connect() unless held, and connecting again
+// while open keeps the link, like a websocket that is already up. Counts its polls and connects.
+#pragma once
+
+#include "ciSpaceBrew.h"
+
+#include <atomic>
+#include <mutex>
+
+class RecordingTransport : public Spacebrew::Transport {
+  public:
+	void connect( const std::string &url ) override
+	{
+		mUrl = url;
+		mNumConnects++;
+		if( ! mIsOpen )
+			mIsOpening = true;
+		mWait->wake();
+	}
+
+	void disconnect() override
+	{
+		mIsOpening = false;
+		if( mIsOpen ) {
+			mIsOpen = false;
+			handleClose();
+		}
+	}
+
+	void write( const std::string &frame ) override
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mWritten.push_back( frame );
+	}
+
+	void poll() override
+	{
+		mNumPolls++;
+		if( mIsOpening && ! mFailure.empty() ) {
+			mIsOpening = false;
+			std::string error;
+			error.swap( mFailure );
+			handleFail( error );
+		}
+		if( mIsOpening && ! mIsHeld ) {
+			mIsOpening = false;
+			mIsOpen = true;
+			handleOpen();
+		}
+		if( mIsDropping ) {
+			mIsDropping = false;
+			if( mIsOpen ) {
+				mIsOpen = false;
+				handleClose();
+			}
+		}
+		std::vector<std::string> frames;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			frames.swap( mReceived );
+		}
+		for( auto &frame : frames )
+			handleMessage( frame );
+	}
+
+	//! Queues \a frame for the next poll(), callable from any thread
+	void receive( const std::string &frame )
+	{
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mReceived.push_back( frame );
+		}
+		mWait->wake();
+	}
+
+	//! Keeps the next connect() pending until open() or fail()
+	void hold() { mIsHeld = true; }
+	//! Lets a held connect() open on the next poll()
+	void open() { mIsHeld = false; mWait->wake(); }
+	//! Fails a pending connect() on the next poll()
+	void fail( const std::string &error ) { mFailure = error; mWait->wake(); }
+	//! Closes an open link on the next poll(), as if the server went away
+	void drop() { mIsDropping = true; mWait->wake(); }
+
+	bool isOpen() const { return mIsOpen; }
+	bool isPending() const { return mIsOpening; }
+	uint64_t getNumPolls() const { return mNumPolls; }
+	uint64_t getNumConnects() const { return mNumConnects; }
+	//! Url of the last connect()
+	const std::string& getUrl() const { return mUrl; }
+
+	//! Frames written so far, message frames only when \a messagesOnly
+	std::vector<std::string> getWritten( bool messagesOnly = true )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		std::vector<std::string> written;
+		for( auto &frame : mWritten ) {
+			if( ! messagesOnly || frame.compare( 0, 11, "{\"message\":" ) == 0 )
+				written.push_back( frame );
+		}
+		return written;
+	}
+
+	void clearWritten()
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mWritten.clear();
+	}
+
+  private:
+	bool						mIsOpen = false, mIsOpening = false, mIsHeld = false, mIsDropping = false;
+	std::string					mUrl, mFailure;
+	std::atomic<uint64_t>		mNumPolls{ 0 };
+	uint64_t					mNumConnects = 0;
+	std::mutex					mMutex;
+	std::vector<std::string>	mWritten, mReceived;
+};
+
+//! A message frame as the server would deliver it
+inline std::string makeMessageFrame( const std::string &name, const std::string &type, const std::string &value, const std::string &clientName = "sender" )
+{
+	return "{\"message\":{\"clientName\":\"" + clientName + "\",\"name\":\"" + name + "\",\"type\":\"" + type + "\",\"value\":" + value + "}}";
+}
+
+//! Value of a message frame written by the Connection
+inline std::string getFrameValue( const std::string &frame )
+{
+	size_t begin = frame.find( "\"value\":" ) + 8;
+	size_t end = frame.find_first_of( ",}", begin );
+	return frame.substr( begin, end - begin );
+}
+
+//! Name of a message frame written by the Connection
+inline std::string getFrameName( const std::string &frame )
+{
+	size_t begin = frame.find( "\"name\":\"" ) + 8;
+	return frame.substr( begin, frame.find( '"', begin ) - begin );
+}
@@ -0,0 +1,55 @@
+// Replaying captures, including one whose first record claims more bytes than the file holds
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+#include <cstdio>
+#include <fstream>
+
+using namespace Spacebrew;
+
+namespace {
+
+const char *sPath = "ReplayerTest.capture";
+
+size_t replayAll()
+{
+	auto connection = Connection::create( "localhost", "ReplayerTest" );
+	connection->setTransport( LoopbackTransport::create() );
+	connection->addSubscribe( "level", TYPE_RANGE );
+	size_t received = 0;
+	connection->onMessage.connect( [&]( const Message & ) { received++; } );
+
+	auto replayer = Replayer::create( sPath );
+	CHECK( replayer );
+	size_t replayed = replayer->replayAll( *connection );
+	CHECK( replayed == received );
+	return replayed;
+}
+
+}
+
+int main()
+{
+	{
+		auto recorder = Recorder::create( sPath );
+		CHECK( recorder );
+		recorder->record( Recorder::INBOUND, "{\"message\":{\"clientName\":\"a\",\"name\":\"level\",\"type\":\"range\",\"value\":1}}" );
+		recorder->record( Recorder::OUTBOUND, "{\"config\":{}}" );
+		recorder->record( Recorder::INBOUND, "{\"message\":{\"clientName\":\"a\",\"name\":\"level\",\"type\":\"range\",\"value\":2}}" );
+		recorder->close();
+	}
+	CHECK( replayAll() == 2 );
+
+	// the first record follows the 16 byte file header, its length field 8 bytes into it
+	{
+		std::fstream file( sPath, std::ios::in | std::ios::out | std::ios::binary );
+		CHECK( file.good() );
+		uint32_t length = 0x7fffffff;
+		file.seekp( 16 + 8 );
+		file.write( reinterpret_cast<const char*>( &length ), sizeof( length ) );
+	}
+	CHECK( replayAll() == 0 );
+
+	std::remove( sPath );
+	return 0;
+}
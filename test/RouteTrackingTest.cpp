@@ -0,0 +1,102 @@
+// Route tracking: sends on publishers nobody is routed to are skipped, but only once the server's
+// reply to the registration, the configs and then the routes, has been applied
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+std::string makeConfigFrame( const std::string &clientName )
+{
+	return "{\"config\":{\"name\":\"" + clientName + "\",\"description\":\"\",\"publish\":{\"messages\":[]},"
+		"\"subscribe\":{\"messages\":[{\"name\":\"level\",\"type\":\"range\"}]},\"remoteAddress\":\"10.0.0.2\"}}";
+}
+
+std::string makeRouteFrame( const std::string &type, const std::string &publisher )
+{
+	return "{\"route\":{\"type\":\"" + type + "\","
+		"\"publisher\":{\"clientName\":\"RouteTrackingTest\",\"name\":\"" + publisher + "\",\"type\":\"range\",\"remoteAddress\":\"10.0.0.1\"},"
+		"\"subscriber\":{\"clientName\":\"other\",\"name\":\"level\",\"type\":\"range\",\"remoteAddress\":\"10.0.0.2\"}}}";
+}
+
+std::vector<std::string> getWrittenNames( RecordingTransport &transport )
+{
+	std::vector<std::string> names;
+	for ( auto & frame : transport.getWritten() )
+		names.push_back( getFrameName( frame ) );
+	transport.clearWritten();
+	return names;
+}
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "RouteTrackingTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	Config config( "RouteTrackingTest", "" );
+	config.addPublish( "light", TYPE_RANGE, "0" );
+	config.addPublish( "dark", TYPE_RANGE, "0" );
+	config.addSubscribe( "input", TYPE_STRING );
+	connection->setRouteTracking( true );
+	connection->connect( "localhost", config );
+	connection->update();
+	bool isRegistered = false;
+	for ( auto & frame : transport->getWritten( false ) )
+		isRegistered = isRegistered || frame.find( "\"admin\":true" ) != std::string::npos;
+	CHECK( isRegistered );
+	transport->clearWritten();
+
+	// nothing is known about routes yet, everything goes out
+	connection->sendRange( "dark", 1 );
+	connection->update();
+	CHECK( getWrittenNames( *transport ) == std::vector<std::string>{ "dark" } );
+
+	// a listener sending between the configs and the routes of the reply isn't cut off
+	connection->onMessage.connect( [&]( const Message &m ) {
+		if ( m.getName() == "input" ) {
+			connection->sendRange( "light", 2 );
+			connection->sendRange( "dark", 2 );
+		}
+	} );
+	transport->receive( "[" + makeConfigFrame( "RouteTrackingTest" ) + "," + makeConfigFrame( "other" ) + "]" );
+	transport->receive( makeMessageFrame( "input", TYPE_STRING, "\"go\"" ) );
+	transport->receive( "[" + makeRouteFrame( "add", "light" ) + "]" );
+	connection->update();
+	CHECK( getWrittenNames( *transport ) == ( std::vector<std::string>{ "light", "dark" } ) );
+	CHECK( connection->getStats().sendsSuppressed == 0 );
+	CHECK( connection->hasRoutes( "light" ) && ! connection->hasRoutes( "dark" ) );
+
+	// from the next update on, every way of sending skips the unrouted publisher
+	connection->sendRange( "light", 3 );
+	connection->sendRange( "dark", 3 );
+	connection->send( "dark", TYPE_RANGE, "3" );
+	connection->send( Message( "dark", TYPE_RANGE, "3" ) );
+	Message dark( "dark", TYPE_RANGE, "3" );
+	connection->send( &dark );
+	connection->update();
+	CHECK( getWrittenNames( *transport ) == std::vector<std::string>{ "light" } );
+	CHECK( connection->getStats().sendsSuppressed == 4 );
+
+	// a route removed later stops the sends right away
+	transport->receive( makeRouteFrame( "remove", "light" ) );
+	connection->update();
+	connection->sendRange( "light", 4 );
+	connection->update();
+	CHECK( getWrittenNames( *transport ).empty() );
+	CHECK( connection->getStats().sendsSuppressed == 5 );
+
+	// a new link starts over until the server replies again
+	transport->disconnect();
+	connection->update();
+	connection->connect();
+	connection->update();
+	transport->clearWritten();
+	connection->sendRange( "dark", 5 );
+	connection->update();
+	CHECK( getWrittenNames( *transport ) == std::vector<std::string>{ "dark" } );
+	return 0;
+}
@@ -0,0 +1,124 @@
+// Schemas: schemaIndex() at compile time, endpoint ids that are schema rows for the schema's
+// subscribers and lie past the table for any added later, a config passed to connect() replacing
+// the schema, and subscriber lookups telling apart names whose FNV-1a hashes are equal
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+#include <map>
+
+using namespace Spacebrew;
+
+namespace {
+
+constexpr SchemaEntry kSchema[] = {
+	{ SchemaEntry::PUBLISH,   "red",        "range",   "0" },
+	{ SchemaEntry::SUBSCRIBE, "start",      "boolean", "false" },
+	{ SchemaEntry::SUBSCRIBE, "costarring", "string",  "" },
+	{ SchemaEntry::PUBLISH,   "start",      "boolean", "false" },
+	{ SchemaEntry::SUBSCRIBE, "liquid",     "string",  "" },
+};
+
+constexpr size_t START = schemaIndex( kSchema, "start" );
+constexpr size_t COSTARRING = schemaIndex( kSchema, "costarring" );
+constexpr size_t LIQUID = schemaIndex( kSchema, "liquid" );
+
+static_assert( START == 1 && COSTARRING == 2 && LIQUID == 4, "subscribers are found by their row" );
+static_assert( schemaIndex( kSchema, "start", SchemaEntry::PUBLISH ) == 3, "publishers are found apart from subscribers" );
+static_assert( schemaIndex( kSchema, "red" ) == 5 && schemaIndex( kSchema, "blue", SchemaEntry::PUBLISH ) == 5, "missing names give the table size" );
+
+//! FNV-1a as Connection hashes names, to show the pairs below really collide
+uint32_t fnv1a( const std::string &name )
+{
+	uint32_t hash = 2166136261u;
+	for ( unsigned char c : name )
+		hash = ( hash ^ c ) * 16777619u;
+	return hash;
+}
+
+typedef std::map<std::string, size_t> EndpointIds;
+
+//! Endpoint id each name in \a names arrives with
+EndpointIds receive( Connection &connection, RecordingTransport &transport, const std::vector<std::string> &names )
+{
+	EndpointIds ids;
+	auto listener = connection.onMessageView.connect( [&]( const MessageView &view ) {
+		ids[std::string( view.getName().data(), view.getName().size() )] = view.getEndpointId();
+	} );
+	for ( auto & name : names )
+		transport.receive( makeMessageFrame( name, TYPE_STRING, "\"" + name + " value\"" ) );
+	connection.update();
+	listener.disconnect();
+	return ids;
+}
+
+std::string getConfigFrame( RecordingTransport &transport )
+{
+	std::string config;
+	for ( auto & frame : transport.getWritten( false ) ) {
+		if ( frame.compare( 0, 10, "{\"config\":" ) == 0 )
+			config = frame;
+	}
+	return config;
+}
+
+bool hasSubscriber( const std::string &config, const std::string &name )
+{
+	Json::Value json;
+	Json::Reader reader;
+	CHECK( reader.parse( config, json ) );
+	for ( auto & sub : json["config"]["subscribe"]["messages"] ) {
+		if ( sub["name"].asString() == name )
+			return true;
+	}
+	return false;
+}
+
+}
+
+int main()
+{
+	CHECK( fnv1a( "costarring" ) == fnv1a( "liquid" ) && fnv1a( "declinate" ) == fnv1a( "macallums" ) );
+
+	auto connection = Connection::create( "localhost", "SchemaTest" );
+	auto transport = std::make_shared<RecordingTransport>();
+	connection->setTransport( transport );
+	connection->setSchema( kSchema );
+	// added after the schema, and colliding with each other as well
+	connection->addSubscribe( "declinate", TYPE_STRING );
+	connection->addSubscribe( "macallums", TYPE_STRING );
+	connection->connect();
+	connection->update();
+	CHECK( connection->isConnected() );
+	std::string config = getConfigFrame( *transport );
+	CHECK( hasSubscriber( config, "start" ) && hasSubscriber( config, "liquid" ) && hasSubscriber( config, "macallums" ) );
+
+	// schema rows for the schema's subscribers, ids past the table for the others
+	auto ids = receive( *connection, *transport, { "start", "costarring", "liquid", "declinate", "macallums", "unknown" } );
+	CHECK( ids["start"] == START && ids["costarring"] == COSTARRING && ids["liquid"] == LIQUID );
+	CHECK( ids["declinate"] >= 5 && ids["macallums"] >= 5 && ids["declinate"] != ids["macallums"] );
+	CHECK( ids["unknown"] == UNKNOWN_ENDPOINT );
+	// names with equal hashes keep their own values
+	std::string value;
+	CHECK( connection->getLatest<String>( "costarring", value ) && value == "costarring value" );
+	CHECK( connection->getLatest<String>( "liquid", value ) && value == "liquid value" );
+	CHECK( connection->getLatest<String>( "macallums", value ) && value == "macallums value" );
+	CHECK( ! connection->getLatest<String>( "zinke", value ) );
+
+	// a config of its own replaces the schema, and ids follow the order subscribers were added in
+	Config replacement( "SchemaTest", "" );
+	replacement.addSubscribe( "liquid", TYPE_STRING );
+	replacement.addSubscribe( "other", TYPE_STRING );
+	replacement.addSubscribe( "costarring", TYPE_STRING );
+	transport->drop();
+	connection->update();
+	transport->clearWritten();
+	connection->connect( "localhost", replacement );
+	connection->update();
+	config = getConfigFrame( *transport );
+	CHECK( hasSubscriber( config, "liquid" ) && hasSubscriber( config, "other" ) && ! hasSubscriber( config, "start" ) );
+	ids = receive( *connection, *transport, { "start", "liquid", "other", "costarring" } );
+	CHECK( ids["liquid"] == 0 && ids["other"] == 1 && ids["costarring"] == 2 );
+	CHECK( ids["start"] == UNKNOWN_ENDPOINT );
+	return 0;
+}
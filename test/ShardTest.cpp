@@ -0,0 +1,99 @@
+// Publisher shards: each shard registers its publishers under a client name of its own, its
+// messages leave with that name on its own socket, and what every socket receives is
+// dispatched together
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+//! The config frames written, which are the frames that aren't messages
+std::vector<std::string> getConfigs( RecordingTransport &transport )
+{
+	std::vector<std::string> configs;
+	for ( auto & frame : transport.getWritten( false ) ) {
+		if ( frame.find( "\"config\":" ) != std::string::npos )
+			configs.push_back( frame );
+	}
+	return configs;
+}
+
+bool contains( const std::string &frame, const std::string &text )
+{
+	return frame.find( text ) != std::string::npos;
+}
+
+//! Client name of a message frame written by the Connection
+std::string getFrameClient( const std::string &frame )
+{
+	size_t begin = frame.find( "\"clientName\":\"" ) + 14;
+	return frame.substr( begin, frame.find( '"', begin ) - begin );
+}
+
+}
+
+int main()
+{
+	auto connection = Connection::create( "localhost", "ShardTest" );
+	auto main = std::make_shared<RecordingTransport>();
+	std::shared_ptr<RecordingTransport> shard;
+	connection->setTransport( main );
+	connection->setShardTransportFactory( [&]() {
+		shard = std::make_shared<RecordingTransport>();
+		return shard;
+	} );
+
+	Config config( "ShardTest", "" );
+	config.addPublish( "light", TYPE_RANGE, "0" );
+	config.addPublish( "camera", TYPE_STRING, "" );
+	config.addSubscribe( "input", TYPE_STRING );
+	connection->setPublisherShard( "camera", 1 );
+	CHECK( shard && connection->getNumShards() == 2 );
+	connection->connect( "localhost", config );
+	// the main connection opens, then the shard it connects
+	connection->update();
+	connection->update();
+	CHECK( connection->isShardConnected( 0 ) && connection->isShardConnected( 1 ) );
+
+	// the main client keeps the subscribers and the other publishers, the shard only has its own
+	auto mainConfigs = getConfigs( *main );
+	auto shardConfigs = getConfigs( *shard );
+	CHECK( ! mainConfigs.empty() && ! shardConfigs.empty() );
+	const std::string &mainConfig = mainConfigs.back(), &shardConfig = shardConfigs.back();
+	CHECK( contains( mainConfig, "\"name\": \"ShardTest\"" ) );
+	CHECK( contains( mainConfig, "\"light\"" ) && contains( mainConfig, "\"input\"" ) && ! contains( mainConfig, "\"camera\"" ) );
+	CHECK( contains( shardConfig, "\"name\": \"ShardTest#1\"" ) );
+	CHECK( contains( shardConfig, "\"camera\"" ) && ! contains( shardConfig, "\"light\"" ) && ! contains( shardConfig, "\"input\"" ) );
+
+	// every way of sending leaves on the publisher's socket under its client's name
+	main->clearWritten();
+	shard->clearWritten();
+	connection->sendRange( "light", 1 );
+	connection->sendString( "camera", "a" );
+	connection->send( "camera", TYPE_STRING, "b" );
+	connection->send( Message( "camera", TYPE_STRING, "c" ) );
+	Message message( "camera", TYPE_STRING, "d" );
+	connection->send( &message );
+	connection->update();
+	auto mainWritten = main->getWritten();
+	auto shardWritten = shard->getWritten();
+	CHECK( mainWritten.size() == 1 && getFrameName( mainWritten[0] ) == "light" && getFrameClient( mainWritten[0] ) == "ShardTest" );
+	CHECK( shardWritten.size() == 4 );
+	const char *values[] = { "\"a\"", "\"b\"", "\"c\"", "\"d\"" };
+	for ( size_t i = 0; i < shardWritten.size(); ++i ) {
+		CHECK( getFrameName( shardWritten[i] ) == "camera" && getFrameClient( shardWritten[i] ) == "ShardTest#1" );
+		CHECK( getFrameValue( shardWritten[i] ) == values[i] );
+	}
+
+	// messages arriving on either socket reach the same listeners
+	std::vector<std::string> received;
+	connection->onMessage.connect( [&]( const Message &m ) { received.push_back( m.getRawValue() ); } );
+	main->receive( makeMessageFrame( "input", TYPE_STRING, "\"main\"" ) );
+	shard->receive( makeMessageFrame( "input", TYPE_STRING, "\"shard\"" ) );
+	connection->update();
+	CHECK( received.size() == 2 );
+	CHECK( ( received[0] == "main" && received[1] == "shard" ) || ( received[0] == "shard" && received[1] == "main" ) );
+	return 0;
+}
@@ -0,0 +1,105 @@
+// Shared memory inboxes, in particular writing to a peer that isn't running mustn't create its inbox,
+// and a slot with a corrupt length mustn't be read past
+#include "ciSpaceBrew.h"
+#include "Check.h"
+#include "RecordingTransport.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace Spacebrew;
+
+namespace {
+
+std::vector<std::string> listFiles( const std::string &directory )
+{
+	std::vector<std::string> files;
+	DIR *dir = opendir( directory.c_str() );
+	CHECK( dir );
+	while ( dirent *entry = readdir( dir ) ) {
+		std::string name = entry->d_name;
+		if ( name != "." && name != ".." )
+			files.push_back( name );
+	}
+	closedir( dir );
+	return files;
+}
+
+//! Overwrites the length of the slot holding \a frame in the inbox at \a path. A slot is its
+//! 64 bit sequence and 32 bit length, padded to 16 bytes, followed by the frame.
+void corruptLength( const std::string &path, const std::string &frame, uint32_t length )
+{
+	std::ifstream file( path, std::ios::binary );
+	std::string contents( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
+	size_t offset = contents.find( frame );
+	CHECK( offset != std::string::npos && offset >= 8 );
+	uint32_t written;
+	memcpy( &written, contents.data() + offset - 8, sizeof( written ) );
+	CHECK( written == frame.size() );
+
+	int fd = open( path.c_str(), O_WRONLY );
+	CHECK( fd >= 0 );
+	CHECK( pwrite( fd, &length, sizeof( length ), offset - 8 ) == sizeof( length ) );
+	close( fd );
+}
+
+Route localRoute( const std::string &subscriberClient )
+{
+	Route route;
+	route.publisher = { "sender", "level", "range", "10.0.0.1" };
+	route.subscriber = { subscriberClient, "level", "range", "10.0.0.1" };
+	return route;
+}
+
+}
+
+int main()
+{
+	char directory[] = "/tmp/SharedMemoryTest-XXXXXX";
+	CHECK( mkdtemp( directory ) );
+
+	{
+		SharedMemoryTransportRef sender = SharedMemoryTransport::create( "sender", LoopbackTransport::create(), directory );
+		sender->connect( "" );
+		CHECK( listFiles( directory ).size() == 1 );
+
+		// nobody runs "absent", the message goes through the server and no inbox shows up for it
+		sender->setRoutes( { localRoute( "absent" ) } );
+		sender->write( makeMessageFrame( "level", "range", "\"1\"" ) );
+		CHECK( sender->getNumLocalWrites() == 0 );
+		CHECK( listFiles( directory ).size() == 1 );
+
+		// a running peer still gets it locally
+		SharedMemoryTransportRef receiver = SharedMemoryTransport::create( "receiver", LoopbackTransport::create(), directory );
+		receiver->connect( "" );
+		sender->setRoutes( { localRoute( "receiver" ) } );
+		sender->write( makeMessageFrame( "level", "range", "\"2\"" ) );
+		CHECK( sender->getNumLocalWrites() == 1 );
+		receiver->poll();
+		CHECK( receiver->getNumLocalReads() == 1 );
+
+		// a length past the slot, as left by a peer that died while writing, is dropped and skipped
+		std::string inbox;
+		for ( auto & name : listFiles( directory ) ) {
+			if ( name.find( "spacebrew-receiver-" ) == 0 )
+				inbox = std::string( directory ) + "/" + name;
+		}
+		CHECK( ! inbox.empty() );
+		std::string corrupt = makeMessageFrame( "level", "range", "\"3\"" );
+		sender->write( corrupt );
+		corruptLength( inbox, corrupt, 0xffffffff );
+		sender->write( makeMessageFrame( "level", "range", "\"4\"" ) );
+		receiver->poll();
+		CHECK( receiver->getNumDropped() == 1 );
+		CHECK( receiver->getNumLocalReads() == 2 );
+	}
+
+	CHECK( listFiles( directory ).empty() );
+	CHECK( rmdir( directory ) == 0 );
+	return 0;
+}
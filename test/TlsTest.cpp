@@ -0,0 +1,92 @@
+// wss:// against a local server with the self-signed certificate in tls/: the first connection
+// makes a full handshake, and the one after the server dropped it resumes the session
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+// older Boost.Asio uses std::exchange in C++20 without including it
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <atomic>
+#include <thread>
+
+using namespace Spacebrew;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+namespace {
+
+//! Updates \a connection until \a done returns true, or fails after a while
+template<typename Fn>
+void updateUntil( const ConnectionRef &connection, Fn done )
+{
+	auto start = std::chrono::steady_clock::now();
+	while ( ! done() ) {
+		CHECK( std::chrono::steady_clock::now() - start < std::chrono::seconds( 10 ) );
+		connection->update();
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+}
+
+}
+
+int main( int argc, char *argv[] )
+{
+	CHECK( argc == 2 );
+	std::string directory = argv[1];
+
+	asio::io_context io;
+	asio::ssl::context context( asio::ssl::context::tls_server );
+	context.use_certificate_chain_file( directory + "/localhost.pem" );
+	context.use_private_key_file( directory + "/localhost.key", asio::ssl::context::pem );
+	tcp::acceptor acceptor( io, tcp::endpoint( asio::ip::address_v4::loopback(), 0 ) );
+	uint16_t port = acceptor.local_endpoint().port();
+
+	// reads the client's config frame, then drops the first connection once told to and keeps
+	// the second until the client goes away
+	std::atomic<bool> drop( false );
+	std::thread server( [&]() {
+		for ( int i = 0; i < 2; ++i ) {
+			tcp::socket socket( io );
+			acceptor.accept( socket );
+			asio::ssl::stream<tcp::socket&> stream( socket, context );
+			boost::system::error_code err;
+			stream.handshake( asio::ssl::stream_base::server, err );
+			asio::streambuf buffer;
+			if ( ! err )
+				asio::read_until( stream, buffer, '\n', err );
+			if ( i == 0 ) {
+				while ( ! drop )
+					std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+				// without a close_notify, like a router that restarted
+				socket.shutdown( tcp::socket::shutdown_send, err );
+			}
+			while ( ! err )
+				socket.read_some( asio::buffer( buffer.prepare( 4096 ) ), err );
+		}
+	} );
+
+	WebSocketTransport::TlsOptions options;
+	options.caFile = directory + "/localhost.pem";
+	WebSocketTransport::setTlsOptions( options );
+	{
+		auto connection = Connection::create( "wss://localhost", port, "TlsTest" );
+		connection->connect();
+		updateUntil( connection, [&]() { return connection->isConnected(); } );
+		CHECK( connection->getStats().tlsHandshakes == 1 );
+		CHECK( connection->getStats().tlsResumptions == 0 );
+		CHECK( connection->getStats().lastHandshakeSeconds > 0 );
+
+		drop = true;
+		updateUntil( connection, [&]() { return ! connection->isConnected(); } );
+		connection->connect();
+		updateUntil( connection, [&]() { return connection->isConnected(); } );
+		CHECK( connection->getStats().tlsHandshakes == 2 );
+		CHECK( connection->getStats().tlsResumptions == 1 );
+		CHECK( connection->getStats().lastHandshakeSeconds > 0 );
+	}
+	server.join();
+	return 0;
+}
@@ -0,0 +1,59 @@
+// Topology indexes, in particular a client routed to itself, which shows up once per route
+#include "ciSpaceBrew.h"
+#include "Check.h"
+
+using namespace Spacebrew;
+
+namespace {
+
+Json::Value parse( const std::string &text )
+{
+	Json::Value json;
+	Json::Reader reader;
+	CHECK( reader.parse( text, json ) );
+	return json;
+}
+
+std::string endpoint( const std::string &client, const std::string &name )
+{
+	return "{\"clientName\":\"" + client + "\",\"name\":\"" + name + "\",\"type\":\"range\",\"remoteAddress\":\"10.0.0.1\"}";
+}
+
+Json::Value route( const std::string &type, const std::string &publisher, const std::string &subscriber )
+{
+	return parse( "{\"route\":{\"type\":\"" + type + "\",\"publisher\":" + publisher + ",\"subscriber\":" + subscriber + "}}" );
+}
+
+}
+
+int main()
+{
+	Topology topology;
+	CHECK( topology.apply( parse( "{\"config\":{\"name\":\"slider\",\"remoteAddress\":\"10.0.0.1\",\"publish\":{\"messages\":[{\"name\":\"level\",\"type\":\"range\"}]},\"subscribe\":{\"messages\":[{\"name\":\"level\",\"type\":\"range\"},{\"name\":\"echo\",\"type\":\"range\"}]}}}" ) ) );
+	CHECK( topology.apply( parse( "{\"config\":{\"name\":\"meter\",\"remoteAddress\":\"10.0.0.1\",\"subscribe\":{\"messages\":[{\"name\":\"level\",\"type\":\"range\"}]}}}" ) ) );
+
+	// to the client's own subscriber of another name, and of the same name
+	CHECK( topology.apply( route( "add", endpoint( "slider", "level" ), endpoint( "slider", "echo" ) ) ) );
+	CHECK( topology.apply( route( "add", endpoint( "slider", "level" ), endpoint( "slider", "level" ) ) ) );
+	CHECK( topology.apply( route( "add", endpoint( "slider", "level" ), endpoint( "meter", "level" ) ) ) );
+	CHECK( ! topology.apply( route( "add", endpoint( "slider", "level" ), endpoint( "meter", "level" ) ) ) );
+
+	CHECK( topology.getRoutes( "slider", "10.0.0.1" ).size() == 3 );
+	CHECK( topology.getRoutes( "meter", "10.0.0.1" ).size() == 1 );
+	Route::Endpoint level;
+	level.clientName = "slider";
+	level.name = "level";
+	level.type = "range";
+	level.remoteAddress = "10.0.0.1";
+	CHECK( topology.getRoutes( level ).size() == 3 );
+
+	CHECK( topology.apply( route( "remove", endpoint( "slider", "level" ), endpoint( "slider", "level" ) ) ) );
+	CHECK( topology.getRoutes( "slider", "10.0.0.1" ).size() == 2 );
+	CHECK( topology.getRoutes( level ).size() == 2 );
+
+	CHECK( topology.apply( parse( "{\"remove\":[{\"name\":\"slider\",\"remoteAddress\":\"10.0.0.1\"}]}" ) ) );
+	CHECK( topology.getRoutes( "slider", "10.0.0.1" ).empty() );
+	CHECK( topology.getRoutes( "meter", "10.0.0.1" ).empty() );
+	CHECK( topology.getAllRoutes().empty() );
+	return 0;
+}
@@ -0,0 +1,52 @@
+#include "cinder/app/App.h"
+
+#include <chrono>
+
+namespace cinder { namespace app {
+
+namespace {
+
+std::function<void (const std::function<void ()>&)> sDispatchHook;
+double sElapsedSeconds = -1;
+
+}
+
+App* App::get()
+{
+	static App app;
+	return &app;
+}
+
+signals::Signal<void ()>& App::getSignalUpdate()
+{
+	static signals::Signal<void ()> update;
+	return update;
+}
+
+void App::dispatchAsync( const std::function<void ()> &fn )
+{
+	if( sDispatchHook )
+		sDispatchHook( fn );
+	else
+		fn();
+}
+
+void App::setDispatchHook( const std::function<void (const std::function<void ()>&)> &hook )
+{
+	sDispatchHook = hook;
+}
+
+double getElapsedSeconds()
+{
+	if( sElapsedSeconds >= 0 )
+		return sElapsedSeconds;
+	static auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void setElapsedSeconds( double seconds )
+{
+	sElapsedSeconds = seconds;
+}
+
+} } // namespace cinder::app
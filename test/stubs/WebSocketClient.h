@@ -0,0 +1,48 @@
+// Minimal stand-in for the Cinder-WebSocketPP client. It never connects: tests use the
+// LoopbackTransport or a Transport of their own instead.
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// the few websocketpp names the transport uses to find the client's socket
+#include <websocketpp/client.hpp>
+
+class WebSocketClient {
+  public:
+	class Client {
+	  public:
+		struct Socket {
+			int native_handle() { return -1; }
+		};
+		struct Connection {
+			Socket &get_raw_socket() { return mSocket; }
+			Socket mSocket;
+		};
+
+		void set_tcp_post_init_handler( const std::function<void (websocketpp::connection_hdl)> & ) {}
+		std::shared_ptr<Connection> get_con_from_hdl( websocketpp::connection_hdl, websocketpp::lib::error_code &err )
+		{
+			err = std::make_error_code( std::errc::not_connected );
+			return nullptr;
+		}
+	};
+
+	void connect( const std::string & ) {}
+	void disconnect() {}
+	void poll() {}
+	void write( const std::string & ) {}
+	void ping( const std::string & ) {}
+	Client &getClient() { return mClient; }
+
+	void connectOpenEventHandler( const std::function<void ()> & ) {}
+	void connectCloseEventHandler( const std::function<void ()> & ) {}
+	void connectInterruptEventHandler( const std::function<void ()> & ) {}
+	void connectFailEventHandler( const std::function<void (std::string)> & ) {}
+	void connectPingEventHandler( const std::function<void (std::string)> & ) {}
+	void connectMessageEventHandler( const std::function<void (std::string)> & ) {}
+
+  private:
+	Client mClient;
+};
@@ -0,0 +1,9 @@
+// Minimal stand-in for Cinder's header, enough to build the block's tests without Cinder
+#pragma once
+
+#include <iostream>
+
+#define CI_LOG_E( stream ) ( std::cerr << stream << std::endl )
+#define CI_LOG_W( stream ) ( std::cerr << stream << std::endl )
+#define CI_LOG_I( stream ) ( std::cerr << stream << std::endl )
+#define CI_LOG_V( stream ) ( std::cerr << stream << std::endl )
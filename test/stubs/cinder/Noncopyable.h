@@ -0,0 +1,18 @@
+// Minimal stand-in for Cinder's header, enough to build the block's tests without Cinder
+#pragma once
+
+namespace cinder {
+
+class Noncopyable {
+  protected:
+	Noncopyable() {}
+	~Noncopyable() {}
+
+  private:
+	Noncopyable( const Noncopyable& );
+	Noncopyable& operator=( const Noncopyable& );
+};
+
+}
+
+namespace ci = cinder;
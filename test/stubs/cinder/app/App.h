@@ -0,0 +1,95 @@
+// Minimal stand-in for Cinder's header, enough to build the block's tests without Cinder
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cinder/Noncopyable.h"
+
+namespace cinder { namespace signals {
+
+class Connection {
+  public:
+	Connection() {}
+	Connection( const std::function<void ()> &disconnect, const std::shared_ptr<bool> &alive )
+	: mDisconnect( disconnect ), mAlive( alive ) {}
+
+	void disconnect()
+	{
+		if( mAlive && *mAlive ) {
+			*mAlive = false;
+			mDisconnect();
+		}
+	}
+	bool isConnected() const { return mAlive && *mAlive; }
+
+  private:
+	std::function<void ()>	mDisconnect;
+	std::shared_ptr<bool>	mAlive;
+};
+
+template<typename Signature>
+class Signal;
+
+template<typename R, typename... Args>
+class Signal<R (Args...)> {
+  public:
+	Connection connect( const std::function<R (Args...)> &callback )
+	{
+		auto alive = std::make_shared<bool>( true );
+		mSlots->push_back( Slot{ callback, alive } );
+		auto slots = mSlots;
+		return Connection( [slots] {
+			for( size_t i = 0; i < slots->size(); ++i ) {
+				if( ! *(*slots)[i].alive ) {
+					slots->erase( slots->begin() + i );
+					break;
+				}
+			}
+		}, alive );
+	}
+
+	//! Like Cinder's, emitting doesn't allocate. Slots connected during emit() wait for the next one.
+	void emit( Args... args )
+	{
+		auto slots = mSlots;
+		size_t count = slots->size();
+		for( size_t i = 0; i < count && i < slots->size(); ++i ) {
+			if( *(*slots)[i].alive )
+				(*slots)[i].callback( args... );
+		}
+	}
+
+	size_t getNumSlots() const { return mSlots->size(); }
+
+  private:
+	struct Slot {
+		std::function<R (Args...)>	callback;
+		std::shared_ptr<bool>		alive;
+	};
+	std::shared_ptr<std::vector<Slot>>	mSlots = std::make_shared<std::vector<Slot>>();
+};
+
+} // namespace signals
+
+namespace app {
+
+class App {
+  public:
+	static App*						get();
+	signals::Signal<void ()>&		getSignalUpdate();
+	//! Runs \a fn right away, or hands it to setDispatchHook()'s hook
+	void							dispatchAsync( const std::function<void ()> &fn );
+
+	//! Test hook that receives dispatchAsync() calls instead of running them
+	static void						setDispatchHook( const std::function<void (const std::function<void ()>&)> &hook );
+};
+
+double getElapsedSeconds();
+//! Test hook that stops getElapsedSeconds() at \a seconds, a negative value lets it run again
+void setElapsedSeconds( double seconds );
+
+} } // namespace cinder::app
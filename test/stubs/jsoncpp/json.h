@@ -0,0 +1,4 @@
+// Cinder ships jsoncpp as "jsoncpp/json.h", the system package as <json/json.h>
+#pragma once
+
+#include <json/json.h>
@@ -0,0 +1,41 @@
+// Minimal stand-in for websocketpp, with only the names the block uses. The TLS client in
+// config/asio_client.hpp is real as far as TLS goes, it handshakes through OpenSSL over
+// Boost.Asio, but it sends newline separated text frames instead of the websocket protocol.
+// TlsTest's server speaks the same.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+
+namespace websocketpp {
+
+typedef std::weak_ptr<void> connection_hdl;
+
+namespace lib {
+using std::shared_ptr;
+using std::make_shared;
+typedef std::error_code error_code;
+}
+
+namespace close { namespace status {
+typedef uint16_t value;
+static const value going_away = 1001;
+} }
+
+namespace frame { namespace opcode {
+enum value { text = 1, binary = 2 };
+} }
+
+namespace log {
+struct alevel { static const uint32_t all = 0xffffffff; };
+struct elevel { static const uint32_t all = 0xffffffff; };
+}
+
+//! Each config names its endpoint type
+template<typename config>
+using client = typename config::client_type;
+
+} // namespace websocketpp
@@ -0,0 +1,260 @@
+// Stand-in for websocketpp's TLS client config, see ../client.hpp. Connections resolve, connect
+// and handshake asynchronously on the client's io_context, which poll() runs. Like websocketpp,
+// a connection that was opened ends with the close handler and one that wasn't with the fail
+// handler. close() drops the connection without a closing handshake.
+#pragma once
+
+#include <websocketpp/client.hpp>
+
+// older Boost.Asio uses std::exchange in C++20 without including it
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <deque>
+
+namespace websocketpp {
+
+namespace lib { namespace asio {
+using namespace boost::asio;
+typedef boost::system::error_code error_code;
+} }
+
+namespace detail {
+
+//! Host and port of a wss:// url
+class uri {
+  public:
+	uri( const std::string &host, uint16_t port ) : m_host( host ), m_port( port ) {}
+
+	std::string const & get_host() const { return m_host; }
+	uint16_t get_port() const { return m_port; }
+
+  private:
+	std::string	m_host;
+	uint16_t	m_port;
+};
+
+class tls_connection : public std::enable_shared_from_this<tls_connection> {
+  public:
+	typedef lib::asio::ssl::stream<lib::asio::ip::tcp::socket> socket_type;
+
+	explicit tls_connection( const std::shared_ptr<uri> &location ) : m_uri( location ) {}
+
+	std::shared_ptr<uri> get_uri() const { return m_uri; }
+	connection_hdl get_handle() { return shared_from_this(); }
+	socket_type::lowest_layer_type & get_raw_socket() { return m_stream->lowest_layer(); }
+	lib::error_code get_ec() const { return m_ec; }
+
+  private:
+	std::shared_ptr<uri>						m_uri;
+	std::shared_ptr<lib::asio::ssl::context>	m_context;
+	//! Made on connect, once the tls init handler gave a context
+	std::unique_ptr<socket_type>				m_stream;
+	lib::asio::streambuf						m_read;
+	//! Frames being written, the front one is in flight
+	std::deque<std::string>						m_writes;
+	lib::error_code								m_ec;
+	bool										m_open = false, m_closed = false;
+
+	friend class tls_client;
+};
+
+class tls_client {
+  public:
+	typedef std::shared_ptr<tls_connection> connection_ptr;
+
+	class message {
+	  public:
+		explicit message( std::string payload ) : m_payload( std::move( payload ) ) {}
+		std::string const & get_payload() const { return m_payload; }
+
+	  private:
+		std::string m_payload;
+	};
+	typedef std::shared_ptr<message> message_ptr;
+
+	typedef std::function<void (connection_hdl)> handler;
+
+	tls_client() : m_resolver( m_io ) {}
+
+	~tls_client()
+	{
+		// runs what's pending to completion without calling back, asio objects mustn't outlive m_io
+		m_destroying = true;
+		m_resolver.cancel();
+		if ( m_connection && m_connection->m_stream ) {
+			lib::asio::error_code ignored;
+			m_connection->m_stream->lowest_layer().close( ignored );
+		}
+		m_io.restart();
+		m_io.poll();
+		m_connection.reset();
+	}
+
+	void clear_access_channels( uint32_t ) {}
+	void clear_error_channels( uint32_t ) {}
+	void init_asio() {}
+
+	void set_tls_init_handler( std::function<std::shared_ptr<lib::asio::ssl::context> (connection_hdl)> h ) { m_tls_init = h; }
+	void set_socket_init_handler( std::function<void (connection_hdl, tls_connection::socket_type&)> h ) { m_socket_init = h; }
+	void set_tcp_post_init_handler( handler h ) { m_tcp_post_init = h; }
+	void set_open_handler( handler h ) { m_open = h; }
+	void set_close_handler( handler h ) { m_close = h; }
+	void set_interrupt_handler( handler h ) { m_interrupt = h; }
+	void set_fail_handler( handler h ) { m_fail = h; }
+	void set_message_handler( std::function<void (connection_hdl, message_ptr)> h ) { m_message = h; }
+
+	//! Accepts wss://host[:port][/path] only
+	connection_ptr get_connection( const std::string &url, lib::error_code &ec )
+	{
+		const std::string scheme = "wss://";
+		size_t begin = scheme.size();
+		size_t end = url.find( '/', begin );
+		std::string authority = url.compare( 0, begin, scheme ) == 0 ? url.substr( begin, end - begin ) : "";
+		size_t colon = authority.find( ':' );
+		long port = colon == std::string::npos ? 443 : std::strtol( authority.c_str() + colon + 1, nullptr, 10 );
+		if ( authority.empty() || colon == 0 || port <= 0 || port > 65535 ) {
+			ec = std::make_error_code( std::errc::invalid_argument );
+			return nullptr;
+		}
+		ec = lib::error_code();
+		return std::make_shared<tls_connection>( std::make_shared<uri>( authority.substr( 0, colon ), static_cast<uint16_t>( port ) ) );
+	}
+
+	connection_ptr get_con_from_hdl( connection_hdl hdl, lib::error_code &ec )
+	{
+		connection_ptr con = std::static_pointer_cast<tls_connection>( hdl.lock() );
+		ec = con ? lib::error_code() : std::make_error_code( std::errc::not_connected );
+		return con;
+	}
+
+	void connect( connection_ptr con )
+	{
+		m_connection = con;
+		con->m_context = m_tls_init ? m_tls_init( con->get_handle() ) : nullptr;
+		if ( ! con->m_context ) {
+			finish( con, std::make_error_code( std::errc::protocol_error ) );
+			return;
+		}
+		con->m_stream.reset( new tls_connection::socket_type( m_io, *con->m_context ) );
+		if ( m_socket_init )
+			m_socket_init( con->get_handle(), *con->m_stream );
+
+		m_resolver.async_resolve( con->m_uri->get_host(), std::to_string( con->m_uri->get_port() ),
+			[this, con]( const lib::asio::error_code &ec, lib::asio::ip::tcp::resolver::results_type results ) {
+				if ( ec )
+					return finish( con, ec );
+				lib::asio::async_connect( con->m_stream->lowest_layer(), results,
+					[this, con]( const lib::asio::error_code &ec, const lib::asio::ip::tcp::endpoint& ) {
+						if ( ec )
+							return finish( con, ec );
+						if ( m_tcp_post_init )
+							m_tcp_post_init( con->get_handle() );
+						con->m_stream->async_handshake( lib::asio::ssl::stream_base::client, [this, con]( const lib::asio::error_code &ec ) {
+							if ( ec )
+								return finish( con, ec );
+							con->m_open = true;
+							if ( m_open )
+								m_open( con->get_handle() );
+							read( con );
+						} );
+					} );
+			} );
+	}
+
+	void close( connection_hdl hdl, close::status::value, const std::string&, lib::error_code &ec )
+	{
+		connection_ptr con = get_con_from_hdl( hdl, ec );
+		if ( ! con || con->m_closed )
+			return;
+		// like websocketpp, the handler runs from poll()
+		lib::asio::post( m_io, [this, con]() {
+			if ( con->m_stream ) {
+				lib::asio::error_code ignored;
+				con->m_stream->lowest_layer().close( ignored );
+			}
+			finish( con, lib::error_code() );
+		} );
+	}
+
+	void send( connection_hdl hdl, const std::string &payload, frame::opcode::value, lib::error_code &ec )
+	{
+		connection_ptr con = get_con_from_hdl( hdl, ec );
+		if ( con && ( ! con->m_open || con->m_closed ) )
+			ec = std::make_error_code( std::errc::not_connected );
+		if ( ec )
+			return;
+		con->m_writes.push_back( payload + '\n' );
+		if ( con->m_writes.size() == 1 )
+			write( con );
+	}
+
+	size_t poll()
+	{
+		size_t count = m_io.poll();
+		if ( m_io.stopped() )
+			m_io.restart();
+		return count;
+	}
+
+  private:
+	void read( const connection_ptr &con )
+	{
+		lib::asio::async_read_until( *con->m_stream, con->m_read, '\n', [this, con]( const lib::asio::error_code &ec, size_t length ) {
+			if ( ec )
+				return finish( con, ec );
+			auto data = con->m_read.data();
+			std::string payload( lib::asio::buffers_begin( data ), lib::asio::buffers_begin( data ) + length - 1 );
+			con->m_read.consume( length );
+			if ( m_message && ! m_destroying )
+				m_message( con->get_handle(), std::make_shared<message>( std::move( payload ) ) );
+			if ( ! con->m_closed )
+				read( con );
+		} );
+	}
+
+	void write( const connection_ptr &con )
+	{
+		lib::asio::async_write( *con->m_stream, lib::asio::buffer( con->m_writes.front() ), [this, con]( const lib::asio::error_code &ec, size_t ) {
+			if ( ec )
+				return finish( con, ec );
+			con->m_writes.pop_front();
+			if ( ! con->m_writes.empty() )
+				write( con );
+		} );
+	}
+
+	//! Ends \a con once, with the close handler if it was open and the fail handler if not
+	void finish( const connection_ptr &con, const lib::error_code &ec )
+	{
+		if ( m_destroying || con->m_closed )
+			return;
+		con->m_closed = true;
+		con->m_ec = ec;
+		handler &h = con->m_open ? m_close : m_fail;
+		if ( h )
+			h( con->get_handle() );
+	}
+
+	lib::asio::io_context				m_io;
+	lib::asio::ip::tcp::resolver		m_resolver;
+	connection_ptr						m_connection;
+	bool								m_destroying = false;
+
+	std::function<std::shared_ptr<lib::asio::ssl::context> (connection_hdl)>	m_tls_init;
+	std::function<void (connection_hdl, tls_connection::socket_type&)>		m_socket_init;
+	handler			m_tcp_post_init, m_open, m_close, m_interrupt, m_fail;
+	std::function<void (connection_hdl, message_ptr)>							m_message;
+};
+
+} // namespace detail
+
+namespace config {
+struct asio_tls_client {
+	typedef detail::tls_client client_type;
+};
+}
+
+} // namespace websocketpp